@@ -11,9 +11,11 @@
 //	we use ReadFrom/WriteBack to fetch the contents of the directory
 //	from disk, and to write back any modifications back to disk.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	The table grows (doubling) when all of its entries are in use;
+//	the file system then extends the directory file to match.  Names
+//	are looked up through an in-core hash index, rebuilt whenever the
+//	table is fetched from disk, so lookups do not depend on the size
+//	of the directory.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -21,12 +23,17 @@
 
 #include "copyright.h"
 #include "utility.h"
+#include "debug.h"
 #include "filehdr.h"
 #include "directory.h"
 
 // TODO
 #define NumDirEntries 64
 
+// Special values in the hash index
+#define EmptySlot -1   // never used: ends a probe sequence
+#define DeletedSlot -2 // name removed: probing goes on past it
+
 //----------------------------------------------------------------------
 // Directory::Directory
 // 	Initialize a directory; initially, the directory is completely
@@ -39,18 +46,10 @@
 
 Directory::Directory(int size)
 {
-    table = new DirectoryEntry[size];
-
-    // MP4 mod tag
-    memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
-
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++) {
-        table[i].inUse = FALSE;
-
-        // TODO
-        table[i].isDir = FALSE;
-    }
+    table = NULL;
+    index = NULL;
+    tableSize = 0;
+    Resize(size);
 
     // TODO
     indentation = 0;
@@ -64,32 +63,146 @@ Directory::Directory(int size)
 Directory::~Directory()
 {
     delete[] table;
+    delete[] index;
+}
+
+//----------------------------------------------------------------------
+// Directory::Resize
+// 	Change the table to "size" entries, keeping the existing ones
+//	(the new ones are unused), and rebuild the hash index to match.
+//----------------------------------------------------------------------
+
+void Directory::Resize(int size)
+{
+    DirectoryEntry *newTable = new DirectoryEntry[size];
+
+    // MP4 mod tag
+    memset(newTable, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
+
+    for (int i = 0; i < size; i++) {
+        if (i < tableSize) {
+            newTable[i] = table[i];
+        } else {
+            newTable[i].inUse = FALSE;
+
+            // TODO
+            newTable[i].isDir = FALSE;
+        }
+    }
+    delete[] table;
+    table = newTable;
+    tableSize = size;
+    BuildIndex();
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// 	Read the contents of the directory from disk.  The table is
+//	resized to fit the whole directory file.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void Directory::FetchFrom(OpenFile *file)
 {
+    int size = file->Length() / sizeof(DirectoryEntry);
+
+    if (size != tableSize) {
+        delete[] table;
+        table = new DirectoryEntry[size];
+        tableSize = size;
+    }
     (void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    BuildIndex();
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// 	Write any modifications to the directory back to disk.  The file
+//	must already be FileSize() bytes long.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
 void Directory::WriteBack(OpenFile *file)
 {
+    ASSERT(file->Length() >= FileSize());
     (void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
 }
 
+//----------------------------------------------------------------------
+// HashName
+// 	Hash a file name (at most FileNameMaxLen characters matter), FNV-1a.
+//----------------------------------------------------------------------
+
+static unsigned
+HashName(char *name)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//----------------------------------------------------------------------
+// Directory::BuildIndex
+// 	Throw away the hash index and build it again from the entries
+//	in use in the table.
+//----------------------------------------------------------------------
+
+void Directory::BuildIndex()
+{
+    delete[] index;
+    for (indexSize = 16; indexSize < 2 * tableSize; indexSize *= 2)
+        ;
+    index = new int[indexSize];
+    for (int s = 0; s < indexSize; s++)
+        index[s] = EmptySlot;
+    numDeleted = 0;
+    freeHint = 0;
+
+    for (int i = 0; i < tableSize; i++)
+        if (table[i].inUse)
+            IndexInsert(i);
+}
+
+//----------------------------------------------------------------------
+// Directory::IndexInsert
+// 	Put table entry "i" into the hash index, in the first free or
+//	deleted slot of its probe sequence.
+//----------------------------------------------------------------------
+
+void Directory::IndexInsert(int i)
+{
+    int s = HashName(table[i].name) & (indexSize - 1);
+
+    while (index[s] >= 0)
+        s = (s + 1) & (indexSize - 1);
+    if (index[s] == DeletedSlot)
+        numDeleted--;
+    index[s] = i;
+}
+
+//----------------------------------------------------------------------
+// Directory::FindSlot
+// 	Return the hash index slot that refers to "name", or -1 if the
+//	name isn't in the directory.
+//----------------------------------------------------------------------
+
+int Directory::FindSlot(char *name)
+{
+    int s = HashName(name) & (indexSize - 1);
+
+    for (; index[s] != EmptySlot; s = (s + 1) & (indexSize - 1))
+        if (index[s] >= 0 &&
+            !strncmp(table[index[s]].name, name, FileNameMaxLen))
+            return s;
+    return -1; // name not in directory
+}
+
 //----------------------------------------------------------------------
 // Directory::FindIndex
 // 	Look up file name in directory, and return its location in the table of
@@ -100,10 +213,11 @@ void Directory::WriteBack(OpenFile *file)
 
 int Directory::FindIndex(char *name)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
-            return i;
-    return -1; // name not in directory
+    int s = FindSlot(name);
+
+    if (s == -1)
+        return -1; // name not in directory
+    return index[s];
 }
 
 //----------------------------------------------------------------------
@@ -127,9 +241,9 @@ int Directory::Find(char *name)
 //----------------------------------------------------------------------
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
-//	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	return FALSE if the file name is already in the directory.
+//	If the table is full, it is doubled; FileSize() then tells how
+//	big the directory file has to grow.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
@@ -137,21 +251,29 @@ int Directory::Find(char *name)
 
 bool Directory::Add(char *name, int newSector, bool isDir) // TODO
 {
+    int i;
+
     if (FindIndex(name) != -1)
         return FALSE;
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse)
-        {
-            //TODO
-            table[i].isDir = isDir;
+    for (i = freeHint; i < tableSize && table[i].inUse; i++)
+        ;
+    if (i == tableSize) // no space: grow the table
+        Resize(2 * tableSize);
+    freeHint = i + 1;
 
-            table[i].inUse = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
-        }
-    return FALSE; // no space.  Fix when we have extensible files.
+    //TODO
+    table[i].isDir = isDir;
+
+    table[i].inUse = TRUE;
+    strncpy(table[i].name, name, FileNameMaxLen);
+    table[i].sector = newSector;
+
+    if (4 * numDeleted > indexSize)
+        BuildIndex(); // too many deleted slots to probe past
+    else
+        IndexInsert(i);
+    return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -164,11 +286,14 @@ bool Directory::Add(char *name, int newSector, bool isDir) // TODO
 
 bool Directory::Remove(char *name)
 {
-    int i = FindIndex(name);
+    int s = FindSlot(name);
 
-    if (i == -1)
+    if (s == -1)
         return FALSE; // name not in directory
-    table[i].inUse = FALSE;
+    table[index[s]].inUse = FALSE;
+    freeHint = min(freeHint, index[s]);
+    index[s] = DeletedSlot;
+    numDeleted++;
     return TRUE;
 }
 
@@ -216,28 +341,112 @@ bool Directory::IsDir(char *name)
     return i >= 0 && table[i].isDir;
 }
 
-void Directory::RecursiveList() 
+//----------------------------------------------------------------------
+// Directory::RecursiveList
+// 	List all the file names in the directory and in every directory
+//	below it, each indented by how deep it is.
+//----------------------------------------------------------------------
+
+void Directory::RecursiveList()
+{
+    DirectoryWalker walker(this);
+    DirectoryEntry *entry;
+
+    while ((entry = walker.Next()) != NULL) {
+        char type = entry->isDir ? 'D' : 'F';
+        for (int j = 0; j < indentation + walker.Depth(); j++)
+            printf("\t");
+        printf("[%c]: %s\n", type, entry->name);
+    }
+}
+
+// One directory being walked: its table, and where we are in it
+class DirectoryWalk
 {
-    Directory *subDirectory = new Directory(NumDirEntries);	
-	OpenFile *tempFile;
+public:
+    Directory *directory;
+    int next;   // index of the next entry to look at
+    bool owned; // read in by the walker, which deletes it
+};
 
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
-            char type = table[i].isDir ? 'D' : 'F';
-            for(int j = 0; j < indentation; j++) printf("\t");
-            printf("[%c]: %s\n", type, table[i].name);
-            if (table[i].isDir) {
-                tempFile = new OpenFile(table[i].sector);
-                subDirectory->FetchFrom(tempFile);
-                DirectoryEntry *subTable = subDirectory->GetTable();
-                for (int j = 0; j < tableSize; j++)
-                    if(subTable[j].inUse){
-                        subDirectory->indentation = indentation + 1;
-                        break;
-                    } 
-                subDirectory->RecursiveList();
-            }
+//----------------------------------------------------------------------
+// DirectoryWalker::DirectoryWalker
+// 	Start a walk of the tree below "root".
+//----------------------------------------------------------------------
+
+DirectoryWalker::DirectoryWalker(Directory *root)
+{
+    DirectoryWalk *walk = new DirectoryWalk;
+
+    walk->directory = root;
+    walk->next = 0;
+    walk->owned = FALSE;
+    stack = new List<DirectoryWalk *>;
+    stack->Prepend(walk);
+    depth = 0;
+    dirsRead = 0;
+}
+
+//----------------------------------------------------------------------
+// DirectoryWalker::~DirectoryWalker
+// 	Free the directories read in, if the walk was left unfinished.
+//----------------------------------------------------------------------
+
+DirectoryWalker::~DirectoryWalker()
+{
+    DirectoryWalk *walk;
+
+    while (!stack->IsEmpty()) {
+        walk = stack->RemoveFront();
+        if (walk->owned)
+            delete walk->directory;
+        delete walk;
+    }
+    delete stack;
+}
+
+//----------------------------------------------------------------------
+// DirectoryWalker::Next
+// 	Return the next entry of the walk, or NULL when every entry has
+//	been returned.  If it is a directory, read it in, so that its
+//	entries come next.
+//----------------------------------------------------------------------
+
+DirectoryEntry *
+DirectoryWalker::Next()
+{
+    DirectoryWalk *walk, *sub;
+    DirectoryEntry *entry;
+    OpenFile *file;
+
+    while (!stack->IsEmpty()) {
+        walk = stack->Front();
+        while (walk->next < walk->directory->GetTableSize() &&
+               !walk->directory->GetTable()[walk->next].inUse)
+            walk->next++;
+        if (walk->next == walk->directory->GetTableSize()) {
+            stack->RemoveFront(); // done with this one
+            if (walk->owned)
+                delete walk->directory;
+            delete walk;
+            continue;
         }
 
+        entry = &walk->directory->GetTable()[walk->next++];
+        depth = stack->NumInList() - 1;
+        if (entry->isDir) {
+            sub = new DirectoryWalk;
+            sub->directory = new Directory(NumDirEntries);
+            file = new OpenFile(entry->sector);
+            sub->directory->FetchFrom(file);
+            delete file;
+            sub->next = 0;
+            sub->owned = TRUE;
+            stack->Prepend(sub); // "entry" stays valid: its table
+                                 // is still on the stack
+            dirsRead++;
+        }
+        return entry;
     }
+    return NULL;
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 #define DIRECTORY_H
 
 #include "openfile.h"
+#include "list.h"
 
 #define FileNameMaxLen 9 // for simplicity, we assume \
                          // file names are <= 9 characters long
@@ -51,6 +52,11 @@ public:
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
 // from/to disk.
+//
+// In memory, the names are also kept in a hash index (open addressing,
+// linear probing), so finding a name does not scan the whole table.
+// When the table is full, Add doubles it; the caller must then grow
+// the directory file to FileSize() bytes before writing it back.
 
 class Directory
 {
@@ -83,6 +89,8 @@ public:
     void RecursiveList();
     DirectoryEntry* GetTable() { return table; }
     int GetTableSize() { return tableSize; }
+    int FileSize() { return tableSize * sizeof(DirectoryEntry); }
+                   // Bytes the directory file needs to hold the table
     int indentation;
 
 private:
@@ -97,8 +105,49 @@ private:
     DirectoryEntry *table; // Table of pairs:
                            // <file name, file header location>
 
+    int *index;            // Hash index over the names in "table":
+                           //  each slot is a table index, or
+                           //  EmptySlot / DeletedSlot
+    int indexSize;         // Number of slots, a power of two
+                           //  at least twice tableSize
+    int numDeleted;        // Slots holding DeletedSlot
+    int freeHint;          // No free table entry below this one
+
     int FindIndex(char *name); // Find the index into the directory
                                //  table corresponding to "name"
+    int FindSlot(char *name);  // Find the index slot holding "name"
+    void IndexInsert(int i);   // Add table[i] to the index
+    void BuildIndex();         // Rebuild the index from the table
+    void Resize(int size);     // Change the table to "size" entries
+};
+
+// The following class walks the tree below a directory, depth first,
+// handing out each entry before the ones below it.  Subdirectories are
+// read from disk by the sector of their header, not by path, and the
+// walk keeps its own stack, so the tree can be of any depth.
+//
+// A subdirectory is read in when its entry is handed out; the caller
+// may then free its sectors.
+
+class DirectoryWalk;
+
+class DirectoryWalker
+{
+public:
+    DirectoryWalker(Directory *root); // Walk the tree below "root",
+                                      //  which stays the caller's
+    ~DirectoryWalker();
+
+    DirectoryEntry *Next(); // The next entry, or NULL at the end
+    int Depth() { return depth; } // How far below the root the
+                                  //  last entry returned was
+    int DirsRead() { return dirsRead; } // Subdirectories read so far
+
+private:
+    List<DirectoryWalk *> *stack; // The directories being walked,
+                                  //  innermost first
+    int depth;
+    int dirsRead;
 };
 
 #endif // DIRECTORY_H
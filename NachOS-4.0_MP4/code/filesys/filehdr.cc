@@ -58,7 +58,8 @@ FileHeader::~FileHeader()
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 // 	Initialize a fresh file header for a newly created file.
-//	Allocate data blocks for the file out of the map of free disk blocks.
+//	Allocate data blocks for the file out of the map of free disk blocks,
+//	unless the file is small enough to be kept in the header.
 //	Return FALSE if there are not enough free blocks to accomodate
 //	the new file.
 //
@@ -67,10 +68,27 @@ FileHeader::~FileHeader()
 //----------------------------------------------------------------------
 
 bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+{
+	if (fileSize <= (int)InlineSize) {
+		numBytes = fileSize;
+		numSectors = 0;
+		memset(dataSectors, 0, sizeof(dataSectors));
+		return TRUE;
+	}
+	return AllocateBlocks(freeMap, fileSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateBlocks
+// 	Allocate, giving the file data blocks however small it is.  Used
+//	for big files, and for the sub-headers of a big file.
+//----------------------------------------------------------------------
+
+bool FileHeader::AllocateBlocks(PersistentBitmap *freeMap, int fileSize)
 {
 	numBytes = fileSize;
 	numSectors = divRoundUp(fileSize, SectorSize);
-	if (freeMap->NumClear() < numSectors)
+	if (freeMap->NumClear() < numSectors + SubHeaders(fileSize))
 		return FALSE; // not enough space
 
 	// TODO
@@ -112,10 +130,18 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 {
 	// TODO
 	if (numBytes > MaxFileSize1) {
-		for (int i = 0; i < numSectors; i++){
+		int maxFileSize = MaxFileSize1;
+		if (numBytes > MaxFileSize3) maxFileSize = MaxFileSize3;
+		else if (numBytes > MaxFileSize2) maxFileSize = MaxFileSize2;
+
+		// one sub-header per maxFileSize bytes, see RecursiveAllocate
+		for (int i = 0; i < divRoundUp(numBytes, maxFileSize); i++){
 			FileHeader *subHdr = new FileHeader;
 			subHdr->FetchFrom(dataSectors[i]);
 			subHdr->Deallocate(freeMap);
+			delete subHdr;
+			ASSERT(freeMap->Test((int) dataSectors[i]));
+			freeMap->Clear((int) dataSectors[i]);
 		}
 	} else {
 		for (int i = 0; i < numSectors; i++) {
@@ -131,6 +157,206 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 	// }
 }
 
+//----------------------------------------------------------------------
+// FileHeader::ChildSize
+// 	Return how many bytes of a file of "fileSize" bytes each entry of
+//	its header's dataSectors covers: one sector for a direct header,
+//	otherwise a whole sub-header of the next level down (see Allocate).
+//----------------------------------------------------------------------
+
+int
+FileHeader::ChildSize(int fileSize)
+{
+	if (fileSize > MaxFileSize3) return MaxFileSize3;
+	if (fileSize > MaxFileSize2) return MaxFileSize2;
+	if (fileSize > MaxFileSize1) return MaxFileSize1;
+	return SectorSize;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SubHeaders
+// 	Return how many sectors of sub-headers a file of "fileSize" bytes
+//	has, at every level.  The tree only depends on the size: each
+//	level is full but for its last entry, whether the file was made
+//	that big at once (Allocate) or grew to it (Extend, which pushes a
+//	full header down a level instead).
+//----------------------------------------------------------------------
+
+int
+FileHeader::SubHeaders(int fileSize)
+{
+	int childSize, full;
+
+	if (fileSize <= (int)MaxFileSize1)
+		return 0; // data sectors only
+	childSize = ChildSize(fileSize);
+	full = (fileSize - 1) / childSize; // the children before the last
+	return full * (1 + SubHeaders(childSize)) +
+		   1 + SubHeaders(fileSize - full * childSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ExtendNeeds
+// 	Return how many free sectors Extend takes to grow the file to
+//	"newSize" bytes, and checks for first: the new data sectors and
+//	sub-headers.  None if the file stays in its header.
+//----------------------------------------------------------------------
+
+int
+FileHeader::ExtendNeeds(int newSize)
+{
+	if (newSize <= numBytes || (IsInline() && newSize <= (int)InlineSize))
+		return 0;
+	return BlocksNeeded(newSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::BlocksNeeded
+// 	The same for ExtendBlocks, which gives even a small file (or
+//	sub-header) data blocks.  The header must have been allocated.
+//----------------------------------------------------------------------
+
+int
+FileHeader::BlocksNeeded(int newSize)
+{
+	if (newSize <= numBytes)
+		return 0;
+	return divRoundUp(newSize, SectorSize) - numSectors +
+		   SubHeaders(newSize) - SubHeaders(numBytes);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Grow the file to "newSize" bytes, allocating data blocks (and
+//	sub-headers) for the new part out of "freeMap".  The header itself
+//	is only changed in memory; the caller writes it back.  Return
+//	FALSE, changing nothing, if the disk does not have enough room.
+//
+//	When the new size needs one more level of sub-headers, the header
+//	is first filled up to the largest size its level can describe and
+//	moved down into a new sub-header, which becomes the first child of
+//	the (now deeper) header.
+//
+//	A file kept in the header stays there while it fits; otherwise its
+//	data is first moved out to a data block of its own.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newSize" is the new length of the file, in bytes
+//----------------------------------------------------------------------
+
+bool FileHeader::Extend(PersistentBitmap *freeMap, int newSize)
+{
+	char data[SectorSize];
+	int sector;
+
+	if (newSize <= numBytes || !IsInline())
+		return ExtendBlocks(freeMap, newSize);
+
+	if (newSize <= (int)InlineSize) {
+		memset(InlineData() + numBytes, 0, newSize - numBytes);
+		numBytes = newSize;
+		return TRUE;
+	}
+
+	// check for room first, as ExtendBlocks does: once the data is
+	// moved out there is no going back
+	if (freeMap->NumClear() < ExtendNeeds(newSize))
+		return FALSE; // not enough space
+
+	if (numBytes > 0) {
+		memset(data, 0, SectorSize);
+		bcopy(InlineData(), data, numBytes);
+		sector = freeMap->FindAndSet();
+		ASSERT(sector >= 0);
+		kernel->synchDisk->WriteSector(sector, data);
+		memset(dataSectors, -1, sizeof(dataSectors));
+		dataSectors[0] = sector;
+		numSectors = 1;
+	} else
+		memset(dataSectors, -1, sizeof(dataSectors));
+	return ExtendBlocks(freeMap, newSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ExtendBlocks
+// 	Extend a file (or sub-header) that has data blocks.
+//----------------------------------------------------------------------
+
+bool FileHeader::ExtendBlocks(PersistentBitmap *freeMap, int newSize)
+{
+	int childSize, full, sector;
+	FileHeader *child;
+
+	if (newSize <= numBytes)
+		return TRUE;
+	if (numBytes < 0) // fresh header, not allocated yet
+		numBytes = numSectors = 0;
+
+	if (freeMap->NumClear() < BlocksNeeded(newSize))
+		return FALSE; // not enough space
+
+	childSize = ChildSize(numBytes);
+	while (ChildSize(newSize) > childSize) {
+		// fill this level, then push the whole header down one level
+		full = NumDirect * childSize;
+		ExtendLevel(freeMap, full, childSize);
+		sector = freeMap->FindAndSet();
+		ASSERT(sector >= 0);
+		child = new FileHeader;
+		*child = *this;
+		child->WriteBack(sector);
+		delete child;
+		memset(dataSectors, -1, sizeof(dataSectors));
+		dataSectors[0] = sector;
+		childSize = full;
+	}
+	ExtendLevel(freeMap, newSize, childSize);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ExtendLevel
+// 	Grow the file to "newSize" bytes without changing the depth of
+//	the header: each dataSectors entry keeps covering "childSize" bytes.
+//	The last child, if partly used, is grown first; then new children
+//	are added.
+//----------------------------------------------------------------------
+
+void FileHeader::ExtendLevel(PersistentBitmap *freeMap, int newSize, int childSize)
+{
+	int i, oldChildren, newChildren;
+	FileHeader *child;
+
+	ASSERT(newSize <= (int)NumDirect * childSize);
+	if (childSize == SectorSize) {
+		for (i = numSectors; i < divRoundUp(newSize, SectorSize); i++) {
+			dataSectors[i] = freeMap->FindAndSet();
+			ASSERT(dataSectors[i] >= 0);
+		}
+	} else {
+		oldChildren = divRoundUp(numBytes, childSize);
+		newChildren = divRoundUp(newSize, childSize);
+		for (i = max(oldChildren - 1, 0); i < newChildren; i++) {
+			child = new FileHeader;
+			if (i < oldChildren) {
+				if (numBytes - i * childSize == childSize) {
+					delete child; // already full
+					continue;
+				}
+				child->FetchFrom(dataSectors[i]);
+			} else {
+				dataSectors[i] = freeMap->FindAndSet();
+				ASSERT(dataSectors[i] >= 0);
+			}
+			child->ExtendBlocks(freeMap, min(newSize - i * childSize, childSize));
+			child->WriteBack(dataSectors[i]);
+			delete child;
+		}
+	}
+	numBytes = newSize;
+	numSectors = divRoundUp(newSize, SectorSize);
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
 // 	Fetch contents of file header from disk.
@@ -181,6 +407,8 @@ void FileHeader::WriteBack(int sector)
 
 int FileHeader::ByteToSector(int offset)
 {
+	ASSERT(!IsInline());
+
 	// TODO
 	if (numBytes > MaxFileSize3) return RecursiveByteToSector(offset, MaxFileSize3);
 	else if (numBytes > MaxFileSize2) return RecursiveByteToSector(offset, MaxFileSize2);
@@ -199,6 +427,35 @@ int FileHeader::FileLength()
 	return numBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::GetSectors
+// 	Append to "sectors" the disk sectors holding the file: each
+//	sub-header, followed by what it points to, or just the data
+//	sectors for a file small enough not to need sub-headers.  That
+//	is the order Allocate and Extend hand them out in, so a file laid
+//	out in one run lists consecutive sectors.  A file kept in its
+//	header has none.
+//----------------------------------------------------------------------
+
+void FileHeader::GetSectors(List<int> *sectors)
+{
+	int i, childSize = ChildSize(numBytes);
+	FileHeader *child;
+
+	if (childSize == SectorSize) {
+		for (i = 0; i < numSectors; i++)
+			sectors->Append(dataSectors[i]);
+		return;
+	}
+	for (i = 0; i < divRoundUp(numBytes, childSize); i++) {
+		sectors->Append(dataSectors[i]);
+		child = new FileHeader;
+		child->FetchFrom(dataSectors[i]);
+		child->GetSectors(sectors);
+		delete child;
+	}
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 // 	Print the contents of the file header, and the contents of all
@@ -270,8 +527,8 @@ void FileHeader::RecursiveAllocate(PersistentBitmap *freeMap, int fileSize, int
 		FileHeader *subHdr = new FileHeader;
 
 		int nextStorageSize;
-		if (fileSize >= maxFileSize) subHdr->Allocate(freeMap, maxFileSize);
-		else subHdr->Allocate(freeMap, fileSize);
+		if (fileSize >= maxFileSize) subHdr->AllocateBlocks(freeMap, maxFileSize);
+		else subHdr->AllocateBlocks(freeMap, fileSize);
 		
 		fileSize -= maxFileSize;
 		subHdr->WriteBack(dataSectors[i]);
@@ -283,7 +540,9 @@ int FileHeader::RecursiveByteToSector(int offset, int maxFileSize)
 	int which = divRoundDown(offset, maxFileSize);
 	FileHeader *subHdr = new FileHeader;
 	subHdr->FetchFrom(dataSectors[which]);
-	return subHdr->ByteToSector(offset - maxFileSize*which);
+	int sector = subHdr->ByteToSector(offset - maxFileSize*which);
+	delete subHdr;
+	return sector;
 }
 
 void FileHeader::RecursivePrint()
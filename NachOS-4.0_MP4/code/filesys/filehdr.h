@@ -16,6 +16,7 @@
 
 #include "disk.h"
 #include "pbitmap.h"
+#include "list.h"
 
 #define NumDirect ((SectorSize - 2 * sizeof(int)) / sizeof(int))
 
@@ -24,6 +25,10 @@
 #define MaxFileSize2 (NumDirect * NumDirect * SectorSize)
 #define MaxFileSize3 (NumDirect * NumDirect * NumDirect * SectorSize)
 
+// A file this small keeps its data in the header sector itself, in
+// place of the dataSectors table (see FileHeader::IsInline).
+#define InlineSize (NumDirect * sizeof(int))
+
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
 // The file header is organized as a simple table of pointers to
@@ -35,6 +40,12 @@
 // as one disk sector.  Without indirect addressing, this
 // limits the maximum file length to just under 4K bytes.
 //
+// A file of at most InlineSize bytes has no data blocks at all: its
+// data is stored in the header, where the table of pointers would be,
+// so reading it costs no more than reading the header.  It is moved
+// to a data block when it grows past that.  Sub-headers never hold
+// data this way.
+//
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
@@ -63,14 +74,46 @@ public:
 	int FileLength(); // Return the length of the file
 					  // in bytes
 
+	bool IsInline() { return numSectors == 0; }
+					  // Is the data kept in the header?
+	char *InlineData() { return (char *)dataSectors; }
+					  // Where, if so
+
 	void Print(); // Print the contents of the file.
 
+	void GetSectors(List<int> *sectors); // Append every sector the file
+										 //  uses besides its header, in
+										 //  the order it was allocated
+
+	bool Extend(PersistentBitmap *freeMap, int newSize); // Grow the file to
+														 //  "newSize" bytes,
+														 //  allocating the
+														 //  new data blocks
+
+	int ExtendNeeds(int newSize); // Free sectors Extend insists on,
+								  //  to grow to "newSize" bytes
+
+	static int SubHeaders(int fileSize); // Sectors taken by the sub-headers
+										 //  of a file of "fileSize" bytes
+
+	static int ChildSize(int fileSize); // Bytes covered by each entry
+										//  of dataSectors, for a file
+										//  of "fileSize" bytes
+
 	// TODO
 	void RecursiveAllocate(PersistentBitmap *freeMap, int fileSize, int maxFileSize);
 	int RecursiveByteToSector(int offset, int maxFileSize);
 	void RecursivePrint();
 
 private:
+	bool AllocateBlocks(PersistentBitmap *freeMap, int fileSize);
+	bool ExtendBlocks(PersistentBitmap *freeMap, int newSize);
+										// Allocate/Extend, always giving
+										// the data blocks of its own
+	int BlocksNeeded(int newSize);		// Sectors ExtendBlocks takes
+	void ExtendLevel(PersistentBitmap *freeMap, int newSize, int childSize);
+										// Extend, keeping the header's depth
+
 	/*
 		MP4 hint:
 		You will need a data structure to store more information in a header.
@@ -89,7 +132,8 @@ private:
 	int numBytes;				// Number of bytes in the file
 	int numSectors;				// Number of data sectors in the file
 	int dataSectors[NumDirect]; // Disk sector numbers for each data
-								// block in the file
+								// block in the file, or the data
+								// itself if numSectors is 0
 };
 
 #endif // FILEHDR_H
@@ -23,10 +23,16 @@
 //
 //	For those operations (such as Create, Remove) that modify the
 //	directory and/or bitmap, if the operation succeeds, the changes
-//	are written immediately back to disk (the two files are kept
-//	open during all this time).  If the operation fails, and we have
-//	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	are written back (the two files are kept open during all this
+//	time).  If the operation fails, and we have modified part of the
+//	directory and/or bitmap, we simply discard the changed version,
+//	without writing it back to disk.
+//
+//	The write-backs go through a journal (see synchdisk.h): they are
+//	committed to a log, sectors JournalSector onwards, a group of
+//	operations at a time, and only later written to their homes.  On
+//	bootup the log is read back, so an operation either happened as
+//	a whole or not at all.
 //
 // 	Our implementation at this point has the following restrictions:
 //
@@ -35,9 +41,6 @@
 //	   files cannot be bigger than about 3KB in size
 //	   there is no hierarchical directory structure, and only a limited
 //	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -51,16 +54,22 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "synchdisk.h"
+#include "synch.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
 // sectors, so that they can be located on boot-up.
 #define FreeMapSector 0
 #define DirectorySector 1
+#define JournalSector 2
+
+#define JournalSectors 256 // size of the log region, header included
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// Initial file sizes for the bitmap and directory.  A directory file
+// grows when its table fills up, so NumDirEntries is not a limit on
+// the number of files in a directory.
 #define FreeMapFileSize (NumSectors / BitsInByte)
 
 // TODO
@@ -97,6 +106,8 @@ FileSystem::FileSystem(bool format)
         // (make sure no one else grabs these!)
         freeMap->Mark(FreeMapSector);
         freeMap->Mark(DirectorySector);
+        for (int i = 0; i < JournalSectors; i++)
+            freeMap->Mark(JournalSector + i);
 
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
@@ -136,8 +147,10 @@ FileSystem::FileSystem(bool format)
             directory->Print();
         }
 
-        // TODO
-        currentOpenFile = NULL; 
+        // from now on, metadata updates are journaled
+        journal = new Journal(JournalSector, JournalSectors);
+        journal->Format();
+        kernel->synchDisk->SetJournal(journal);
 
         delete freeMap;
         delete directory;
@@ -146,11 +159,24 @@ FileSystem::FileSystem(bool format)
     }
     else
     {
-        // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
+        // if we are not formatting the disk, find the operations committed
+        // to the journal, then open the files representing the bitmap and
+        // directory; these are left open while Nachos is running
+        journal = new Journal(JournalSector, JournalSectors);
+        kernel->synchDisk->SetJournal(journal);
+        journal->Recover();
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
     }
+
+    // the dentry cache starts empty; the root gets in on first use
+    for (int i = 0; i < DirCacheBuckets; i++)
+        dirCache[i] = NULL;
+    dirCacheCount = dirCacheClock = 0;
+    dirCacheLock = new Lock("dentry cache");
+    freeMapLock = new Lock("free map");
+    numFree = -1; // counted when first needed
+    numReserved = 0;
 }
 
 //----------------------------------------------------------------------
@@ -159,8 +185,278 @@ FileSystem::FileSystem(bool format)
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
+    DirCacheEntry *entry;
+
+    // Nachos is halting and no other thread will run again, so the
+    // dentry cache is emptied without taking its lock
+    for (int i = 0; i < DirCacheBuckets; i++)
+        while ((entry = dirCache[i]) != NULL)
+        {
+            dirCache[i] = entry->next;
+            FreeDirEntry(entry);
+        }
+    delete dirCacheLock;
+    delete freeMapLock;
     delete freeMapFile;
     delete directoryFile;
+    kernel->synchDisk->SetJournal(NULL);
+    delete journal;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Sync
+// 	Write out the data that open files are still holding back, then
+//	commit the journaled operations that are still held in memory.
+//	Called when Nachos halts.
+//----------------------------------------------------------------------
+
+void FileSystem::Sync()
+{
+    kernel->openFileTable->FlushAll();
+    journal->Sync();
+}
+
+//----------------------------------------------------------------------
+// NormalizePath
+// 	Copy "name" into "path" as an absolute path: exactly one '/' in
+//	front of every component, none at the end ("/" for the root).
+//	Return FALSE if the result would not fit in MaxPathLen.
+//----------------------------------------------------------------------
+
+static bool
+NormalizePath(char *name, char *path)
+{
+    int len = 0;
+
+    for (char *p = name; *p != '\0'; p++)
+    {
+        if (*p == '/' && (len > 0 && path[len - 1] == '/'))
+            continue; // collapse "//"
+        if (len == 0 && *p != '/')
+            path[len++] = '/';
+        if (len >= MaxPathLen - 1)
+            return FALSE;
+        path[len++] = *p;
+    }
+    if (len > 1 && path[len - 1] == '/')
+        len--;
+    if (len == 0)
+        path[len++] = '/';
+    path[len] = '\0';
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// HashPath
+// 	Hash a path name into a dentry cache bucket (FNV-1a).
+//----------------------------------------------------------------------
+
+static int
+HashPath(char *path)
+{
+    unsigned hash = 2166136261u;
+
+    for (; *path != '\0'; path++)
+    {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash % DirCacheBuckets;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::LookupDir
+// 	Return the dentry cache entry for the directory named by "path",
+//	which must be absolute and normalized.  On a miss, the parent is
+//	looked up first (recursively), and the directory is read from disk
+//	and entered into the cache.  Return NULL if there is no such
+//	directory.
+//
+//	The entry comes back pinned; the caller hands it back with
+//	ReleaseDir, and must hold its lock to use its Directory.
+//
+//	The dentry cache lock is held throughout, so two threads missing
+//	on the same directory do not both enter it.
+//----------------------------------------------------------------------
+
+DirCacheEntry *
+FileSystem::LookupDir(char *path)
+{
+    int bucket = HashPath(path);
+    DirCacheEntry *entry, *parent;
+    char leaf[FileNameMaxLen + 1];
+    bool held = dirCacheLock->IsHeldByCurrentThread();
+    int sector;
+
+    if (!held)
+        dirCacheLock->Acquire();
+    for (entry = dirCache[bucket]; entry != NULL; entry = entry->next)
+        if (!strcmp(entry->path, path))
+        {
+            entry->lastUsed = ++dirCacheClock;
+            entry->pins++;
+            break;
+        }
+
+    if (entry == NULL && strcmp(path, "/") == 0)
+    {
+        sector = DirectorySector;
+    }
+    else if (entry == NULL)
+    {
+        sector = -1;
+        parent = LookupParent(path, leaf);
+        if (parent != NULL)
+        {
+            parent->lock->AcquireRead();
+            sector = parent->directory->Find(leaf);
+            if (sector != -1 && !parent->directory->IsDir(leaf))
+                sector = -1; // not a directory
+            parent->lock->ReleaseRead();
+            ReleaseDir(parent);
+        }
+    }
+
+    if (entry == NULL && sector != -1)
+    {
+        if (dirCacheCount >= DirCacheSize)
+            DirCacheEvict();
+        entry = new DirCacheEntry;
+        strcpy(entry->path, path);
+        entry->sector = sector;
+        entry->file = (sector == DirectorySector) ? directoryFile
+                                                  : new OpenFile(sector);
+        entry->directory = new Directory(NumDirEntries);
+        entry->directory->FetchFrom(entry->file);
+        entry->lastUsed = ++dirCacheClock;
+        entry->lock = new RWLock("directory");
+        entry->pins = 1;
+        entry->stale = FALSE;
+        entry->next = dirCache[bucket];
+        dirCache[bucket] = entry;
+        dirCacheCount++;
+        DEBUG(dbgFile, "Dentry cache miss, entered " << path);
+    }
+    if (!held)
+        dirCacheLock->Release();
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::LookupParent
+// 	Return the dentry cache entry for the directory containing the
+//	last component of "path" (absolute, normalized), and copy that
+//	component into "leaf".  Return NULL if the directory does not exist.
+//	As with LookupDir, the entry is pinned.
+//----------------------------------------------------------------------
+
+DirCacheEntry *
+FileSystem::LookupParent(char *path, char *leaf)
+{
+    char parent[MaxPathLen];
+    char *slash = strrchr(path, '/');
+    int parentLen = slash - path;
+
+    strncpy(leaf, slash + 1, FileNameMaxLen);
+    leaf[FileNameMaxLen] = '\0';
+    strncpy(parent, path, parentLen);
+    parent[parentLen] = '\0';
+    return LookupDir(parentLen == 0 ? (char *)"/" : parent);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ReleaseDir
+// 	Unpin a dentry cache entry.  If it was dropped from the cache
+//	while pinned, the last one out frees it.
+//----------------------------------------------------------------------
+
+void FileSystem::ReleaseDir(DirCacheEntry *entry)
+{
+    bool held = dirCacheLock->IsHeldByCurrentThread();
+
+    if (!held)
+        dirCacheLock->Acquire();
+    ASSERT(entry->pins > 0);
+    if (--entry->pins == 0 && entry->stale)
+        FreeDirEntry(entry);
+    if (!held)
+        dirCacheLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::InvalidateDir
+// 	Drop the directory "path", and every directory below it, from
+//	the dentry cache.  Called when a directory is removed.  Entries
+//	still pinned are marked stale, and freed when they are released;
+//	an operation that finds its directory stale fails.
+//----------------------------------------------------------------------
+
+void FileSystem::InvalidateDir(char *path)
+{
+    int len = strlen(path);
+    DirCacheEntry **link, *entry;
+    bool held = dirCacheLock->IsHeldByCurrentThread();
+
+    if (!held)
+        dirCacheLock->Acquire();
+    for (int i = 0; i < DirCacheBuckets; i++)
+        for (link = &dirCache[i]; (entry = *link) != NULL;)
+        {
+            if (strncmp(entry->path, path, len) == 0 &&
+                (entry->path[len] == '\0' || entry->path[len] == '/' ||
+                 len == 1))
+            {
+                *link = entry->next;
+                dirCacheCount--;
+                if (entry->pins > 0)
+                    entry->stale = TRUE;
+                else
+                    FreeDirEntry(entry);
+            }
+            else
+                link = &entry->next;
+        }
+    if (!held)
+        dirCacheLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DirCacheEvict
+// 	Remove the least recently used entry from the dentry cache.  The
+//	root is never evicted, since its file stays open anyway, and
+//	neither is an entry in use; if every entry is, the cache grows
+//	past DirCacheSize for a while.
+//----------------------------------------------------------------------
+
+void FileSystem::DirCacheEvict()
+{
+    DirCacheEntry **link, **victim = NULL, *entry;
+
+    for (int i = 0; i < DirCacheBuckets; i++)
+        for (link = &dirCache[i]; *link != NULL; link = &(*link)->next)
+            if ((*link)->file != directoryFile && (*link)->pins == 0 &&
+                (victim == NULL || (*link)->lastUsed < (*victim)->lastUsed))
+                victim = link;
+    if (victim == NULL)
+        return;
+    entry = *victim;
+    *victim = entry->next;
+    FreeDirEntry(entry);
+    dirCacheCount--;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FreeDirEntry
+// 	De-allocate a dentry cache entry that is out of the cache.
+//----------------------------------------------------------------------
+
+void FileSystem::FreeDirEntry(DirCacheEntry *entry)
+{
+    if (entry->file != directoryFile)
+        delete entry->file;
+    delete entry->directory;
+    delete entry->lock;
+    delete entry;
 }
 
 //----------------------------------------------------------------------
@@ -173,7 +469,7 @@ FileSystem::~FileSystem()
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
 // 	  Allocate space on disk for the data blocks for the file
-//	  Add the name to the directory
+//	  Add the name to the directory, growing it if it is full
 //	  Store the new file header on disk
 //	  Flush the changes to the bitmap and the directory back to disk
 //
@@ -182,11 +478,11 @@ FileSystem::~FileSystem()
 // 	Create fails if:
 //   		file is already in directory
 //	 	no free space for file header
-//	 	no free entry for file in directory
 //	 	no free space for data blocks for the file
+//	 	no free space to grow a full directory
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+//	The directory is locked for the whole operation, and so is the
+//	bitmap, from the time it is read until it is written back.
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
@@ -194,61 +490,67 @@ FileSystem::~FileSystem()
 
 bool FileSystem::Create(char *name, int initialSize)
 {
+    DirCacheEntry *parent;
     Directory *directory;
     PersistentBitmap *freeMap;
     FileHeader *hdr;
+    char path[MaxPathLen], leaf[FileNameMaxLen + 1];
     int sector;
     bool success;
 
     DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
 
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-
     // TODO
-    OpenFile *tempFile = directoryFile;
-    char *path = strtok(name, "/");
-
-    while(path != NULL){
-        name = path;
-        if ((sector = directory->Find(path)) == -1 || !directory->IsDir(path)) break;
-        tempFile = new OpenFile(sector);	
-        directory->FetchFrom(tempFile);
-        path = strtok(NULL, "/");
-    }
-
-
-
-    if (directory->Find(name) != -1)
-        success = FALSE; // file is already in directory
+    if (!NormalizePath(name, path) ||
+        (parent = LookupParent(path, leaf)) == NULL)
+        return FALSE; // no such directory
+    directory = parent->directory;
+
+    parent->lock->AcquireWrite();
+    freeMapLock->Acquire();
+    journal->Begin();
+    if (parent->stale)
+        success = FALSE; // the directory was removed meanwhile
+    else if (leaf[0] == '\0' || directory->Find(leaf) != -1)
+        success = FALSE; // no name, or file is already in directory
     else
     {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet(); // find a sector to hold the file header
+        freeMap = FetchFreeMap(0);
+        if (freeMap->NumClear() == 0)
+            sector = -1; // what is left is set aside
+        else
+            sector = freeMap->FindAndSet(); // find a sector to hold the file header
         if (sector == -1)
             success = FALSE; // no free block for file header
-        else if (!directory->Add(name, sector, FALSE)) // TODO
+        else if (!directory->Add(leaf, sector, FALSE)) // TODO
             success = FALSE; // no space in directory
         else
         {
             hdr = new FileHeader;
             if (!hdr->Allocate(freeMap, initialSize))
                 success = FALSE; // no space on disk for data
+            else if (!parent->file->Extend(freeMap, directory->FileSize()))
+                success = FALSE; // no space to grow the directory
             else
             {
                 success = TRUE;
                 // everthing worked, flush all changes back to disk
                 hdr->WriteBack(sector);
                 // TODO
-                directory->WriteBack(tempFile);
+                directory->WriteBack(parent->file);
 
-                freeMap->WriteBack(freeMapFile);
+                WriteFreeMap(freeMap);
             }
+            if (!success) // undo the Add in the cached directory
+                directory->FetchFrom(parent->file);
             delete hdr;
         }
         delete freeMap;
     }
-    delete directory;
+    journal->End();
+    freeMapLock->Release();
+    parent->lock->ReleaseWrite();
+    ReleaseDir(parent);
     return success;
 }
 
@@ -264,32 +566,23 @@ bool FileSystem::Create(char *name, int initialSize)
 
 OpenFile * FileSystem::Open(char *name)
 {
-    Directory *directory = new Directory(NumDirEntries);
+    DirCacheEntry *parent;
     OpenFile *openFile = NULL;
+    char path[MaxPathLen], leaf[FileNameMaxLen + 1];
     int sector;
 
-    
-    directory->FetchFrom(directoryFile);
-
     // TODO
-    OpenFile *tempFile = directoryFile;
-    char *path = strtok(name, "/");
-    char *lastPath = path;			
-
-    while(path != NULL){
-        name = path;
-        if ((sector = directory->Find(path)) == -1 || !directory->IsDir(path)) break;
-        tempFile = new OpenFile(sector);	
-        directory->FetchFrom(tempFile);
-        lastPath = path;
-        path = strtok(NULL, "/");
-    }
+    if (!NormalizePath(name, path) ||
+        (parent = LookupParent(path, leaf)) == NULL)
+        return NULL; // no such directory
 
-    DEBUG(dbgFile, "Opening file" << name);
-    sector = directory->Find(name);
+    DEBUG(dbgFile, "Opening file" << path);
+    parent->lock->AcquireRead(); // the file cannot go away meanwhile
+    sector = parent->directory->Find(leaf);
     if (sector >= 0)
         openFile = new OpenFile(sector); // name was found in directory
-    delete directory;
+    parent->lock->ReleaseRead();
+    ReleaseDir(parent);
     return openFile; // return NULL if not found
 }
 
@@ -301,117 +594,275 @@ OpenFile * FileSystem::Open(char *name)
 //	    Delete the space for its data blocks
 //	    Write changes to directory, bitmap back to disk
 //
+//	A directory is removed, if "recursiveRemoveFlag", along with
+//	everything below it.  The tree is walked by sector (see
+//	DirectoryWalker), and all of it is freed in one bitmap in memory,
+//	so the whole removal writes the bitmap and the parent once.  The
+//	directories below it are dropped from the dentry cache before the
+//	bitmap is let go of, so that an operation that got one of them
+//	before then finds it stale once it gets the bitmap, and fails,
+//	instead of using sectors just freed.
+//
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
 //	in the file system.
 //
 //	"name" -- the text name of the file to be removed
 //----------------------------------------------------------------------
 
+static int
+FreeFile(int sector, PersistentBitmap *freeMap)
+{
+    FileHeader *fileHdr = new FileHeader;
+    int reserved;
+
+    reserved = kernel->openFileTable->Discard(sector); // its delayed data is moot
+    fileHdr->FetchFrom(sector);
+    fileHdr->Deallocate(freeMap); // remove data blocks
+    freeMap->Clear(sector);       // remove header block
+    delete fileHdr;
+    return reserved; // no longer needed
+}
+
 bool FileSystem::Remove(char *name, bool recursiveRemoveFlag)
 {
+    DirCacheEntry *parent, *dir = NULL;
     Directory *directory;
+    DirectoryWalker *walker;
+    DirectoryEntry *entry;
     PersistentBitmap *freeMap;
-    FileHeader *fileHdr;
-    int sector;
-
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    char path[MaxPathLen], leaf[FileNameMaxLen + 1];
+    int sector, count;
+    bool isDir, success;
+
+    if (!NormalizePath(name, path) ||
+        (parent = LookupParent(path, leaf)) == NULL)
+        return FALSE; // no such directory
+    directory = parent->directory;
+    parent->lock->AcquireRead();
+    sector = directory->Find(leaf);
+    isDir = (sector != -1 && directory->IsDir(leaf));
+    parent->lock->ReleaseRead();
+    if (sector == -1 || (isDir && !recursiveRemoveFlag))
+    {
+        ReleaseDir(parent);
+        return FALSE; // file not found, or a directory
+    }
 
-    // TODO
-    char pwd[10], buffer[10];
-    OpenFile *tempFile = directoryFile;
-    OpenFile *prevFile = tempFile;
-    char *path = strtok(name, "/");
-    char *lastPath = path;
-    bool dir = TRUE;		
-
-    while(path != NULL){
-        name = path;
-        if ((sector = directory->Find(path)) == -1 || !directory->IsDir(path)){
-            dir = FALSE;
-            break;
-        } 
-        prevFile = tempFile;
-        tempFile = new OpenFile(sector);	
-        directory->FetchFrom(tempFile);
-        lastPath = path;
-        path = strtok(NULL, "/");
+    // look the directory up before locking its parent, which a
+    // miss in the dentry cache would need to read
+    if (isDir && (dir = LookupDir(path)) == NULL)
+    {
+        ReleaseDir(parent);
+        return FALSE;
     }
 
-    if (recursiveRemoveFlag && dir) {
-        DirectoryEntry *table = directory->GetTable();
-        strcpy(pwd, name);
-        for (int i=0; i<directory->GetTableSize(); i++) {
-            if (table[i].inUse) {
-                sprintf(buffer, "%s/%s", pwd, table[i].name);
-                Remove(buffer, true);
-            }
+    if (dir != NULL)
+        dirCacheLock->Acquire(); // to drop its subdirectories, below
+    parent->lock->AcquireWrite();
+    if (dir != NULL)
+        dir->lock->AcquireWrite(); // nothing gets added right in it now
+    freeMapLock->Acquire();
+    journal->Begin();
+    success = (!parent->stale &&
+               directory->Find(leaf) == sector); // not removed meanwhile
+    if (success)
+    {
+        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+        if (dir != NULL)
+        {
+            walker = new DirectoryWalker(dir->directory);
+            for (count = 0; (entry = walker->Next()) != NULL; count++)
+                numReserved -= FreeFile(entry->sector, freeMap);
+            DEBUG(dbgFile, "Removing " << path << ": " << count << " entries in "
+                                       << walker->DirsRead() + 1 << " directories");
+            delete walker;
         }
-        directory->FetchFrom(prevFile);
+        numReserved -= FreeFile(sector, freeMap);
+        directory->Remove(leaf);
+
+        WriteFreeMap(freeMap);               // flush to disk
+        directory->WriteBack(parent->file); // flush to disk
+        delete freeMap;
+        if (dir != NULL)
+            InvalidateDir(path);
     }
-    
-    
-    sector = directory->Find(name);
-    if (sector == -1)
+    journal->End();
+    freeMapLock->Release();
+    if (dir != NULL)
     {
-        delete directory;
-        return FALSE; // file not found
+        dir->lock->ReleaseWrite();
+        ReleaseDir(dir);
+        dirCacheLock->Release();
     }
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
-
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    parent->lock->ReleaseWrite();
+    ReleaseDir(parent);
+    return success;
+}
 
-    fileHdr->Deallocate(freeMap); // remove data blocks
-    freeMap->Clear(sector);       // remove header block
-    directory->Remove(name);
+//----------------------------------------------------------------------
+// FileSystem::ExtendFile
+// 	Allocate disk space for "file" to grow to "newLength" bytes, and
+//	write its header and the bitmap back.  The new data sectors are
+//	taken as one run, right after the file's last sector if there is
+//	room there.  A file that still fits in its header needs no new
+//	sectors.  Return FALSE if the disk is full, or if the file was
+//	removed (see OpenFileTable::Discard).
+//
+//	Whatever Reserve set aside for the file is used up, or given back.
+//
+//	"file" -- the open file to grow
+//	"newLength" -- its length afterwards, in bytes
+//----------------------------------------------------------------------
 
-    freeMap->WriteBack(freeMapFile);     // flush to disk
+bool FileSystem::ExtendFile(OpenFile *file, int newLength)
+{
+    FileHeader *hdr = file->getHdr();
+    PersistentBitmap *freeMap;
+    int length = max(hdr->FileLength(), 0);
+    int near, reserved;
+    bool success;
 
-    // TODO
-    if(dir) directory->WriteBack(prevFile); // flush to disk
-    else directory->WriteBack(tempFile);
-    
+    if (hdr->IsInline())
+    {
+        if (newLength <= (int)InlineSize)
+        { // still fits in the header: no need for the bitmap
+            journal->Begin();
+            success = !file->IsRemoved() && file->Extend(NULL, newLength);
+            journal->End();
+            return success;
+        }
+        length = 0; // no data sectors yet
+    }
+    if (length > 0)
+        near = hdr->ByteToSector(length - 1) + 1;
+    else
+        near = file->getHdrSector() + 1;
+
+    freeMapLock->Acquire();
+    journal->Begin();
+    reserved = file->getReserved(); // set aside for this very growth
+    freeMap = FetchFreeMap(reserved);
+    freeMap->PlaceNear(near, divRoundUp(newLength, SectorSize) -
+                                 divRoundUp(length, SectorSize));
+    success = !file->IsRemoved() && file->Extend(freeMap, newLength);
+    if (success)
+        WriteFreeMap(freeMap);
+    numReserved -= reserved;
+    file->setReserved(0);
+    journal->End();
+    freeMapLock->Release();
 
-    delete fileHdr;
-    delete directory;
     delete freeMap;
-    return TRUE;
+    return success;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::List
-// 	List all the files in the file system directory.
+// FileSystem::Reserve
+// 	Set aside enough free sectors for "file" to grow to "newLength"
+//	bytes later on, with ExtendFile; until then, nothing else can
+//	allocate them.  Used for data written past the allocated end of a
+//	file (see OpenFile::WriteDelayed), which is taken at once, but only
+//	given disk space when it is flushed.  Return FALSE, setting aside
+//	nothing more, if the disk has too little room left.
+//
+//	The free sectors are counted as the bitmap is written back, so this
+//	doesn't need to read it; the bitmap is only read the first time.
+//
+//	"file" -- the open file that will grow; its caller holds its lock
+//	"newLength" -- its length afterwards, in bytes
 //----------------------------------------------------------------------
 
-// TODO
-void FileSystem::List(char *name, bool recursiveListFlag)
+bool FileSystem::Reserve(OpenFile *file, int newLength)
 {
-    Directory *directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    int needed = file->getHdr()->ExtendNeeds(newLength) - file->getReserved();
+    bool success = TRUE;
+
+    if (needed <= 0)
+        return TRUE; // enough is set aside already
+    freeMapLock->Acquire();
+    if (numFree < 0)
+        delete FetchFreeMap(0); // counts the free sectors
+    if (numFree - numReserved < needed)
+        success = FALSE;
+    else if (!file->IsRemoved()) // else its data never gets disk space
+    {
+        numReserved += needed;
+        file->setReserved(file->getReserved() + needed);
+    }
+    freeMapLock->Release();
+    return success;
+}
 
+//----------------------------------------------------------------------
+// FileSystem::FreeSectors
+// 	Return how many free sectors are left to allocate: those Reserve
+//	set aside are not.
+//----------------------------------------------------------------------
 
-    // TODO
-    OpenFile *tempFile = directoryFile;
-    char *path = strtok(name, "/");
-    int sector;
+int FileSystem::FreeSectors()
+{
+    int count;
+
+    freeMapLock->Acquire();
+    if (numFree < 0)
+        delete FetchFreeMap(0); // counts the free sectors
+    count = numFree - numReserved;
+    freeMapLock->Release();
+    return count;
+}
 
-    while(path != NULL){
-        name = path;
-        if ((sector = directory->Find(path)) == -1 || !directory->IsDir(path)) break;
-        tempFile = new OpenFile(sector);	
-        directory->FetchFrom(tempFile);
-        path = strtok(NULL, "/");
-    }
+//----------------------------------------------------------------------
+// FileSystem::FetchFreeMap
+// 	Read the bitmap, for an operation holding freeMapLock.  Its
+//	NumClear leaves out the sectors Reserve set aside, except "keep"
+//	of them, which are the caller's to use.
+//----------------------------------------------------------------------
 
-    if (recursiveListFlag) directory->RecursiveList();
-    else directory->List();
+PersistentBitmap *
+FileSystem::FetchFreeMap(int keep)
+{
+    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
 
+    ASSERT(freeMapLock->IsHeldByCurrentThread());
+    if (numFree < 0)
+        numFree = freeMap->Bitmap::NumClear();
+    freeMap->SetAside(numReserved - keep);
+    return freeMap;
+}
 
+//----------------------------------------------------------------------
+// FileSystem::WriteFreeMap
+// 	Write the bitmap back, and note how many sectors are free now.
+//----------------------------------------------------------------------
 
-    // directory->FetchFrom(directoryFile);
-    // directory->List();
-    delete directory;
+void FileSystem::WriteFreeMap(PersistentBitmap *freeMap)
+{
+    ASSERT(freeMapLock->IsHeldByCurrentThread());
+    freeMap->WriteBack(freeMapFile);
+    numFree = freeMap->Bitmap::NumClear();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::List
+// 	List all the files in the file system directory.
+//----------------------------------------------------------------------
+
+// TODO
+void FileSystem::List(char *name, bool recursiveListFlag)
+{
+    DirCacheEntry *dir;
+    char path[MaxPathLen];
+
+    // TODO
+    if (!NormalizePath(name, path) || (dir = LookupDir(path)) == NULL)
+        return; // no such directory
+
+    dir->lock->AcquireRead();
+    dir->directory->indentation = 0;
+    if (recursiveListFlag) dir->directory->RecursiveList();
+    else dir->directory->List();
+    dir->lock->ReleaseRead();
+    ReleaseDir(dir);
 }
 
 //----------------------------------------------------------------------
@@ -450,61 +901,714 @@ void FileSystem::Print()
     delete directory;
 }
 
-// TODO
+//----------------------------------------------------------------------
+// LayoutTotals
+// 	What -layout adds up over the whole file system.
+//----------------------------------------------------------------------
+
+class LayoutTotals
+{
+public:
+    int files;     // files looked at
+    int sectors;   // sectors they use, sub-headers included
+    int extents;   // runs of consecutive sectors
+    int seekTicks; // estimated cost of reading them all, see Extents
+    int moved;     // files Defrag relocated
+};
+
+#define DefragChunk (8 * SectorsPerTrack) // sectors copied at a time
+
+//----------------------------------------------------------------------
+// Extents
+// 	Return how many runs of consecutive sectors the file with header
+//	"hdr" (at sector "header") falls into, counting its sub-headers
+//	(see FileHeader::GetSectors), and how many sectors that is in
+//	"numSectors".  Also estimate in "seekTicks" what reading the file
+//	start to end costs beyond the transfer itself: every jump to the
+//	start of a new run pays a seek over the tracks in between plus,
+//	on average, half a rotation.
+//----------------------------------------------------------------------
+
+static int
+Extents(FileHeader *hdr, int header, int *numSectors, int *seekTicks)
+{
+    List<int> sectors;
+    int prev = header, extents = 0, sector;
+
+    hdr->GetSectors(&sectors);
+    *numSectors = sectors.NumInList();
+    *seekTicks = 0;
+    while (!sectors.IsEmpty())
+    {
+        sector = sectors.RemoveFront();
+        if (sector != prev + 1)
+        {
+            extents++;
+            *seekTicks += abs(sector / SectorsPerTrack - prev / SectorsPerTrack) * SeekTime +
+                          SectorsPerTrack / 2 * RotationTime;
+        }
+        prev = sector;
+    }
+    if (extents == 0 && *numSectors > 0)
+        extents = 1; // one run, right after the header
+    return extents;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Layout
+// 	Print, for each file and directory, its size, the sectors it
+//	uses, how many runs they form and what seeking between those runs
+//	costs a sequential read; then the totals.
+//----------------------------------------------------------------------
+
+void FileSystem::Layout()
+{
+    LayoutTotals totals;
+
+    memset(&totals, 0, sizeof(totals));
+    printf("%-30s %9s %8s %8s %10s\n", "File", "Bytes", "Sectors", "Extents", "Seek ticks");
+    WalkTree("/", FALSE, &totals);
+    printf("%d files, %d sectors in %d extents, estimated seek ticks %d\n",
+           totals.files, totals.sectors, totals.extents, totals.seekTicks);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Defrag
+// 	Move every regular file whose sectors do not form one run into
+//	one, starting on a track boundary if there is such a hole (see
+//	DefragFile), then print the layout that results.  Directories are
+//	left where they are: the dentry cache holds them open.
+//----------------------------------------------------------------------
+
+void FileSystem::Defrag()
+{
+    LayoutTotals totals;
+
+    memset(&totals, 0, sizeof(totals));
+    WalkTree("/", TRUE, &totals);
+    printf("Defrag moved %d files\n", totals.moved);
+    Layout();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WalkTree
+// 	Visit everything below the directory "path": defragment each
+//	regular file if "defrag", otherwise print its line of the layout
+//	report and add it to "totals".
+//----------------------------------------------------------------------
+
+void FileSystem::WalkTree(char *path, bool defrag, LayoutTotals *totals)
+{
+    DirCacheEntry *dir;
+    DirectoryEntry *table, *entries;
+    FileHeader *hdr;
+    char child[MaxPathLen + FileNameMaxLen + 1];
+    int i, n, extents, numSectors, seekTicks;
+
+    if ((dir = LookupDir(path)) == NULL)
+        return;
+
+    // take a copy of the entries: the directory may change once we
+    // let go of it
+    dir->lock->AcquireRead();
+    table = dir->directory->GetTable();
+    entries = new DirectoryEntry[dir->directory->GetTableSize()];
+    for (i = n = 0; i < dir->directory->GetTableSize(); i++)
+        if (table[i].inUse)
+            entries[n++] = table[i];
+    dir->lock->ReleaseRead();
+    ReleaseDir(dir);
+
+    for (i = 0; i < n; i++)
+    {
+        sprintf(child, "%s/%s", strcmp(path, "/") == 0 ? "" : path, entries[i].name);
+        if (defrag)
+        {
+            if (!entries[i].isDir && DefragFile(entries[i].sector))
+                totals->moved++;
+        }
+        else
+        {
+            hdr = new FileHeader;
+            hdr->FetchFrom(entries[i].sector);
+            extents = Extents(hdr, entries[i].sector, &numSectors, &seekTicks);
+            printf("%-30s %9d %8d %8d %10d\n", child, hdr->FileLength(),
+                   numSectors, extents, seekTicks);
+            totals->files++;
+            totals->sectors += numSectors;
+            totals->extents += extents;
+            totals->seekTicks += seekTicks;
+            delete hdr;
+        }
+        if (entries[i].isDir && strlen(child) < MaxPathLen)
+            WalkTree(child, defrag, totals);
+    }
+    delete[] entries;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragFile
+// 	Relocate the file whose header is at "sector" into one run of
+//	free sectors, if its sectors are not in one run already.  Return
+//	TRUE if the file was moved.
+//
+//	The new sectors are allocated, the same way Allocate lays out a
+//	new file, and the data copied over, a chunk at a time, with only
+//	the bitmap in memory knowing about them.  Then, in one journaled
+//	operation, the new header replaces the old one and the old sectors
+//	are freed, so a crash leaves either the old file or the new one.
+//	The file is locked throughout, and whoever has it open sees the
+//	new header afterwards.
+//----------------------------------------------------------------------
+
+bool FileSystem::DefragFile(int sector)
+{
+    OpenFile *file = new OpenFile(sector);
+    RWLock *lock = file->getLock();
+    FileHeader *oldHdr = new FileHeader, *newHdr = NULL;
+    PersistentBitmap *freeMap = NULL;
+    int extents, seekTicks, length, position, count, i;
+    int runs[DefragChunk];
+    char *buffers[DefragChunk];
+    char *data;
+    bool moved = FALSE;
+
+    (void)file->Flush(); // so the length is final
+    lock->AcquireWrite();
+    *oldHdr = *file->getHdr();
+    extents = Extents(oldHdr, sector, &count, &seekTicks);
+    length = oldHdr->FileLength();
+    if (extents > 1) // else nothing to gain
+    {
+        freeMapLock->Acquire();
+        freeMap = FetchFreeMap(0);
+        if (freeMap->NumClear() >= count &&
+            (freeMap->PlaceAligned(count, SectorsPerTrack) ||
+             freeMap->PlaceAligned(count, 1)))
+            moved = TRUE;
+        else
+            DEBUG(dbgFile, "No run of " << count << " free sectors for file at " << sector);
+    }
+
+    if (moved)
+    {
+        newHdr = new FileHeader;
+        bool ok = newHdr->Allocate(freeMap, length);
+        ASSERT(ok); // the run found above has room
+
+        // copy the data, whole sectors at a time
+        data = new char[DefragChunk * SectorSize];
+        for (position = 0; position < length; position += DefragChunk * SectorSize)
+        {
+            count = min((int)DefragChunk, divRoundUp(length - position, SectorSize));
+            for (i = 0; i < count; i++)
+            {
+                runs[i] = oldHdr->ByteToSector(position + i * SectorSize);
+                buffers[i] = &data[i * SectorSize];
+            }
+            kernel->synchDisk->ReadSectors(runs, count, buffers);
+            for (i = 0; i < count; i++)
+                runs[i] = newHdr->ByteToSector(position + i * SectorSize);
+            kernel->synchDisk->WriteSectors(runs, count, buffers);
+        }
+        delete[] data;
+
+        DEBUG(dbgFile, "Moving file at " << sector << ", " << extents << " extents");
+        journal->Begin();
+        newHdr->WriteBack(sector);
+        oldHdr->Deallocate(freeMap);
+        WriteFreeMap(freeMap);
+        journal->End();
+        *file->getHdr() = *newHdr; // for everyone with the file open
+        delete newHdr;
+    }
+    if (freeMap != NULL)
+    {
+        freeMapLock->Release();
+        delete freeMap;
+    }
+    lock->ReleaseWrite();
+    delete oldHdr;
+    delete file;
+    return moved;
+}
+
+//----------------------------------------------------------------------
+// The file system checker.  Check looks at the disk image itself,
+// mapped into memory, outside of simulated time.  Every header is read
+// straight out of the mapping, and each sector it points to is claimed
+// in "owner", which holds, for each sector, the header that points to
+// it (plus one; 0 if none does).  Claims are made with CompareAndSwap,
+// so that threads of the host can scan different parts of the tree at
+// once; a claim that fails finds a sector allocated twice.
+//----------------------------------------------------------------------
+
+#define CheckThreads 4 // host threads scanning the tree
+#define CheckSplit 16  // subtrees handed to each, to even out the work
+#define MaxReports 10  // sectors listed for each kind of problem
+
+// A file header as it is on disk (see FileHeader)
+class RawHeader
+{
+public:
+    int numBytes;
+    int numSectors;
+    int dataSectors[NumDirect];
+};
+
+// A sector that a second header points to
+class CheckClaim
+{
+public:
+    int sector; // the sector
+    int header; // the second header
+    int index;  // where in its dataSectors; -1 for a directory entry
+    bool data;  // a data sector, not a header
+};
+
+// Part of the tree to scan, and what was found in it.  The work is a
+// list of headers, each as sector * 2 + (1 if a directory).
+class CheckScan
+{
+public:
+    char *image;                 // the disk, mapped
+    int *owner;                  // shared by every scan
+    List<int> *work;             // headers still to scan
+    int files, dirs, headers;    // scanned so far
+    List<int> *damaged;          // headers that make no sense
+    List<CheckClaim *> *doubles; // sectors claimed twice
+};
+
+//----------------------------------------------------------------------
+// CheckClaimSector
+// 	Claim "sector" for the header at "header", which points to it from
+//	dataSectors[index].  Return FALSE, and note it, if it was claimed
+//	already.
+//----------------------------------------------------------------------
+
+static bool
+CheckClaimSector(CheckScan *scan, int sector, int header, int index, bool data)
+{
+    CheckClaim *claim;
+
+    if (CompareAndSwap(&scan->owner[sector], 0, header + 1) == 0)
+        return TRUE;
+    claim = new CheckClaim;
+    claim->sector = sector;
+    claim->header = header;
+    claim->index = index;
+    claim->data = data;
+    scan->doubles->Append(claim);
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// CheckHeader
+// 	Check the header at "sector", and every level of sub-headers below
+//	it, claiming the sectors they point to.  A sub-header must describe
+//	exactly "expect" bytes; a file's own header ("expect" -1) may keep
+//	its data inline.  If "data" is not NULL, append the file's data
+//	sectors to it, in order.  Return FALSE if the header is damaged.
+//----------------------------------------------------------------------
+
+static bool
+CheckHeader(CheckScan *scan, int sector, int expect, List<int> *data)
+{
+    RawHeader *hdr = (RawHeader *)&scan->image[sector * SectorSize];
+    int i, n, childSize, child;
+    bool intact = TRUE;
+
+    scan->headers++;
+    if (hdr->numBytes < 0 || (expect >= 0 && hdr->numBytes != expect))
+        intact = FALSE;
+    else if (expect < 0 && hdr->numSectors == 0 && hdr->numBytes <= (int)InlineSize)
+        return TRUE; // kept in the header
+    else if (hdr->numSectors != divRoundUp(hdr->numBytes, SectorSize))
+        intact = FALSE;
+    else
+    {
+        childSize = FileHeader::ChildSize(hdr->numBytes);
+        n = divRoundUp(hdr->numBytes, childSize);
+        if (n > (int)NumDirect)
+            intact = FALSE;
+        for (i = 0; intact && i < n; i++)
+        {
+            child = hdr->dataSectors[i];
+            if (child < 0 || child >= NumSectors)
+                intact = FALSE;
+            else if (childSize == SectorSize)
+            {
+                CheckClaimSector(scan, child, sector, i, TRUE);
+                if (data != NULL)
+                    data->Append(child);
+            }
+            else if (CheckClaimSector(scan, child, sector, i, FALSE))
+                intact = CheckHeader(scan, child,
+                                     min(hdr->numBytes - i * childSize, childSize), data);
+        }
+    }
+    if (!intact)
+        scan->damaged->Append(sector);
+    return intact;
+}
+
+//----------------------------------------------------------------------
+// CheckNext
+// 	Scan the next header on the work list: the file's header levels,
+//	and if it is a directory, its entries.  Their headers are claimed
+//	and added to the work list, at the front for a depth first scan,
+//	or at the back for a breadth first one.
+//----------------------------------------------------------------------
+
+static void
+CheckNext(CheckScan *scan, bool breadthFirst)
+{
+    int item = scan->work->RemoveFront();
+    int sector = item / 2, length, i, pos;
+    RawHeader *hdr = (RawHeader *)&scan->image[sector * SectorSize];
+    DirectoryEntry *table;
+    List<int> data;
+    char *contents;
+
+    if (!CheckHeader(scan, sector, -1, (item % 2) ? &data : NULL))
+        return;
+    if (item % 2 == 0)
+    {
+        scan->files++;
+        return;
+    }
+
+    // gather the directory file
+    scan->dirs++;
+    length = hdr->numBytes;
+    contents = new char[length + SectorSize];
+    if (hdr->numSectors == 0)
+        bcopy(hdr->dataSectors, contents, length);
+    for (pos = 0; !data.IsEmpty(); pos += SectorSize)
+        bcopy(&scan->image[data.RemoveFront() * SectorSize], &contents[pos], SectorSize);
+
+    table = (DirectoryEntry *)contents;
+    for (i = 0; i < length / (int)sizeof(DirectoryEntry); i++)
+    {
+        if (!table[i].inUse)
+            continue;
+        if (table[i].sector < 0 || table[i].sector >= NumSectors)
+            scan->damaged->Append(sector);
+        else if (CheckClaimSector(scan, table[i].sector, sector, -1, FALSE))
+        {
+            item = table[i].sector * 2 + (table[i].isDir ? 1 : 0);
+            if (breadthFirst)
+                scan->work->Append(item);
+            else
+                scan->work->Prepend(item);
+        }
+    }
+    delete[] contents;
+}
+
+//----------------------------------------------------------------------
+// CheckThread
+// 	What each host thread runs: scan its share of the tree.  Nothing
+//	here may call into Nachos.
+//----------------------------------------------------------------------
+
+static void *
+CheckThread(void *arg)
+{
+    CheckScan *scan = (CheckScan *)arg;
+
+    while (!scan->work->IsEmpty())
+        CheckNext(scan, FALSE);
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// CheckReport
+// 	Print how many "sectors" there are of "what", and the first few
+//	of them, emptying the list.
+//----------------------------------------------------------------------
+
+static void
+CheckReport(char *what, List<int> *sectors)
+{
+    int n = 0;
+
+    if (sectors->IsEmpty())
+        return;
+    printf("fsck: %d %s:", sectors->NumInList(), what);
+    while (!sectors->IsEmpty())
+    {
+        int sector = sectors->RemoveFront();
+        if (n++ < MaxReports)
+            printf(" %d", sector);
+    }
+    printf(n > MaxReports ? " ...\n" : "\n");
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Check
+// 	Check that the directory tree, the file headers at every level
+//	and the bitmap of free sectors agree: rebuild the bitmap from what
+//	the headers point to, and report the sectors it gets wrong (marked
+//	free while in use, or in use while nothing points to them),
+//	sectors that two headers point to, and headers that make no sense.
+//	Return TRUE if there was nothing to report.
+//
+//	The start of the tree is scanned breadth first, until there are
+//	enough subtrees to share out among CheckThreads threads of the
+//	host, which scan the rest of it from the mapped disk.
+//
+//	If "repair", fix the bitmap, and give the second owner of a
+//	doubly allocated data sector a copy of its own.  The bitmap is
+//	left alone if a header is damaged: its sectors would be freed.
+//	Meant for a file system nothing else is using at the time.
+//----------------------------------------------------------------------
+
+bool FileSystem::Check(bool repair)
+{
+    CheckScan scans[CheckThreads + 1], *scan;
+    void *threads[CheckThreads];
+    ::List<int> wrongFree, wrongUsed, damaged;
+    ::List<CheckClaim *> doubles;
+    ListIterator<CheckClaim *> *iter;
+    CheckClaim *claim;
+    PersistentBitmap *freeMap;
+    RawHeader raw;
+    char *image, buf[SectorSize];
+    int *owner, i, n, sector, problems, repaired = 0;
+    bool used, fixing;
+
+    // bring the disk itself up to date
+    kernel->openFileTable->FlushAll();
+    journal->Sync(TRUE);
+    if ((image = kernel->synchDisk->MapImage()) == NULL)
+    {
+        printf("fsck: cannot map the disk\n");
+        return FALSE;
+    }
+
+    owner = new int[NumSectors];
+    memset(owner, 0, NumSectors * sizeof(int));
+    for (i = 0; i <= CheckThreads; i++)
+    {
+        scans[i].image = image;
+        scans[i].owner = owner;
+        scans[i].work = new ::List<int>;
+        scans[i].files = scans[i].dirs = scans[i].headers = 0;
+        scans[i].damaged = new ::List<int>;
+        scans[i].doubles = new ::List<CheckClaim *>;
+    }
+
+    // the sectors at well-known places
+    scan = &scans[0];
+    for (i = 0; i < JournalSectors; i++)
+        owner[JournalSector + i] = JournalSector + 1;
+    owner[FreeMapSector] = FreeMapSector + 1;
+    owner[DirectorySector] = DirectorySector + 1;
+    scan->work->Append(FreeMapSector * 2);
+    scan->work->Append(DirectorySector * 2 + 1);
+    while (!scan->work->IsEmpty() &&
+           scan->work->NumInList() < CheckThreads * CheckSplit)
+        CheckNext(scan, TRUE);
+
+    // share out the rest
+    for (i = 0; !scan->work->IsEmpty(); i++)
+        scans[1 + i % CheckThreads].work->Append(scan->work->RemoveFront());
+    for (i = 0; i < CheckThreads; i++)
+        threads[i] = ForkHostThread(CheckThread, &scans[1 + i]);
+    for (i = 0; i < CheckThreads; i++)
+        JoinHostThread(threads[i]);
+
+    for (i = 1; i <= CheckThreads; i++)
+    {
+        scans[0].files += scans[i].files;
+        scans[0].dirs += scans[i].dirs;
+        scans[0].headers += scans[i].headers;
+    }
+    for (i = 0; i <= CheckThreads; i++)
+    {
+        while (!scans[i].damaged->IsEmpty())
+            damaged.Append(scans[i].damaged->RemoveFront());
+        while (!scans[i].doubles->IsEmpty())
+            doubles.Append(scans[i].doubles->RemoveFront());
+        delete scans[i].work;
+        delete scans[i].damaged;
+        delete scans[i].doubles;
+    }
+    printf("fsck: %d directories, %d files, %d headers\n",
+           scans[0].dirs, scans[0].files, scans[0].headers);
+
+    // compare the bitmap with what was found
+    freeMapLock->Acquire();
+    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    for (sector = 0; sector < NumSectors; sector++)
+    {
+        used = (owner[sector] != 0);
+        if (used && !freeMap->Test(sector))
+        {
+            wrongFree.Append(sector);
+            freeMap->Mark(sector);
+        }
+        else if (!used && freeMap->Test(sector))
+        {
+            wrongUsed.Append(sector);
+            freeMap->Clear(sector);
+        }
+    }
+    problems = wrongFree.NumInList() + wrongUsed.NumInList() +
+               doubles.NumInList() + damaged.NumInList();
+    fixing = repair && problems > 0 && damaged.IsEmpty();
+    if (fixing)
+        repaired = wrongFree.NumInList() + wrongUsed.NumInList();
+    CheckReport("sectors in use but marked free", &wrongFree);
+    CheckReport("sectors marked in use but unreachable", &wrongUsed);
+    CheckReport("damaged headers", &damaged);
+    n = 0;
+    iter = new ListIterator<CheckClaim *>(&doubles);
+    for (; !iter->IsDone(); iter->Next())
+        if (n++ < MaxReports)
+            printf("fsck: sector %d claimed by sectors %d and %d\n",
+                   iter->Item()->sector, owner[iter->Item()->sector] - 1,
+                   iter->Item()->header);
+    delete iter;
+
+    if (fixing)
+    {
+        // copy the doubly allocated data sectors, before the journaled
+        // operation that points the second headers at the copies
+        iter = new ListIterator<CheckClaim *>(&doubles);
+        for (; !iter->IsDone(); iter->Next())
+        {
+            claim = iter->Item();
+            if (!claim->data || (sector = freeMap->FindAndSet()) < 0)
+            {
+                claim->index = -1; // leave it be
+                continue;
+            }
+            kernel->synchDisk->ReadSector(claim->sector, buf);
+            kernel->synchDisk->WriteSector(sector, buf);
+            claim->sector = sector;
+        }
+        delete iter;
+
+        journal->Begin();
+        while (!doubles.IsEmpty())
+        {
+            claim = doubles.RemoveFront();
+            if (claim->index >= 0)
+            {
+                kernel->synchDisk->ReadSector(claim->header, (char *)&raw);
+                raw.dataSectors[claim->index] = claim->sector;
+                kernel->synchDisk->WriteSector(claim->header, (char *)&raw);
+                repaired++;
+            }
+            delete claim;
+        }
+        WriteFreeMap(freeMap);
+        journal->End();
+        journal->Sync(TRUE);
+    }
+    freeMapLock->Release();
+    while (!doubles.IsEmpty())
+        delete doubles.RemoveFront();
+    delete freeMap;
+    delete[] owner;
+    kernel->synchDisk->UnmapImage(image);
+
+    if (problems == 0)
+        printf("fsck: clean\n");
+    else if (repair)
+        printf("fsck: %d problems, %d repaired\n", problems, repaired);
+    else
+        printf("fsck: %d problems\n", problems);
+    return problems == 0;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::OpenAFile
+// 	Open a file for the running user program, and return the id it
+//	has in the program's open-file table, or -1 on failure.
+//----------------------------------------------------------------------
+
 OpenFileId FileSystem::OpenAFile(char *name) {	
-    currentOpenFile = Open(name);
-	if(!currentOpenFile) return -1;
-    return 1;
+    AddrSpace *space = kernel->currentThread->space;
+    OpenFile *openFile;
+    OpenFileId id;
+
+    if (space == NULL || (openFile = Open(name)) == NULL)
+        return -1;
+    if ((id = space->AddOpenFile(openFile)) == -1)
+        delete openFile; // too many open files
+    return id;
 }
 
-int FileSystem::ReadFile(char *buffer, int size, OpenFileId id){
-    return currentOpenFile->Read(buffer, size);
+//----------------------------------------------------------------------
+// FileSystem::ReadFile/WriteFile
+// 	Read/write the file the running program has open as "id", to or
+//	from the user buffer at virtual address "buffer".  Return the
+//	number of bytes transferred, or -1 for a bad id or buffer.
+//----------------------------------------------------------------------
+
+int FileSystem::ReadFile(int buffer, int size, OpenFileId id){
+    AddrSpace *space = kernel->currentThread->space;
+    OpenFile *openFile = space ? space->GetOpenFile(id) : NULL;
+
+    if (openFile == NULL)
+        return -1;
+    return space->ReadFile(openFile, buffer, size);
 }
 
-int FileSystem::WriteFile(char *buffer, int size, OpenFileId id){
-    return currentOpenFile->Write(buffer, size);
+int FileSystem::WriteFile(int buffer, int size, OpenFileId id){
+    AddrSpace *space = kernel->currentThread->space;
+    OpenFile *openFile = space ? space->GetOpenFile(id) : NULL;
+
+    if (openFile == NULL)
+        return -1;
+    return space->WriteFile(openFile, buffer, size);
 }
 
+//----------------------------------------------------------------------
+// FileSystem::CloseFile
+// 	Close the file the running program has open as "id".  Return 1,
+//	or -1 if "id" was not open.
+//----------------------------------------------------------------------
+
 int FileSystem::CloseFile(OpenFileId id){
-	currentOpenFile->~OpenFile();
-	currentOpenFile = NULL;
-	return 1;
+    AddrSpace *space = kernel->currentThread->space;
+
+    if (space == NULL || !space->CloseOpenFile(id))
+        return -1;
+    return 1;
 }
 
 bool FileSystem::CreateDirectory(char *name){
 
+    DirCacheEntry *parent;
 	Directory *directory;
     PersistentBitmap *freeMap;
     FileHeader *hdr;
+    char path[MaxPathLen], leaf[FileNameMaxLen + 1];
     int sector;
     bool success;	
 
-	directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-
-	OpenFile *tempFile = directoryFile;
-    char *path = strtok(name, "/");
-
-    while(path != NULL){
-        name = path;
-        if ((sector = directory->Find(path)) == -1 || !directory->IsDir(path)) break;
-        tempFile = new OpenFile(sector);	
-        directory->FetchFrom(tempFile);
-        path = strtok(NULL, "/");
-    }
-
-	if (directory->Find(name) != -1){
-        delete directory;
-        return FALSE; 
-    }
-    
-    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
-    sector = freeMap->FindAndSet();
-    if (sector == -1) success = FALSE;
-    else if (!directory->Add(name, sector, TRUE)) success = FALSE;
+    if (!NormalizePath(name, path) ||
+        (parent = LookupParent(path, leaf)) == NULL)
+        return FALSE; // no such directory
+    directory = parent->directory;
+
+    parent->lock->AcquireWrite();
+    freeMapLock->Acquire();
+    journal->Begin();
+    freeMap = FetchFreeMap(0);
+    sector = freeMap->NumClear() > 0 ? freeMap->FindAndSet() : -1;
+	if (parent->stale) success = FALSE; // the directory was removed meanwhile
+	else if (leaf[0] == '\0' || directory->Find(leaf) != -1) success = FALSE;
+    else if (sector == -1) success = FALSE;
+    else if (!directory->Add(leaf, sector, TRUE)) success = FALSE;
     else {
         hdr = new FileHeader;
         if (!hdr->Allocate(freeMap, DirectoryFileSize)) success = FALSE;
+        else if (!parent->file->Extend(freeMap, directory->FileSize())) success = FALSE;
         else {
             success = TRUE;
             hdr->WriteBack(sector);
@@ -513,16 +1617,21 @@ bool FileSystem::CreateDirectory(char *name){
             Directory *subDirectory = new Directory(NumDirEntries);
             subDirectory->WriteBack(subDirectoryFile);
 
-            directory->WriteBack(tempFile);
-            freeMap->WriteBack(freeMapFile);
+            directory->WriteBack(parent->file);
+            WriteFreeMap(freeMap);
 
             delete subDirectoryFile;
             delete subDirectory;
         }
+        if (!success) // undo the Add in the cached directory
+            directory->FetchFrom(parent->file);
         delete hdr;
     }
     delete freeMap;	
-    delete directory;
+    journal->End();
+    freeMapLock->Release();
+    parent->lock->ReleaseWrite();
+    ReleaseDir(parent);
 
     return success;
 }		
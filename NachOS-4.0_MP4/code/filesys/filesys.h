@@ -76,6 +76,43 @@ public:
 };
 
 #else // FILESYS
+class Directory;
+class Journal;
+class LayoutTotals;
+class Lock;
+class RWLock;
+
+#define MaxPathLen 256	   // longest path name, with the trailing '\0'
+#define DirCacheSize 64	   // directories kept by the dentry cache
+#define DirCacheBuckets 64 // hash buckets of the dentry cache
+
+// The following class defines an entry of the dentry cache: a directory
+// reached by walking "path" from the root, kept open together with its
+// in-core table, so that the next lookup of the same path (or of a path
+// below it) need not read the directories on the way from disk again.
+//
+// File system operations change the cached Directory itself and then
+// write it back, so the cached copy is always up to date.  They hold
+// the entry's lock while they do, shared to look names up and alone
+// to change them, so operations on different directories (and lookups
+// in the same one) go on at the same time.  An entry in use is pinned:
+// it is not evicted, or freed, until the last user lets go of it.
+
+class DirCacheEntry
+{
+public:
+	char path[MaxPathLen]; // absolute, e.g. "/a/b"; "/" for the root
+	int sector;			   // where the directory's header is on disk
+	OpenFile *file;		   // the directory file, open
+	Directory *directory;  // its contents
+	int lastUsed;		   // for LRU replacement
+	DirCacheEntry *next;   // next entry in the same hash bucket
+	RWLock *lock;		   // readers and writers of "directory"
+	int pins;			   // operations using the entry
+	bool stale;			   // dropped from the cache while pinned;
+						   // freed when the last pin goes
+};
+
 class FileSystem
 {
 public:
@@ -88,6 +125,8 @@ public:
 	// MP4 mod tag
 	~FileSystem();
 
+	void Sync(); // Commit journaled operations to disk
+
 	bool Create(char *name, int initialSize);
 	// Create a file (UNIX creat)
 
@@ -102,18 +141,78 @@ public:
 	void Print(); // List all the files and their contents
 
 	// TODO
-	OpenFile* currentOpenFile;
+	// Open-file calls for the running user program; "id" indexes the
+	// open-file table of its address space (see AddrSpace::AddOpenFile)
 	OpenFileId OpenAFile(char *name);
-	int ReadFile(char *buffer, int size, OpenFileId id);
-	int WriteFile(char *buffer, int size, OpenFileId id);
+	int ReadFile(int buffer, int size, OpenFileId id);
+	int WriteFile(int buffer, int size, OpenFileId id);
 	int CloseFile(OpenFileId id);
 	bool CreateDirectory(char *name);
 
+	bool ExtendFile(OpenFile *file, int newLength);
+	// Allocate disk space for an open file
+	// to grow to "newLength" bytes
+	bool Reserve(OpenFile *file, int newLength);
+	// Set that space aside, to be allocated
+	// later by ExtendFile
+	int FreeSectors(); // Free sectors not set aside
+
+	void Layout(); // Report how fragmented each file is
+	void Defrag(); // Move each fragmented file into one run
+	bool Check(bool repair); // Check the bitmap against the tree
+							 // of headers, and fix it if "repair"
+
 private:
 	OpenFile *freeMapFile;	 // Bit map of free disk blocks,
 							 // represented as a file
 	OpenFile *directoryFile; // "Root" directory -- list of
 							 // file names, represented as a file
+
+	Journal *journal;		 // Log of metadata updates
+
+	DirCacheEntry *dirCache[DirCacheBuckets]; // dentry cache, by path
+	int dirCacheCount;		 // entries in the cache
+	int dirCacheClock;		 // ticks on every lookup, for LRU
+	Lock *dirCacheLock;		 // protects the dentry cache itself;
+							 // taken before any directory's lock
+
+	Lock *freeMapLock;		 // held from reading the bitmap until
+							 // writing it back
+	int numFree;			 // clear bits in the bitmap on disk, or
+							 // -1 if not counted yet
+	int numReserved;		 // how many of them Reserve set aside;
+							 // both under freeMapLock
+
+	PersistentBitmap *FetchFreeMap(int keep);
+	// Read the bitmap, leaving out of its
+	// free count the sectors set aside,
+	// except "keep" of them
+	void WriteFreeMap(PersistentBitmap *freeMap);
+	// Write it back, and count what's free
+
+	DirCacheEntry *LookupDir(char *path);
+	// Find the directory named by an absolute,
+	// normalized path, and pin it; NULL if
+	// there is none
+	DirCacheEntry *LookupParent(char *path, char *leaf);
+	// Find the directory holding the last
+	// component of "path", which is copied
+	// into "leaf"
+	void ReleaseDir(DirCacheEntry *entry);
+	// Unpin an entry LookupDir/LookupParent
+	// returned
+	void InvalidateDir(char *path);
+	// Drop "path" and everything below it
+	// from the dentry cache
+	void DirCacheEvict();	 // Make room for one more entry
+	void FreeDirEntry(DirCacheEntry *entry);
+
+	void WalkTree(char *path, bool defrag, LayoutTotals *totals);
+	// Layout, or Defrag, of everything
+	// below the directory "path"
+	bool DefragFile(int sector);
+	// Move the file whose header is at
+	// "sector"; FALSE if it was left alone
 };
 
 #endif // FILESYS
@@ -7,6 +7,10 @@
 //	Also as in UNIX, for convenience, we keep the file header in
 //	memory while the file is open.
 //
+//	Files grow when written past their end.  The new data is first
+//	kept with the shared header; disk space for it is allocated, in
+//	one extent, only when that buffer fills up or the file is closed.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -17,30 +21,190 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "synch.h"
+
+//----------------------------------------------------------------------
+// OpenFileTable::OpenFileTable
+// 	Initialize an empty system-wide open-file table.
+//----------------------------------------------------------------------
+
+static int
+SharedHeaderKey(SharedHeader *entry)
+{
+    return entry->sector;
+}
+
+static unsigned
+SharedHeaderHash(int sector)
+{
+    return (unsigned)sector;
+}
+
+OpenFileTable::OpenFileTable()
+{
+    headers = new HashTable<int, SharedHeader *>(SharedHeaderKey,
+                                                 SharedHeaderHash);
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::~OpenFileTable
+// 	De-allocate the table, along with the headers of any files still
+//	open when Nachos halts.
+//----------------------------------------------------------------------
+
+OpenFileTable::~OpenFileTable()
+{
+    SharedHeader *entry;
+
+    while (!headers->IsEmpty())
+    {
+        HashIterator<int, SharedHeader *> iter(headers);
+        entry = headers->Remove(iter.Item()->sector);
+        delete entry->hdr;
+        delete[] entry->delayed;
+        delete entry->lock;
+        delete entry;
+    }
+    delete headers;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Acquire
+// 	Return the table entry of the file whose header is at "sector",
+//	reading the header from disk if no one has the file open yet.
+//----------------------------------------------------------------------
+
+SharedHeader *
+OpenFileTable::Acquire(int sector)
+{
+    SharedHeader *entry;
+
+    if (!headers->Find(sector, &entry))
+    {
+        entry = new SharedHeader;
+        entry->sector = sector;
+        entry->hdr = new FileHeader;
+        entry->hdr->FetchFrom(sector);
+        entry->refCount = 0;
+        entry->delayed = NULL;
+        entry->delayedBytes = 0;
+        entry->reserved = 0;
+        entry->lock = new RWLock("open file");
+        entry->removed = FALSE;
+        headers->Insert(entry);
+    }
+    entry->refCount++;
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Release
+// 	Drop a reference to the header at "sector"; the last one out
+//	frees the in-core header.
+//----------------------------------------------------------------------
+
+void OpenFileTable::Release(int sector)
+{
+    SharedHeader *entry;
+    bool found = headers->Find(sector, &entry);
+
+    ASSERT(found);
+    if (--entry->refCount == 0)
+    {
+        ASSERT(entry->delayedBytes == 0 && entry->reserved == 0);
+        headers->Remove(sector);
+        delete entry->hdr;
+        delete[] entry->delayed;
+        delete entry->lock;
+        delete entry;
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::Discard
+// 	The file whose header is at "sector" has been removed while still
+//	open.  Drop its delayed data, which must not get disk space now.
+//
+//	A flush may be under way already, waiting for the bitmap that the
+//	caller (FileSystem::Remove) holds; so the file is also marked
+//	removed, and FileSystem::ExtendFile, which checks the mark once it
+//	has the bitmap, or the journal, won't extend it.
+//
+//	Return how many free sectors were set aside for the delayed data,
+//	for the caller to give back.
+//----------------------------------------------------------------------
+
+int OpenFileTable::Discard(int sector)
+{
+    SharedHeader *entry;
+    int reserved = 0;
+
+    if (headers->Find(sector, &entry))
+    {
+        entry->delayedBytes = 0;
+        entry->removed = TRUE;
+        reserved = entry->reserved;
+        entry->reserved = 0;
+    }
+    return reserved;
+}
+
+//----------------------------------------------------------------------
+// OpenFileTable::FlushAll
+// 	Flush the delayed data of every open file, as when Nachos halts
+//	with files still open.
+//----------------------------------------------------------------------
+
+void OpenFileTable::FlushAll()
+{
+    List<int> sectors;
+    OpenFile *file;
+
+    // note the files first: flushing waits for the disk, and the
+    // table may change meanwhile
+    for (HashIterator<int, SharedHeader *> iter(headers); !iter.IsDone();
+         iter.Next())
+        if (iter.Item()->delayedBytes > 0)
+            sectors.Append(iter.Item()->sector);
+    while (!sectors.IsEmpty())
+    {
+        file = new OpenFile(sectors.RemoveFront());
+        (void)file->Flush();
+        delete file;
+    }
+}
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
-// 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+// 	Open a Nachos file for reading and writing.  The file header is
+//	shared through the system-wide open-file table, so it is only
+//	read from disk if the file is not open already.
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector)
 {
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    shared = kernel->openFileTable->Acquire(sector);
+    hdr = shared->hdr;
+    hdrSector = sector;
     seekPosition = 0;
+    nextSequential = 0;
+    readAhead = InitReadAhead;
+    readAheadEnd = 0;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	Data written past the allocated end of the file gets its disk
+//	space now.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    (void)Flush();
+    kernel->openFileTable->Release(hdrSector);
 }
 
 //----------------------------------------------------------------------
@@ -101,19 +265,87 @@ int OpenFile::Write(char *into, int numBytes)
 //	   so that we don't overwrite the unmodified portion.  We then copy
 //	   in the data that will be modified, and write back all the full
 //	   or partial sectors that are part of the request.
+//	Only the partial sectors are staged in a buffer of our own; whole
+//	sectors move directly between the caller's buffer and the disk
+//	(or the SynchDisk cache).
+//
+//	WriteAt past the end of the file makes the file longer; the part
+//	beyond the allocated sectors goes to the delayed data, and ReadAt
+//	finds it there.
 //
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
 //	"numBytes" -- the number of bytes to transfer
 //	"position" -- the offset within the file of the first byte to be
 //			read/written
+//
+//	ReadAt also reads ahead: when a read picks up where the previous
+//	one left off and runs past what was fetched so far, the next
+//	"readAhead" sectors of the file are read along with it, in the
+//	same disk requests.  They land in the SynchDisk cache, so the
+//	reads that follow are served without waiting for the disk.
 //----------------------------------------------------------------------
 
 int OpenFile::ReadAt(char *into, int numBytes, int position)
+{
+    int fileLength, allocated;
+    int done = 0;
+
+    if (numBytes <= 0)
+        return 0; // check request
+    shared->lock->AcquireRead();
+    allocated = hdr->FileLength();
+    fileLength = allocated + shared->delayedBytes;
+    if (position >= fileLength)
+        numBytes = 0;
+    else if ((position + numBytes) > fileLength)
+        numBytes = fileLength - position;
+    if (position < allocated)
+        done = ReadBlocks(into, min(numBytes, allocated - position), position);
+    if (done < numBytes) // the rest has no disk space yet
+        bcopy(&shared->delayed[position + done - allocated], &into[done],
+              numBytes - done);
+    shared->lock->ReleaseRead();
+    return numBytes;
+}
+
+int OpenFile::WriteAt(char *from, int numBytes, int position)
+{
+    int allocated;
+    int done = 0, count;
+
+    if (numBytes <= 0)
+        return 0; // check request
+    shared->lock->AcquireWrite();
+    allocated = hdr->FileLength();
+    if (position < allocated)
+        done = WriteBlocks(from, min(numBytes, allocated - position), position);
+    while (done < numBytes)
+    {
+        count = WriteDelayed(&from[done], numBytes - done, position + done);
+        if (count < 0)
+            break; // disk full
+        done += count;
+    }
+    shared->lock->ReleaseWrite();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadBlocks/WriteBlocks
+// 	ReadAt/WriteAt for a part of the file that has disk space, with
+//	the same conventions.  For a file kept in its header, that is the
+//	header.
+//----------------------------------------------------------------------
+
+int OpenFile::ReadBlocks(char *into, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int i, firstSector, lastSector, wantSector, numSectors;
+    bool firstPartial, lastPartial;
+    char first[SectorSize], last[SectorSize];
+    int *sectors;
+    char **buffers;
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
@@ -121,28 +353,76 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline())
+    { // the data is in the header: no disk I/O at all
+        bcopy(hdr->InlineData() + position, into, numBytes);
+        return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
-    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+    lastSector = wantSector = divRoundDown(position + numBytes - 1, SectorSize);
+
+    // adapt the read-ahead window: grow it while reads keep landing
+    // in sectors fetched ahead, shrink it when the file is read out
+    // of order, and restart it once the reads turn sequential again
+    if (position != nextSequential)
+        readAhead /= 2;
+    else if (position + numBytes <= readAheadEnd)
+        readAhead = min(2 * readAhead, MaxReadAhead);
+    else if (readAhead == 0)
+        readAhead = 1;
+    nextSequential = position + numBytes;
+
+    if (position + numBytes > readAheadEnd && readAhead > 0)
+    {
+        lastSector = min(lastSector + readAhead,
+                         divRoundDown(fileLength - 1, SectorSize));
+        readAheadEnd = (lastSector + 1) * SectorSize;
+    }
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
+    // whole sectors go straight into "into"; only the partial sectors
+    // at either end need a buffer of their own, and the sectors read
+    // ahead just go to the cache
+    firstPartial = (position != firstSector * SectorSize);
+    lastPartial = (position + numBytes != (wantSector + 1) * SectorSize) &&
+                  (wantSector != firstSector || !firstPartial);
+    sectors = new int[numSectors];
+    buffers = new char *[numSectors];
     for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    {
+        sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+        if (i == firstSector && firstPartial)
+            buffers[i - firstSector] = first;
+        else if (i == wantSector && lastPartial)
+            buffers[i - firstSector] = last;
+        else if (i > wantSector)
+            buffers[i - firstSector] = NULL;
+        else
+            buffers[i - firstSector] = &into[i * SectorSize - position];
+    }
+    kernel->synchDisk->ReadSectors(sectors, numSectors, buffers);
 
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete[] buf;
+    // copy the part we want out of the partial sectors
+    if (firstPartial)
+        bcopy(&first[position - firstSector * SectorSize], into,
+              min(numBytes, (firstSector + 1) * SectorSize - position));
+    if (lastPartial)
+        bcopy(last, &into[wantSector * SectorSize - position],
+              position + numBytes - wantSector * SectorSize);
+    delete[] buffers;
+    delete[] sectors;
     return numBytes;
 }
 
-int OpenFile::WriteAt(char *from, int numBytes, int position)
+int OpenFile::WriteBlocks(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
     bool firstAligned, lastAligned;
-    char *buf;
+    char first[SectorSize], last[SectorSize];
+    int *sectors;
+    char **buffers;
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
@@ -150,32 +430,51 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline())
+    {
+        bcopy(from, hdr->InlineData() + position, numBytes);
+        hdr->WriteBack(hdrSector);
+        return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    buf = new char[numSectors * SectorSize];
-
-    memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
-
     firstAligned = (position == (firstSector * SectorSize));
     lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
 
     // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
-
-    // copy in the bytes we want to change
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+    // (straight from the disk, so as not to disturb read-ahead), and
+    // copy in the bytes we want to change; whole sectors are written
+    // straight from "from"
+    sectors = new int[numSectors];
+    buffers = new char *[numSectors];
+    for (i = firstSector; i <= lastSector; i++)
+    {
+        sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+        if (i == firstSector && (!firstAligned || (i == lastSector && !lastAligned)))
+        {
+            kernel->synchDisk->ReadSector(sectors[0], first);
+            bcopy(from, &first[position - firstSector * SectorSize],
+                  min(numBytes, (firstSector + 1) * SectorSize - position));
+            buffers[0] = first;
+        }
+        else if (i == lastSector && !lastAligned)
+        {
+            kernel->synchDisk->ReadSector(sectors[numSectors - 1], last);
+            bcopy(&from[lastSector * SectorSize - position], last,
+                  position + numBytes - lastSector * SectorSize);
+            buffers[numSectors - 1] = last;
+        }
+        else
+            buffers[i - firstSector] = &from[i * SectorSize - position];
+    }
 
     // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
-    delete[] buf;
+    kernel->synchDisk->WriteSectors(sectors, numSectors, buffers);
+    delete[] buffers;
+    delete[] sectors;
     return numBytes;
 }
 
@@ -186,7 +485,108 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
 
 int OpenFile::Length()
 {
-    return hdr->FileLength();
+    return hdr->FileLength() + shared->delayedBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteDelayed
+// 	Write "numBytes" bytes at "position", at or past the allocated end
+//	of the file, into the delayed data; bytes skipped over read as
+//	zeros.  When the buffer fills up, it is flushed.
+//
+//	The disk space the data will need is set aside first, so that
+//	once the write is taken, the flush can't run out of room.
+//
+//	Return how many bytes were taken (possibly none, if only a hole
+//	was flushed to make room), or -1 if the disk is full.
+//----------------------------------------------------------------------
+
+int OpenFile::WriteDelayed(char *from, int numBytes, int position)
+{
+    const int size = DelayedSectors * SectorSize;
+    int offset = position - hdr->FileLength();
+    int count = offset < size ? min(numBytes, size - offset) : 0;
+    int end = max(shared->delayedBytes, min(offset + count, size));
+
+    ASSERT(offset >= 0);
+    if (!kernel->fileSystem->Reserve(this, hdr->FileLength() + end))
+        return -1;
+    if (shared->delayed == NULL)
+        shared->delayed = new char[size];
+    if (offset > shared->delayedBytes)
+    { // a hole: zero-fill up to the write
+        memset(&shared->delayed[shared->delayedBytes], 0,
+               min(offset, size) - shared->delayedBytes);
+        shared->delayedBytes = min(offset, size);
+    }
+    if (offset >= size)
+        return FlushDelayed() ? 0 : -1;
+
+    bcopy(from, &shared->delayed[offset], count);
+    shared->delayedBytes = max(shared->delayedBytes, offset + count);
+    if (shared->delayedBytes == size && !FlushDelayed())
+        return -1;
+    return count;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Flush
+// 	Give the delayed data disk space, now that its size is known, and
+//	write it there.  The file system places the new sectors in one run
+//	if it can.  The space was set aside as the data was written (see
+//	WriteDelayed), so this only fails, returning FALSE, if the file
+//	was removed meanwhile.
+//
+//	FlushDelayed does the work, for WriteAt, which already holds the
+//	file's lock.
+//----------------------------------------------------------------------
+
+bool OpenFile::Flush()
+{
+    bool success;
+
+    if (shared->delayedBytes == 0)
+        return TRUE; // also keeps closing files at halt off the lock
+    shared->lock->AcquireWrite();
+    success = FlushDelayed();
+    shared->lock->ReleaseWrite();
+    return success;
+}
+
+bool OpenFile::FlushDelayed()
+{
+    int allocated = hdr->FileLength();
+    int numBytes = shared->delayedBytes;
+    bool success;
+
+    if (numBytes == 0)
+        return TRUE;
+    success = kernel->fileSystem->ExtendFile(this, allocated + numBytes);
+    shared->delayedBytes = 0;
+    if (success)
+        WriteBlocks(shared->delayed, numBytes, allocated);
+    else
+        DEBUG(dbgFile, "Not flushing " << numBytes << " bytes: file removed");
+    return success;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Extend
+// 	Grow the file to "newLength" bytes, taking the new data blocks
+//	from "freeMap", and write the updated file header back to disk.
+//	Return FALSE if the disk is too full; the file is then unchanged.
+//
+//	The caller must write "freeMap" back for the change to stick.
+//----------------------------------------------------------------------
+
+bool OpenFile::Extend(PersistentBitmap *freeMap, int newLength)
+{
+    if (newLength <= hdr->FileLength())
+        return TRUE;
+    if (!hdr->Extend(freeMap, newLength))
+        return FALSE;
+    hdr->WriteBack(hdrSector);
+    return TRUE;
 }
 
 #endif //FILESYS_STUB
@@ -73,7 +73,72 @@ private:
 };
 
 #else // FILESYS
+#include "hash.h"
+
 class FileHeader;
+class PersistentBitmap;
+class RWLock;
+
+// How much a file may be written past its allocated end before the
+// new data is given disk space, in sectors.  Until then the data is
+// held in memory, so the file grows by one extent of up to this size
+// at a time instead of a sector per write.
+
+const int DelayedSectors = 1024;
+
+// The following class defines one entry of the system-wide open-file
+// table: the in-core copy of a file header, shared by every OpenFile
+// on that file, and the data written past the end of the file that
+// has no disk space yet.  Its reader/writer lock lets reads of the
+// file go on together, while a write has the file to itself.
+
+class SharedHeader
+{
+public:
+	int sector;		 // where the header lives on disk
+	FileHeader *hdr; // the in-core copy
+	int refCount;	 // OpenFiles using it
+	char *delayed;	 // bytes following hdr->FileLength(),
+					 // DelayedSectors worth; NULL if unused
+	int delayedBytes; // how many of them the file has
+	int reserved;	 // free sectors set aside for them (see
+					 // FileSystem::Reserve)
+	RWLock *lock;	 // shared by ReadAt, held alone by WriteAt
+					 // and Flush
+	bool removed;	 // the file was removed while open: it must
+					 // not get disk space any more
+};
+
+// The following class defines the system-wide open-file table.  Each
+// file header is read from disk when its file is first opened, and
+// kept until the last OpenFile on the file is closed; opening the same
+// file again reuses the in-core header, so every open of a file sees
+// the same length and block map.
+
+class OpenFileTable
+{
+public:
+	OpenFileTable();
+	~OpenFileTable();
+
+	SharedHeader *Acquire(int sector); // Header at "sector", shared
+	void Release(int sector);		 // Drop one reference to it
+	int Discard(int sector);		 // The file is gone: forget its
+									 // delayed data
+	void FlushAll();				 // Give every file's delayed data
+									 // disk space, and write it
+
+private:
+	HashTable<int, SharedHeader *> *headers; // by header sector
+};
+
+// Bounds, in sectors, on how far ahead of a sequential reader an
+// OpenFile fetches.  The window starts at InitReadAhead, doubles each
+// time a read is served from sectors fetched ahead, and halves each
+// time the file is read out of order.
+
+const int InitReadAhead = 4;
+const int MaxReadAhead = 32;
 
 class OpenFile
 {
@@ -100,13 +165,40 @@ public:
 				  // file (this interface is simpler
 				  // than the UNIX idiom -- lseek to
 				  // end of file, tell, lseek back
+
+	bool Extend(PersistentBitmap *freeMap, int newLength);
+				  // Grow the file, allocating its new
+				  // blocks from "freeMap"; the caller
+				  // flushes "freeMap" afterwards
+	bool Flush(); // Allocate and write the data
+				  // written past the allocated end
   
   // TODO
   FileHeader* getHdr() { return hdr;}
+  int getHdrSector() { return hdrSector;}
+  RWLock* getLock() { return shared->lock;}
+  bool IsRemoved() { return shared->removed;}
+  int getReserved() { return shared->reserved;}
+  void setReserved(int count) { shared->reserved = count;}
 
 private:
+	SharedHeader *shared; // Entry in the open-file table
 	FileHeader *hdr;  // Header for this file
+	int hdrSector;	  // Where the header lives on disk
 	int seekPosition; // Current position within the file
+
+	int nextSequential; // Where a read continuing the last one starts
+	int readAhead;		// Sectors to fetch past a sequential read
+	int readAheadEnd;	// File offset up to which sectors were
+						// already fetched ahead
+
+	int ReadBlocks(char *into, int numBytes, int position);
+	int WriteBlocks(char *from, int numBytes, int position);
+						// ReadAt/WriteAt within the
+						// allocated part of the file
+	int WriteDelayed(char *from, int numBytes, int position);
+						// WriteAt past it
+	bool FlushDelayed(); // Flush, with the lock held
 };
 
 #endif // FILESYS
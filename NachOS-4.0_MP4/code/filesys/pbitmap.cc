@@ -8,6 +8,7 @@
 
 #include "copyright.h"
 #include "pbitmap.h"
+#include "disk.h"
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -21,6 +22,9 @@
 
 PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems)
 {
+    goal = 0;
+    setAside = 0;
+    onDisk = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -40,7 +44,10 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    goal = 0;
+    setAside = 0;
+    onDisk = NULL;
+    FetchFrom(file);
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +57,7 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
 
 PersistentBitmap::~PersistentBitmap()
 {
+    delete[] onDisk;
 }
 
 //----------------------------------------------------------------------
@@ -62,16 +70,140 @@ PersistentBitmap::~PersistentBitmap()
 void PersistentBitmap::FetchFrom(OpenFile *file)
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    if (onDisk == NULL)
+        onDisk = new unsigned int[numWords];
+    bcopy(map, onDisk, numWords * sizeof(unsigned));
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
 // 	Store the contents of a persistent bitmap to a Nachos file.
+//	Only the sectors of the file that changed since the bitmap was
+//	read are written; an operation usually flips a handful of bits,
+//	and the whole map takes hundreds of sectors.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
 
 void PersistentBitmap::WriteBack(OpenFile *file)
 {
-    file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    int numBytes = numWords * sizeof(unsigned);
+    char *now = (char *)map, *then = (char *)onDisk;
+    int start, end;
+
+    if (onDisk == NULL)
+    {
+        file->WriteAt(now, numBytes, 0);
+        onDisk = new unsigned int[numWords];
+    }
+    else
+        for (start = 0; start < numBytes; start = end)
+        {
+            end = min(start + SectorSize, numBytes);
+            if (memcmp(&now[start], &then[start], end - start) != 0)
+                file->WriteAt(&now[start], end - start, start);
+        }
+    bcopy(map, onDisk, numBytes);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSet
+// 	Return the number of the first bit which is clear, at or after
+//	"goal" (wrapping around), and set it.  The search for the next
+//	bit starts just past it, so consecutive calls hand out
+//	consecutive free bits.  Return -1 if no bits are clear.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSet()
+{
+    int which;
+
+    for (int i = 0; i < numBits; i++)
+    {
+        which = (goal + i) % numBits;
+        if (!Test(which))
+        {
+            Mark(which);
+            goal = which + 1;
+            return which;
+        }
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::PlaceNear
+// 	Look for "count" consecutive clear bits, starting at "which" and
+//	wrapping around, and make FindAndSet hand them out next.  If there
+//	is no run that long, FindAndSet just starts at "which".
+//
+//	Used to give a growing file one contiguous extent, right after
+//	the blocks it already has if possible.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::PlaceNear(int which, int count)
+{
+    int bit, run = 0;
+
+    goal = which % numBits;
+    for (int i = 0; i < numBits; i++)
+    {
+        bit = (goal + i) % numBits;
+        if (bit == 0 || Test(bit))
+            run = 0; // runs do not wrap around
+        if (!Test(bit) && ++run == count)
+        {
+            goal = bit - count + 1;
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::PlaceAligned
+// 	Find the first run of "count" clear bits that starts at a
+//	multiple of "align", and make FindAndSet hand them out next.
+//	Return FALSE, changing nothing, if there is no such run.
+//----------------------------------------------------------------------
+
+bool PersistentBitmap::PlaceAligned(int count, int align)
+{
+    int start = 0, i;
+
+    while (start + count <= numBits)
+    {
+        for (i = start; i < start + count && !Test(i); i++)
+            ;
+        if (i == start + count)
+        {
+            goal = start;
+            return TRUE;
+        }
+        start = (i / align + 1) * align; // past the set bit
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::SetAside
+// 	Make NumClear leave out "count" of the clear bits, as they are
+//	promised to data that has no disk space yet (see
+//	FileSystem::Reserve).  FileHeader checks NumClear before it
+//	allocates anything, so the space stays there for that data.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::SetAside(int count)
+{
+    ASSERT(count >= 0);
+    setAside = count;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::NumClear
+// 	Return the number of clear bits that are not set aside.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::NumClear() const
+{
+    return Bitmap::NumClear() - setAside;
 }
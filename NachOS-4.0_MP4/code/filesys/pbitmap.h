@@ -31,6 +31,26 @@ public:
 
     void FetchFrom(OpenFile *file); // read bitmap from the disk
     void WriteBack(OpenFile *file); // write bitmap contents to disk
+
+    int FindAndSet();               // Like Bitmap::FindAndSet, but
+                                    // searching from "goal" on
+    void PlaceNear(int which, int count);
+                                    // Aim the next "count" FindAndSets
+                                    // at a free run near "which"
+    bool PlaceAligned(int count, int align);
+                                    // Same, at the first free run that
+                                    // starts at a multiple of "align"
+
+    void SetAside(int count);       // Leave "count" clear bits out of
+                                    // NumClear: they are spoken for
+    int NumClear() const;           // Bitmap::NumClear, less those
+
+private:
+    int goal;             // where FindAndSet starts looking
+    int setAside;         // clear bits NumClear doesn't count
+    unsigned int *onDisk; // the map as last read or written, so that
+                          // WriteBack can skip the unchanged sectors;
+                          // NULL if it is not known
 };
 
 #endif // PBITMAP_H
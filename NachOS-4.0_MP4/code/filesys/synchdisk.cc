@@ -5,10 +5,19 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Each request carries its own semaphore, which the disk interrupt
+//	handler signals when the request is done.  Because the physical
+//	disk can only handle one operation at a time, requests that
+//	arrive while it is busy are queued, and the interrupt handler
+//	starts the next one chosen by the scheduling policy (by default
+//	C-LOOK, which keeps the head sweeping in one direction).
+//
+//	A small write-through cache of recently used sectors sits in
+//	front of the queue.  It is what OpenFile read-ahead fills.
+//
+//	The metadata journal is here too: it decides which writes go to
+//	the log instead of their home sectors, and writes the log itself
+//	below the cache.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,19 +25,58 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Describe a request for a run of "count" consecutive sectors,
+//	starting at "sector", to be read into or written from "buf".
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int sector, char *buf, int count, bool write)
+{
+    sectorNumber = sector;
+    data = buf;
+    numSectors = count;
+    writing = write;
+    done = new Semaphore("disk request", 0);
+}
+
+DiskRequest::~DiskRequest()
+{
+    delete done;
+}
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"policy" -- how to order requests queued while the disk is busy
+//	"mapDisk" -- how the raw disk gets at its UNIX file (see Disk::Disk)
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+static int
+SectorKey(CachedSector *entry)
+{
+    return entry->sectorNumber;
+}
+
+static unsigned
+SectorHash(int sectorNumber)
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
-    disk = new Disk(this);
+    return (unsigned)sectorNumber;
+}
+
+SynchDisk::SynchDisk(DiskSchedPolicy policy, bool mapDisk)
+{
+    this->policy = policy;
+    queue = new List<DiskRequest *>;
+    active = NULL;
+    cache = new HashTable<int, CachedSector *>(SectorKey, SectorHash);
+    lru = new List<CachedSector *>;
+    journal = NULL;
+    disk = new Disk(this, mapDisk);
 }
 
 //----------------------------------------------------------------------
@@ -39,9 +87,13 @@ SynchDisk::SynchDisk()
 
 SynchDisk::~SynchDisk()
 {
+    ASSERT(active == NULL && queue->IsEmpty());
     delete disk;
-    delete lock;
-    delete semaphore;
+    delete queue;
+    while (!lru->IsEmpty())
+        delete cache->Remove(lru->RemoveFront()->sectorNumber);
+    delete lru;
+    delete cache;
 }
 
 //----------------------------------------------------------------------
@@ -55,10 +107,7 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    ReadSectors(&sectorNumber, 1, &data);
 }
 
 //----------------------------------------------------------------------
@@ -72,19 +121,796 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    WriteSectors(&sectorNumber, 1, &data);
+}
+
+//----------------------------------------------------------------------
+// RunLength
+// 	Return how many entries, starting at "sectorNumbers[0]", name
+//	physically consecutive disk sectors.
+//----------------------------------------------------------------------
+
+static int
+RunLength(int *sectorNumbers, int numSectors)
+{
+    int run = 1;
+
+    while (run < numSectors &&
+           sectorNumbers[run] == sectorNumbers[run - 1] + 1)
+        run++;
+    return run;
+}
+
+//----------------------------------------------------------------------
+// Contiguous
+// 	Return TRUE if the "numSectors" buffers follow one another in
+//	memory, so the disk can transfer them in one go.
+//----------------------------------------------------------------------
+
+static bool
+Contiguous(char **buffers, int numSectors)
+{
+    for (int i = 1; i < numSectors; i++)
+        if (buffers[i] != buffers[0] + i * SectorSize)
+            return FALSE;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Transfer
+// 	Split a list of sectors into runs of consecutive sectors, queue
+//	one request per run, and wait for all of them.  All the runs are
+//	queued before waiting, so the scheduler can order them together
+//	with whatever other threads are asking for.
+//
+//	A run whose buffers lie back to back in memory is transferred in
+//	place; otherwise it goes through a staging buffer.
+//----------------------------------------------------------------------
+
+void SynchDisk::Transfer(int *sectorNumbers, int numSectors, char **buffers,
+                         bool writing)
+{
+    DiskRequest **requests = new DiskRequest *[numSectors];
+    char **staging = new char *[numSectors];
+    int *first = new int[numSectors];
+    int i, j, run, numRequests = 0;
+    char *data;
+
+    for (i = 0; i < numSectors; i += run)
+    {
+        run = RunLength(&sectorNumbers[i], numSectors - i);
+        if (Contiguous(&buffers[i], run))
+        {
+            data = buffers[i];
+            staging[numRequests] = NULL;
+        }
+        else
+        {
+            data = staging[numRequests] = new char[run * SectorSize];
+            if (writing)
+                for (j = 0; j < run; j++)
+                    bcopy(buffers[i + j], &data[j * SectorSize], SectorSize);
+        }
+        first[numRequests] = i;
+        requests[numRequests] = new DiskRequest(sectorNumbers[i], data,
+                                                run, writing);
+        Submit(requests[numRequests++]);
+    }
+    for (i = 0; i < numRequests; i++)
+    {
+        requests[i]->done->P(); // wait for interrupt
+        if (staging[i] != NULL)
+        {
+            if (!writing)
+                for (j = 0; j < requests[i]->numSectors; j++)
+                    bcopy(&staging[i][j * SectorSize],
+                          buffers[first[i] + j], SectorSize);
+            delete[] staging[i];
+        }
+        delete requests[i];
+    }
+    delete[] first;
+    delete[] staging;
+    delete[] requests;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read a list of disk sectors, each into its own buffer.  Return
+//	only after all the data has been read.  Sectors found in the
+//	cache are copied from there; the rest are read from the disk
+//	straight into the caller's buffers, with consecutive sectors
+//	merged into one Disk request so they pay a single seek.
+//
+//	A NULL buffer asks for the sector to be cached but not copied
+//	anywhere, which is how OpenFile reads ahead.
+//
+//	"sectorNumbers" -- the disk sectors to read
+//	"numSectors" -- how many sectors are listed
+//	"buffers" -- where each sector goes, SectorSize bytes apiece
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int *sectorNumbers, int numSectors, char **buffers)
+{
+    int *sectors = new int[numSectors];
+    char **into = new char *[numSectors];
+    char *scratch = NULL;
+    int i, numMissing = 0, numScratch = 0;
+
+    for (i = 0; i < numSectors; i++)
+        if (!CacheLookup(sectorNumbers[i], buffers[i]) &&
+            (journal == NULL || !journal->Lookup(sectorNumbers[i], buffers[i])))
+        {
+            sectors[numMissing] = sectorNumbers[i];
+            into[numMissing++] = buffers[i];
+            if (buffers[i] == NULL)
+                numScratch++;
+        }
+
+    if (numMissing > 0)
+    {
+        // sectors wanted only for the cache still need somewhere to land
+        if (numScratch > 0)
+        {
+            scratch = new char[numScratch * SectorSize];
+            for (i = 0, numScratch = 0; i < numMissing; i++)
+                if (into[i] == NULL)
+                    into[i] = &scratch[SectorSize * numScratch++];
+        }
+        Transfer(sectors, numMissing, into, FALSE);
+        for (i = 0; i < numMissing; i++)
+            CacheInsert(sectors[i], into[i], FALSE);
+        delete[] scratch;
+    }
+    delete[] into;
+    delete[] sectors;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write a list of disk sectors, each from its own buffer.  Return
+//	only after all the data has been written.  The cache is updated
+//	too, so later reads see the new contents.
+//
+//	"sectorNumbers" -- the disk sectors to write
+//	"numSectors" -- how many sectors are listed
+//	"buffers" -- the new contents of each sector
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteSectors(int *sectorNumbers, int numSectors, char **buffers)
+{
+    int i;
+
+    if (journal != NULL && journal->Logging())
+    {
+        for (i = 0; i < numSectors; i++)
+        {
+            journal->Log(sectorNumbers[i], buffers[i]);
+            CacheInsert(sectorNumbers[i], buffers[i], TRUE);
+        }
+        return;
+    }
+    for (i = 0; i < numSectors; i++)
+    {
+        if (journal != NULL)
+            journal->Revoke(sectorNumbers[i]);
+        CacheInsert(sectorNumbers[i], buffers[i], TRUE);
+    }
+    Transfer(sectorNumbers, numSectors, buffers, TRUE);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CacheLookup
+// 	If "sectorNumber" is cached, copy it into "data" (unless "data"
+//	is NULL), mark it most recently used, and return TRUE.  Otherwise
+//	return FALSE.
+//----------------------------------------------------------------------
+
+bool SynchDisk::CacheLookup(int sectorNumber, char *data)
+{
+    CachedSector *entry;
+
+    if (!cache->Find(sectorNumber, &entry))
+        return FALSE;
+    if (data != NULL)
+        bcopy(entry->data, data, SectorSize);
+    lru->Remove(entry);
+    lru->Append(entry);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CacheInsert
+// 	Remember the contents of "sectorNumber", evicting the least
+//	recently used sector if the cache is full.
+//
+//	A read that went to the disk passes "replace" FALSE: if a write
+//	to the same sector slipped in while it waited, the cache already
+//	holds the newer data and must keep it.
+//----------------------------------------------------------------------
+
+void SynchDisk::CacheInsert(int sectorNumber, char *data, bool replace)
+{
+    CachedSector *entry;
+
+    if (cache->Find(sectorNumber, &entry))
+    {
+        if (!replace)
+            return;
+        lru->Remove(entry);
+    }
+    else
+    {
+        if (lru->NumInList() >= (unsigned)CacheSectors)
+        {
+            entry = lru->RemoveFront();
+            cache->Remove(entry->sectorNumber);
+        }
+        else
+            entry = new CachedSector;
+        entry->sectorNumber = sectorNumber;
+        cache->Insert(entry);
+    }
+    bcopy(data, entry->data, SectorSize);
+    lru->Append(entry);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Submit
+// 	Hand a request to the disk if it is idle, otherwise queue it
+//	until the interrupt handler gets to it.
+//----------------------------------------------------------------------
+
+void SynchDisk::Submit(DiskRequest *request)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    if (active == NULL)
+        Dispatch(request);
+    else
+        queue->Append(request);
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Dispatch
+// 	Start "request" on the raw disk.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+void SynchDisk::Dispatch(DiskRequest *request)
+{
+    active = request;
+    if (request->writing)
+        disk->WriteRequest(request->sectorNumber, request->data,
+                           request->numSectors);
+    else
+        disk->ReadRequest(request->sectorNumber, request->data,
+                          request->numSectors);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::PickNext
+// 	Remove from the queue, and return, the request to serve next
+//	given where the disk head is now.  Return NULL if nothing waits.
+//
+//	FIFO takes the oldest request.  SSTF takes the one on the track
+//	closest to the head.  C-LOOK takes the lowest track at or past
+//	the head; if there is none, it wraps around to the lowest track.
+//	Ties go to the oldest request, so nothing starves on one track.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::PickNext()
+{
+    DiskRequest *best = NULL, *lowest = NULL;
+    int head = disk->HeadSector() / SectorsPerTrack;
+    int track, bestKey = 0;
+
+    if (queue->IsEmpty())
+        return NULL;
+    if (policy == DiskFIFO)
+        return queue->RemoveFront();
+
+    ListIterator<DiskRequest *> iter(queue);
+    for (; !iter.IsDone(); iter.Next())
+    {
+        track = iter.Item()->sectorNumber / SectorsPerTrack;
+        if (policy == DiskSSTF)
+        {
+            if (best == NULL || abs(track - head) < bestKey)
+            {
+                best = iter.Item();
+                bestKey = abs(track - head);
+            }
+        }
+        else
+        {
+            if (track >= head && (best == NULL || track < bestKey))
+            {
+                best = iter.Item();
+                bestKey = track;
+            }
+            if (lowest == NULL ||
+                track < lowest->sectorNumber / SectorsPerTrack)
+                lowest = iter.Item();
+        }
+    }
+    if (best == NULL) // C-LOOK: nothing ahead of the head, wrap around
+        best = lowest;
+    queue->Remove(best);
+    return best;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Wake up the thread waiting for the disk
+//	request to finish, and start the next queued request, if any.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack()
 {
-    semaphore->V();
+    DiskRequest *finished = active;
+
+    active = PickNext();
+    if (active != NULL)
+        Dispatch(active);
+    finished->done->V();
+}
+
+// The layout of the log header and of a group descriptor.  The header
+// only uses "magic" and "commit", the number of the first commit after
+// it.
+
+class LogDescriptor
+{
+public:
+    unsigned magic;            // JournalMagic
+    unsigned commit;           // the commit the group belongs to
+    int count;                 // sectors logged in the group
+    int last;                  // last group of the commit?
+    unsigned checksum;         // of "homes" and the logged sectors
+    int homes[EntriesPerGroup]; // where the logged sectors belong
+};
+
+//----------------------------------------------------------------------
+// LogSize
+// 	Return how many log sectors it takes to commit "numLogged"
+//	sectors: the sectors themselves, and a descriptor per group.
+//----------------------------------------------------------------------
+
+static int
+LogSize(int numLogged)
+{
+    return numLogged + divRoundUp(numLogged, EntriesPerGroup);
+}
+
+//----------------------------------------------------------------------
+// GroupChecksum
+// 	Checksum (FNV-1a) a group's list of home sectors and the logged
+//	sectors that follow its descriptor in "data".
+//----------------------------------------------------------------------
+
+static unsigned
+GroupChecksum(LogDescriptor *desc, char *data)
+{
+    unsigned hash = 2166136261u;
+    unsigned char *p = (unsigned char *)desc->homes;
+    int i;
+
+    for (i = 0; i < desc->count * (int)sizeof(int); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    for (i = 0; i < desc->count * SectorSize; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    return hash;
+}
+
+static int
+SectorOrder(CachedSector *x, CachedSector *y)
+{
+    return x->sectorNumber - y->sectorNumber;
+}
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Set up a journal logging to the "numSectors" sectors starting at
+//	"firstSector".  Format or Recover must be called before use.
+//----------------------------------------------------------------------
+
+Journal::Journal(int firstSector, int numSectors)
+{
+    ASSERT(numSectors > LogSize(1));
+    this->firstSector = firstSector;
+    this->numSectors = numSectors;
+    tail = firstSector + 1;
+    nextCommit = 1;
+    lock = new Lock("journal");
+    depth = numOps = 0;
+    pending = new HashTable<int, CachedSector *>(SectorKey, SectorHash);
+    pendingList = new List<CachedSector *>;
+    committed = new HashTable<int, CachedSector *>(SectorKey, SectorHash);
+    committedList = new SortedList<CachedSector *>(SectorOrder);
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.  Whatever was not committed is lost, as
+//	in a crash; what was committed is still in the log on disk.
+//----------------------------------------------------------------------
+
+Journal::~Journal()
+{
+    CachedSector *entry;
+
+    while (!pendingList->IsEmpty())
+    {
+        entry = pendingList->RemoveFront();
+        delete pending->Remove(entry->sectorNumber);
+    }
+    while (!committedList->IsEmpty())
+    {
+        entry = committedList->RemoveFront();
+        delete committed->Remove(entry->sectorNumber);
+    }
+    delete pending;
+    delete pendingList;
+    delete committed;
+    delete committedList;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Clear the log region of a newly formatted disk, and start an
+//	empty log.  Clearing it all means nothing left there from an
+//	earlier file system can pass for a commit.
+//----------------------------------------------------------------------
+
+void Journal::Format()
+{
+    char *buf = new char[numSectors * SectorSize];
+    LogDescriptor *header = (LogDescriptor *)buf;
+
+    memset(buf, 0, numSectors * SectorSize);
+    header->magic = JournalMagic;
+    header->commit = nextCommit = 1;
+    LogTransfer(firstSector, numSectors, buf, TRUE);
+    tail = firstSector + 1;
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Read the whole log back, in one request, and find the commits
+//	in it: starting from the one named by the header, each commit
+//	whose groups all check out is taken, in order, up to the first
+//	one that does not (which was cut short by a crash, if anything).
+//
+//	The sectors of the commits found are kept as committed; they are
+//	served from the journal, and written home at the next checkpoint.
+//
+//	A disk with no log was formatted before there was a journal: the
+//	log region may hold its files, so it can't be used.  Only
+//	"nachos -f" lays out a log.
+//----------------------------------------------------------------------
+
+void Journal::Recover()
+{
+    char *buf = new char[numSectors * SectorSize];
+    LogDescriptor *header = (LogDescriptor *)buf;
+    LogDescriptor *desc;
+    int pos, start, i, numCommits = 0;
+
+    LogTransfer(firstSector, numSectors, buf, FALSE);
+    if (header->magic != JournalMagic)
+        cerr << "No journal on the disk: it must be formatted again "
+             << "(nachos -f)\n";
+    ASSERT(header->magic == JournalMagic);
+
+    nextCommit = header->commit;
+    for (pos = start = 1; pos < numSectors; pos += 1 + desc->count)
+    {
+        desc = (LogDescriptor *)&buf[pos * SectorSize];
+        if (desc->magic != JournalMagic || desc->commit != nextCommit ||
+            desc->count < 1 || desc->count > EntriesPerGroup ||
+            pos + 1 + desc->count > numSectors ||
+            desc->checksum != GroupChecksum(desc, &buf[(pos + 1) * SectorSize]))
+            break;
+        if (!desc->last)
+            continue;
+
+        // the commit is complete: take all of its groups
+        for (; start <= pos; start += 1 + desc->count)
+        {
+            desc = (LogDescriptor *)&buf[start * SectorSize];
+            for (i = 0; i < desc->count; i++)
+                Remember(desc->homes[i], &buf[(start + 1 + i) * SectorSize]);
+        }
+        desc = (LogDescriptor *)&buf[pos * SectorSize];
+        nextCommit++;
+        numCommits++;
+    }
+    tail = firstSector + start;
+    DEBUG(dbgFile, "Journal recovered " << numCommits << " commits, "
+                                        << committedList->NumInList() << " sectors");
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin/End
+// 	Bracket one file system operation.  Operations are serialized;
+//	a thread already inside one may start another (it becomes part
+//	of the outer one).  Once enough operations have finished, End
+//	commits them together.
+//----------------------------------------------------------------------
+
+void Journal::Begin()
+{
+    if (lock->IsHeldByCurrentThread())
+    {
+        depth++;
+        return;
+    }
+    lock->Acquire();
+    depth = 1;
+}
+
+void Journal::End()
+{
+    ASSERT(lock->IsHeldByCurrentThread());
+    if (--depth > 0)
+        return;
+    if (++numOps >= GroupCommitOps)
+        Commit();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Sync
+// 	Commit the operations finished so far, as when Nachos halts.  If
+//	this thread is in the middle of an operation, nothing is
+//	committed: its half-done changes must not reach the log.  If
+//	another thread is, wait for it to finish.
+//
+//	If "home", also checkpoint, so that the sectors on the disk are
+//	up to date by themselves, for a tool that reads them directly.
+//----------------------------------------------------------------------
+
+void Journal::Sync(bool home)
+{
+    if (lock->IsHeldByCurrentThread())
+        return;
+    lock->Acquire();
+    if (depth == 0)
+    {
+        Commit();
+        if (home)
+            Checkpoint();
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Log
+// 	Record that the current operation wrote "data" to "sectorNumber".
+//	An operation too big for the log is committed in pieces, giving
+//	up its atomicity.
+//----------------------------------------------------------------------
+
+void Journal::Log(int sectorNumber, char *data)
+{
+    CachedSector *entry;
+
+    ASSERT(Logging());
+    if (pending->Find(sectorNumber, &entry))
+    {
+        bcopy(data, entry->data, SectorSize);
+        return;
+    }
+    if (LogSize(pendingList->NumInList() + 1) > numSectors - 1)
+        Commit();
+    entry = new CachedSector;
+    entry->sectorNumber = sectorNumber;
+    bcopy(data, entry->data, SectorSize);
+    pending->Insert(entry);
+    pendingList->Append(entry);
+}
+
+//----------------------------------------------------------------------
+// Journal::Lookup
+// 	If "sectorNumber" has been logged and is not home yet, copy its
+//	latest contents into "data" (unless "data" is NULL) and return
+//	TRUE.  Otherwise return FALSE.
+//----------------------------------------------------------------------
+
+bool Journal::Lookup(int sectorNumber, char *data)
+{
+    CachedSector *entry;
+
+    if (!pending->Find(sectorNumber, &entry) &&
+        !committed->Find(sectorNumber, &entry))
+        return FALSE;
+    if (data != NULL)
+        bcopy(entry->data, data, SectorSize);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Revoke
+// 	A sector that was logged is about to be written outside of any
+//	operation (it was freed, and now holds file data).  Forget the
+//	uncommitted copy, and checkpoint the committed one, so that
+//	neither the checkpoint nor a recovery can later write the old
+//	metadata over the new data.
+//----------------------------------------------------------------------
+
+void Journal::Revoke(int sectorNumber)
+{
+    CachedSector *entry;
+
+    if (!pending->IsInTable(sectorNumber) && !committed->IsInTable(sectorNumber))
+        return;
+    lock->Acquire();
+    if (pending->Find(sectorNumber, &entry))
+    {
+        pending->Remove(sectorNumber);
+        pendingList->Remove(entry);
+        delete entry;
+    }
+    if (committed->IsInTable(sectorNumber))
+        Checkpoint();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	Append the pending sectors to the log, in groups of up to
+//	EntriesPerGroup behind a descriptor, with a single disk request.
+//	If they do not fit after the tail, checkpoint first.  Called
+//	with the lock held.
+//----------------------------------------------------------------------
+
+void Journal::Commit()
+{
+    int numLogged = pendingList->NumInList();
+    int needed = LogSize(numLogged);
+    int pos, i, logged, count;
+    CachedSector *entry;
+    LogDescriptor *desc;
+    char *buf;
+
+    numOps = 0;
+    if (numLogged == 0)
+        return;
+    ASSERT(needed <= numSectors - 1);
+    if (tail + needed > firstSector + numSectors)
+        Checkpoint();
+
+    buf = new char[needed * SectorSize];
+    memset(buf, 0, needed * SectorSize);
+    for (pos = logged = 0; logged < numLogged; logged += count)
+    {
+        count = min(EntriesPerGroup, numLogged - logged);
+        desc = (LogDescriptor *)&buf[pos * SectorSize];
+        desc->magic = JournalMagic;
+        desc->commit = nextCommit;
+        desc->count = count;
+        desc->last = (logged + count == numLogged);
+        for (i = 0; i < count; i++)
+        {
+            entry = pendingList->RemoveFront();
+            pending->Remove(entry->sectorNumber);
+            desc->homes[i] = entry->sectorNumber;
+            bcopy(entry->data, &buf[(pos + 1 + i) * SectorSize], SectorSize);
+            Remember(entry->sectorNumber, entry->data);
+            delete entry;
+        }
+        desc->checksum = GroupChecksum(desc, &buf[(pos + 1) * SectorSize]);
+        pos += 1 + count;
+    }
+    DEBUG(dbgFile, "Journal commit " << nextCommit << ": " << numLogged
+                                     << " sectors at " << tail);
+    LogTransfer(tail, needed, buf, TRUE);
+    tail += needed;
+    nextCommit++;
+    delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+// 	Write every committed sector to its home location, in sector
+//	order so the disk can merge and sweep, and then empty the log by
+//	moving the header past the commits in it.  Called with the lock
+//	held (or at mount time).
+//----------------------------------------------------------------------
+
+void Journal::Checkpoint()
+{
+    int numHome = committedList->NumInList();
+    int *sectors = new int[numHome];
+    char **buffers = new char *[numHome];
+    ListIterator<CachedSector *> iter(committedList);
+    CachedSector *entry;
+    int i;
+
+    if (numHome == 0 && tail == firstSector + 1)
+    {
+        delete[] sectors;
+        delete[] buffers;
+        return;
+    }
+    DEBUG(dbgFile, "Journal checkpoint: " << numHome << " sectors");
+    for (i = 0; !iter.IsDone(); iter.Next(), i++)
+    {
+        sectors[i] = iter.Item()->sectorNumber;
+        buffers[i] = iter.Item()->data;
+    }
+    kernel->synchDisk->Transfer(sectors, numHome, buffers, TRUE);
+    while (!committedList->IsEmpty())
+    {
+        entry = committedList->RemoveFront();
+        delete committed->Remove(entry->sectorNumber);
+    }
+    tail = firstSector + 1;
+    WriteHeader();
+    delete[] sectors;
+    delete[] buffers;
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteHeader
+// 	Write the log header, saying the log starts with commit
+//	"nextCommit".  Anything already in the log is thereby dropped.
+//----------------------------------------------------------------------
+
+void Journal::WriteHeader()
+{
+    char buf[SectorSize];
+    LogDescriptor *header = (LogDescriptor *)buf;
+
+    memset(buf, 0, SectorSize);
+    header->magic = JournalMagic;
+    header->commit = nextCommit;
+    LogTransfer(firstSector, 1, buf, TRUE);
+}
+
+//----------------------------------------------------------------------
+// Journal::Remember
+// 	Keep "data" as the committed contents of "sectorNumber", until
+//	the next checkpoint writes it home.
+//----------------------------------------------------------------------
+
+void Journal::Remember(int sectorNumber, char *data)
+{
+    CachedSector *entry;
+
+    if (!committed->Find(sectorNumber, &entry))
+    {
+        entry = new CachedSector;
+        entry->sectorNumber = sectorNumber;
+        committed->Insert(entry);
+        committedList->Insert(entry);
+    }
+    bcopy(data, entry->data, SectorSize);
+}
+
+//----------------------------------------------------------------------
+// Journal::LogTransfer
+// 	Read or write "count" consecutive log sectors, starting at
+//	"sector", to or from "buf", in one disk request.  The log does
+//	not go through the cache: nothing reads it but Recover.
+//----------------------------------------------------------------------
+
+void Journal::LogTransfer(int sector, int count, char *buf, bool writing)
+{
+    int *sectors = new int[count];
+    char **buffers = new char *[count];
+
+    for (int i = 0; i < count; i++)
+    {
+        sectors[i] = sector + i;
+        buffers[i] = &buf[i * SectorSize];
+    }
+    kernel->synchDisk->Transfer(sectors, count, buffers, writing);
+    delete[] sectors;
+    delete[] buffers;
 }
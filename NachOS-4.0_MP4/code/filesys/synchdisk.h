@@ -14,6 +14,50 @@
 #include "disk.h"
 #include "synch.h"
 #include "callback.h"
+#include "list.h"
+#include "hash.h"
+
+// Policies for choosing which queued request goes to the disk next.
+//	DiskFIFO  -- in order of arrival
+//	DiskSSTF  -- shortest seek (track distance from the head) first
+//	DiskCLOOK -- sweep the head towards higher tracks, serving requests
+//		     in track order, then jump back to the lowest waiting
+//		     track and sweep again
+
+enum DiskSchedPolicy { DiskFIFO, DiskSSTF, DiskCLOOK };
+
+// The following class describes one outstanding disk request: a run
+// of physically consecutive sectors to be read into or written from
+// "data".  The requesting thread waits on "done" until the disk
+// interrupt for this request arrives.
+
+class DiskRequest
+{
+public:
+    DiskRequest(int sector, char *buf, int count, bool write);
+    ~DiskRequest();
+
+    int sectorNumber; // first sector of the run
+    char *data;       // buffer holding numSectors * SectorSize bytes
+    int numSectors;   // length of the run
+    bool writing;     // write (TRUE) or read (FALSE)?
+    Semaphore *done;  // V'ed when the request completes
+};
+
+// Number of recently used sectors SynchDisk keeps in memory.  It
+// should be well above the largest OpenFile read-ahead window, so
+// that sectors fetched ahead survive until they are asked for.
+
+const int CacheSectors = 128;
+
+// A copy of one sector, as held by the sector cache and the journal.
+
+class CachedSector
+{
+public:
+    int sectorNumber;       // which sector this is a copy of
+    char data[SectorSize];  // its contents
+};
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -24,15 +68,31 @@
 //
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
-// returning.
+// returning.  Requests from different threads are queued while the
+// disk is busy, and the next one to run is picked according to the
+// scheduling policy, so that the head does not bounce across the disk.
+//
+// Recently read or written sectors are kept in a write-through cache,
+// so a read that finds its sector there does not go to the disk.
+//
+// Once a Journal is attached, writes made inside a journaled file
+// system operation go to the journal instead of their home sectors,
+// and reads look there before going to the disk.
+
+class Journal;
 
 class SynchDisk : public CallBackObj
 {
 public:
-    SynchDisk();  // Initialize a synchronous disk,
-                  // by initializing the raw Disk.
+    SynchDisk(DiskSchedPolicy policy = DiskCLOOK, bool mapDisk = TRUE);
+                  // Initialize a synchronous disk,
+                  // by initializing the raw Disk
+                  // (mapped into memory if "mapDisk").
     ~SynchDisk(); // De-allocate the synch disk data
 
+    void SetPolicy(DiskSchedPolicy p) { policy = p; }
+    DiskSchedPolicy GetPolicy() { return policy; }
+
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
     // only once the data is actually read
@@ -41,16 +101,145 @@ public:
     // then wait until the request is done.
     void WriteSector(int sectorNumber, char *data);
 
+    void ReadSectors(int *sectorNumbers, int numSectors, char **buffers);
+    // Scatter/gather versions of the above:
+    // transfer "numSectors" sectors, listed
+    // in "sectorNumbers", to/from the
+    // sector-sized "buffers".  Runs of
+    // physically consecutive sectors are
+    // merged into a single disk request.
+    // Sectors already in the cache are
+    // copied without touching the disk.
+    // A NULL read buffer only brings the
+    // sector into the cache.
+    void WriteSectors(int *sectorNumbers, int numSectors, char **buffers);
+
     void CallBack(); // Called by the disk device interrupt
                      // handler, to signal that the
                      // current disk operation is complete.
 
+    void SetJournal(Journal *j) { journal = j; }
+                     // Route metadata writes through "j"
+                     // (NULL to write everything home)
+
+    char *MapImage() { return disk->MapContents(); }
+    void UnmapImage(char *image) { disk->UnmapContents(image); }
+                     // The raw disk, read-only (see
+                     // Disk::MapContents); what the
+                     // journal holds is not there yet
+
+private:
+    friend class Journal;        // writes the log with Transfer
+
+
+    Disk *disk;                  // Raw disk device
+    DiskSchedPolicy policy;      // How to pick the next request
+    List<DiskRequest *> *queue;  // Requests waiting for the disk
+    DiskRequest *active;         // Request the disk is working on,
+                                 // NULL if the disk is idle
+    HashTable<int, CachedSector *> *cache;
+                                 // Cached sectors, by sector number
+    List<CachedSector *> *lru;   // The same sectors, least recently
+                                 // used first
+    Journal *journal;            // Metadata log, if any
+
+    bool CacheLookup(int sectorNumber, char *data);
+                                 // Copy out a cached sector, if any
+    void CacheInsert(int sectorNumber, char *data, bool replace);
+                                 // Remember a sector's contents
+
+    void Transfer(int *sectorNumbers, int numSectors, char **buffers,
+                  bool writing);
+                                 // Queue one request per run of
+                                 // consecutive sectors, wait for all
+    void Submit(DiskRequest *request);
+                                 // Start the request, or queue it
+                                 // if the disk is busy
+    void Dispatch(DiskRequest *request);
+                                 // Hand the request to the raw disk
+    DiskRequest *PickNext();     // Remove and return the queued
+                                 // request chosen by "policy"
+};
+
+// Parameters of the metadata journal.  Each group of logged sectors is
+// written after a descriptor sector listing where they belong; a commit
+// is one or more groups written to the log in a single disk request.
+
+const unsigned JournalMagic = 0x4a524e4c; // "JRNL", marks log sectors
+const int EntriesPerGroup = (SectorSize - 5 * sizeof(int)) / sizeof(int);
+const int GroupCommitOps = 16; // operations per commit, at most
+
+// The following class defines a write-ahead journal for file system
+// metadata.  File system operations are bracketed with Begin/End; the
+// sectors written in between (file headers, directory files, the free
+// map) are kept in memory, and the operations are committed a group at
+// a time by appending the new sector contents to a log region on the
+// disk, with one sequential write.  Logged sectors reach their home
+// locations only when the log fills up and is checkpointed.
+//
+// After a crash, Recover reads the log back and finds the operations
+// that were committed; those that were not are lost as a whole, so the
+// file system on disk is always consistent.
+//
+// The log region starts with a header sector holding the number of the
+// first commit in the log; each group's descriptor carries the number
+// of the commit it belongs to, a checksum, and a flag on the last group
+// of the commit.  A commit counts only if all of its groups check out.
+
+class Journal
+{
+public:
+    Journal(int firstSector, int numSectors);
+                                 // Use the "numSectors" sectors from
+                                 // "firstSector" on as the log
+    ~Journal();
+
+    void Format();               // Start an empty log on a new disk
+    void Recover();              // Find the operations committed to
+                                 // the log, at mount time
+
+    void Begin();                // Start a file system operation
+    void End();                  // Finish it; commits the group once
+                                 // GroupCommitOps operations are done
+    void Sync(bool home = FALSE); // Commit the finished operations
+                                 // now, and write them home as well
+                                 // if "home"
+
+    // Called by SynchDisk
+    bool Logging() { return lock->IsHeldByCurrentThread(); }
+                                 // Is this thread inside an operation?
+    void Log(int sectorNumber, char *data);
+                                 // Record a metadata write
+    bool Lookup(int sectorNumber, char *data);
+                                 // Latest logged contents, if any
+    void Revoke(int sectorNumber);
+                                 // A plain write is about to replace
+                                 // a logged sector
+
 private:
-    Disk *disk;           // Raw disk device
-    Semaphore *semaphore; // To synchronize requesting thread
-                          // with the interrupt handler
-    Lock *lock;           // Only one read/write request
-                          // can be sent to the disk at a time
+    int firstSector;             // the header sector of the log
+    int numSectors;              // size of the log region
+    int tail;                    // next free sector of the log
+    unsigned nextCommit;         // number of the next commit
+    Lock *lock;                  // held for the whole of an operation
+    int depth;                   // operations nest (Remove recurses)
+    int numOps;                  // operations finished since the
+                                 // last commit
+    HashTable<int, CachedSector *> *pending;
+    List<CachedSector *> *pendingList;
+                                 // logged, not committed yet
+    HashTable<int, CachedSector *> *committed;
+    SortedList<CachedSector *> *committedList;
+                                 // in the log, not home yet; by sector
+
+    void Commit();               // Append the pending sectors to the log
+    void Checkpoint();           // Write committed sectors home, and
+                                 // empty the log
+    void WriteHeader();          // Start the log at "nextCommit"
+    void Remember(int sectorNumber, char *data);
+                                 // Note a sector as committed
+    void LogTransfer(int sector, int count, char *buf, bool writing);
+                                 // Read/write a stretch of the log
 };
 
 #endif // SYNCHDISK_H
@@ -32,6 +32,10 @@
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <cerrno>
 
 #ifdef SOLARIS
@@ -379,6 +383,26 @@ Lseek(int fd, int offset, int whence)
     ASSERT(retVal >= 0);
 }
 
+//----------------------------------------------------------------------
+// ReadAt/WriteAt
+// 	Read/write characters at "offset" within an open file, in a
+//	single system call.  Abort if the read/write fails.
+//----------------------------------------------------------------------
+
+void
+ReadAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pread(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+void
+WriteAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
 //----------------------------------------------------------------------
 // Tell
 // 	Report the current location within an open file.
@@ -420,6 +444,193 @@ Unlink(char *name)
     return unlink(name);
 }
 
+//----------------------------------------------------------------------
+// IsDirectory
+// 	Return TRUE if "name" is a directory.
+//----------------------------------------------------------------------
+
+bool
+IsDirectory(char *name)
+{
+    struct stat info;
+
+    return stat(name, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+//----------------------------------------------------------------------
+// OpenDirectory/ReadDirectory/CloseDirectory
+// 	Walk the entries of a directory.  ReadDirectory returns the name
+//	of the next entry ("." and ".." excluded), or NULL at the end.
+//	The name is only good until the next call.
+//----------------------------------------------------------------------
+
+void *
+OpenDirectory(char *name)
+{
+    return opendir(name);
+}
+
+char *
+ReadDirectory(void *dir)
+{
+    struct dirent *entry;
+
+    while ((entry = readdir((DIR *)dir)) != NULL)
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            return entry->d_name;
+    return NULL;
+}
+
+void
+CloseDirectory(void *dir)
+{
+    closedir((DIR *)dir);
+}
+
+//----------------------------------------------------------------------
+// MapFile/UnmapFile/SyncFile
+// 	Map the first "nBytes" bytes of an open file into memory, for
+//	reading only unless "writable".  The mapping follows what is
+//	written to the file afterwards, and what is written to the
+//	mapping goes to the file (for sure, once SyncFile returns).
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int nBytes, bool writable)
+{
+    void *addr = mmap(NULL, nBytes,
+                      writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_SHARED, fd, 0);
+
+    return addr == MAP_FAILED ? NULL : (char *)addr;
+}
+
+void
+UnmapFile(char *addr, int nBytes)
+{
+    munmap(addr, nBytes);
+}
+
+void
+SyncFile(char *addr, int nBytes)
+{
+    int retVal = msync(addr, nBytes, MS_SYNC);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// ForkHostThread/JoinHostThread
+// 	Run "func(arg)" in a new thread of the host, and wait for it to
+//	finish.  Unlike a Nachos Thread, it really runs at the same time.
+//----------------------------------------------------------------------
+
+void *
+ForkHostThread(void *(*func)(void *), void *arg)
+{
+    pthread_t *thread = new pthread_t;
+    int result = pthread_create(thread, NULL, func, arg);
+
+    ASSERT(result == 0);
+    return thread;
+}
+
+void
+JoinHostThread(void *thread)
+{
+    pthread_join(*(pthread_t *)thread, NULL);
+    delete (pthread_t *)thread;
+}
+
+//----------------------------------------------------------------------
+// CompareAndSwap
+// 	If "word" holds "oldValue", set it to "newValue", atomically even
+//	with respect to host threads.  Return what "word" held before.
+//----------------------------------------------------------------------
+
+int
+CompareAndSwap(int *word, int oldValue, int newValue)
+{
+    return __sync_val_compare_and_swap(word, oldValue, newValue);
+}
+
+//----------------------------------------------------------------------
+// NewHostSemaphore/HostSemaphoreP/HostSemaphoreV/DeleteHostSemaphore
+// 	A semaphore that host threads can wait on, with initial value
+//	"value".  Unlike a Nachos Semaphore, P really blocks the host
+//	thread, and nothing else runs in its place.
+//----------------------------------------------------------------------
+
+struct HostSemaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int value;
+};
+
+void *
+NewHostSemaphore(int value)
+{
+    HostSemaphore *sema = new HostSemaphore;
+
+    pthread_mutex_init(&sema->lock, NULL);
+    pthread_cond_init(&sema->changed, NULL);
+    sema->value = value;
+    return sema;
+}
+
+void
+HostSemaphoreP(void *s)
+{
+    HostSemaphore *sema = (HostSemaphore *)s;
+
+    pthread_mutex_lock(&sema->lock);
+    while (sema->value == 0)
+        pthread_cond_wait(&sema->changed, &sema->lock);
+    sema->value--;
+    pthread_mutex_unlock(&sema->lock);
+}
+
+void
+HostSemaphoreV(void *s)
+{
+    HostSemaphore *sema = (HostSemaphore *)s;
+
+    pthread_mutex_lock(&sema->lock);
+    sema->value++;
+    pthread_cond_signal(&sema->changed);
+    pthread_mutex_unlock(&sema->lock);
+}
+
+void
+DeleteHostSemaphore(void *s)
+{
+    HostSemaphore *sema = (HostSemaphore *)s;
+
+    pthread_mutex_destroy(&sema->lock);
+    pthread_cond_destroy(&sema->changed);
+    delete sema;
+}
+
+//----------------------------------------------------------------------
+// AllocateCode/FreeCode
+// 	Allocate "nBytes" of memory that can be written, and then run
+//	as host instructions.
+//----------------------------------------------------------------------
+
+char *
+AllocateCode(int nBytes)
+{
+    void *addr = mmap(NULL, nBytes, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return addr == MAP_FAILED ? NULL : (char *)addr;
+}
+
+void
+FreeCode(char *addr, int nBytes)
+{
+    munmap(addr, nBytes);
+}
+
 //----------------------------------------------------------------------
 // OpenSocket
 // 	Open an interprocess communication (IPC) connection.  For now, 
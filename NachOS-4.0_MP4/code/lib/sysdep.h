@@ -49,10 +49,45 @@ extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
+extern void ReadAt(int fd, char *buffer, int nBytes, int offset);
+extern void WriteAt(int fd, char *buffer, int nBytes, int offset);
+                                            // at "offset", without
+                                            // moving the file position
 extern int Tell(int fd);
 extern int Close(int fd);
 extern bool Unlink(char *name);
 
+// Walking a directory, for copying whole trees into Nachos.
+extern bool IsDirectory(char *name);
+extern void *OpenDirectory(char *name);     // NULL if it can't be read
+extern char *ReadDirectory(void *dir);      // next name, NULL at the end
+extern void CloseDirectory(void *dir);
+
+// Tools that look at the disk image from outside the simulation (such
+// as the file system checker) map it into memory, and may split the
+// work among threads of the host; so does the simulated multiprocessor
+// (see machine/smp.h).  These threads must not call into Nachos: only
+// the Nachos thread that forks them may.
+extern char *MapFile(int fd, int nBytes, bool writable = FALSE);
+                                            // NULL on error
+extern void UnmapFile(char *addr, int nBytes);
+extern void SyncFile(char *addr, int nBytes); // write a writable mapping
+                                              // back to the file
+extern void *ForkHostThread(void *(*func)(void *), void *arg);
+extern void JoinHostThread(void *thread);
+extern int CompareAndSwap(int *word, int oldValue, int newValue);
+                                            // atomically; returns what
+                                            // "word" held before
+extern void *NewHostSemaphore(int value);   // for waiting on host threads
+extern void HostSemaphoreP(void *sema);
+extern void HostSemaphoreV(void *sema);
+extern void DeleteHostSemaphore(void *sema);
+
+// Memory the host can run instructions from, for user programs
+// translated into host code (see machine/codecache.h).
+extern char *AllocateCode(int nBytes);      // NULL on error
+extern void FreeCode(char *addr, int nBytes);
+
 // Other C library routines that are used by Nachos.
 // These are assumed to be portable, so we don't include a wrapper.
 extern "C" {
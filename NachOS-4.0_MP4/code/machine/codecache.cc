@@ -0,0 +1,1037 @@
+// codecache.cc
+//	Routines to translate basic blocks of user programs into host
+//	machine code, and to run them.
+//
+//	A block is what Machine::RunBlock would run: the instructions up
+//	to the first branch or jump, and its delay slot, all on one page.
+//	It is translated once it has been run HotBlock times, into one
+//	buffer of host code; when the buffer is full, every translation
+//	is thrown away.
+//
+//	While translated code runs, the host registers hold
+//		esi -- the Machine (whose "registers" it works on)
+//		edi -- mainMemory
+//		ebx -- the page table
+//		ebp -- how many more instructions may run before the
+//		       next interrupt is due
+//	and eax, ecx and edx are scratch.  Only the way in and out of
+//	translated code depends on whether the host is 32 or 64 bit:
+//	everything in between does 32 bit arithmetic, and addresses
+//	memory through the pointers above, and these instructions are
+//	encoded the same way for both.
+//
+//	The PC registers are not kept up to date inside a block, since
+//	the PC of each instruction is known when it is translated; they
+//	are set wherever the code returns to the simulator.  Everything
+//	else is as OneInstruction leaves it, instruction by instruction.
+//
+//	A translated block starts by checking that it still applies: that
+//	its page is mapped to the same frame, that memory still holds the
+//	words it was translated from, and that it can run to the end
+//	before an interrupt is due.  If not, it returns, having done
+//	nothing, so blocks can jump straight to each other ("chaining")
+//	without ever running stale code.
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#define OPCODES_ONLY
+
+#include "copyright.h"
+#include "codecache.h"
+#include "debug.h"
+#include "machine.h"
+#include "mipssim.h"
+#include "sysdep.h"
+
+const int CodeSize = 1 << 20;     // bytes of host code
+const int MaxBlockCode = 1 << 14; // more than any block could need
+const int HotBlock = 16;          // runs before a block is translated
+const int ExitsPerInstr = 8;      // more than any instruction has
+
+// Host registers, and conditions for jumps
+enum HostReg { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+enum HostCond { CondO = 0x0, CondB = 0x2, CondAE = 0x3, CondE = 0x4,
+                CondNE = 0x5, CondBE = 0x6, CondL = 0xc, CondGE = 0xd,
+                CondLE = 0xe, CondG = 0xf };
+
+// How C++ calls translated code: run from "block", for at most "limit"
+// instructions; return how many of them are left, and set "link" to
+// where the code could have jumped to the next block, or -1.
+typedef int (*TranslatedCode)(Machine *machine, int limit, char *block,
+                              int *link);
+
+// A basic block, translated
+class TranslatedBlock
+{
+public:
+    int virtAddr, physAddr; // where it starts
+    int length;             // how many instructions
+    unsigned int *words;    // what was translated
+    int code;               // where its host code is, in the buffer
+};
+
+//----------------------------------------------------------------------
+// IsTranslated, IsBranch
+// 	Whether translated code can run an instruction (the same ones
+//	RunBlock runs), and whether it is a branch or a jump.
+//----------------------------------------------------------------------
+
+static bool
+IsTranslated(int opCode)
+{
+    switch (opCode) {
+      case OP_ADD:
+      case OP_ADDI:
+      case OP_ADDIU:
+      case OP_ADDU:
+      case OP_AND:
+      case OP_ANDI:
+      case OP_BEQ:
+      case OP_BGEZ:
+      case OP_BGEZAL:
+      case OP_BGTZ:
+      case OP_BLEZ:
+      case OP_BLTZ:
+      case OP_BLTZAL:
+      case OP_BNE:
+      case OP_DIV:
+      case OP_DIVU:
+      case OP_J:
+      case OP_JAL:
+      case OP_JALR:
+      case OP_JR:
+      case OP_LB:
+      case OP_LBU:
+      case OP_LH:
+      case OP_LHU:
+      case OP_LUI:
+      case OP_LW:
+      case OP_MFHI:
+      case OP_MFLO:
+      case OP_MTHI:
+      case OP_MTLO:
+      case OP_MULT:
+      case OP_MULTU:
+      case OP_NOR:
+      case OP_OR:
+      case OP_ORI:
+      case OP_SB:
+      case OP_SH:
+      case OP_SLL:
+      case OP_SLLV:
+      case OP_SLT:
+      case OP_SLTI:
+      case OP_SLTIU:
+      case OP_SLTU:
+      case OP_SRA:
+      case OP_SRAV:
+      case OP_SRL:
+      case OP_SRLV:
+      case OP_SUB:
+      case OP_SUBU:
+      case OP_SW:
+      case OP_XOR:
+      case OP_XORI:
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+
+static bool
+IsBranch(int opCode)
+{
+    switch (opCode) {
+      case OP_BEQ:
+      case OP_BNE:
+      case OP_BGEZ:
+      case OP_BGEZAL:
+      case OP_BGTZ:
+      case OP_BLEZ:
+      case OP_BLTZ:
+      case OP_BLTZAL:
+      case OP_J:
+      case OP_JAL:
+      case OP_JR:
+      case OP_JALR:
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// CodeCache::CodeCache
+// 	Set up to translate the user programs "mach" runs, and lay down
+//	the way in and out of translated code.  On hosts we can't
+//	translate for, or if there's no memory to run code from, there
+//	is no buffer, and Run never runs anything.
+//----------------------------------------------------------------------
+
+CodeCache::CodeCache(Machine *mach)
+{
+    TranslationEntry entry;
+    int i;
+
+    machine = mach;
+    blocks = new TranslatedBlock *[MemorySize / 4];
+    heat = new int[MemorySize / 4];
+    for (i = 0; i < MemorySize / 4; i++) {
+        blocks[i] = NULL;
+        heat[i] = 0;
+    }
+    instrs = new Instruction *[PageSize / 4];
+    exitJumps = new int[ExitsPerInstr * (PageSize / 4 + 1)];
+    exitAt = new int[ExitsPerInstr * (PageSize / 4 + 1)];
+    pendingLink = -1;
+
+    registersAt = (char *)machine->registers - (char *)machine;
+    mainMemoryAt = (char *)&machine->mainMemory - (char *)machine;
+    pageTableAt = (char *)&machine->pageTable - (char *)machine;
+    pageTableSizeAt = (char *)&machine->pageTableSize - (char *)machine;
+    physicalPageAt = (char *)&entry.physicalPage - (char *)&entry;
+    validAt = (char *)&entry.valid - (char *)&entry;
+    readOnlyAt = (char *)&entry.readOnly - (char *)&entry;
+    useAt = (char *)&entry.use - (char *)&entry;
+    dirtyAt = (char *)&entry.dirty - (char *)&entry;
+    for (pageShift = 0; (1 << pageShift) < PageSize; pageShift++)
+        ;
+    ASSERT((1 << pageShift) == PageSize);
+
+#if defined(__i386__) || defined(__x86_64__)
+    code = AllocateCode(CodeSize);
+#else
+    code = NULL;
+#endif
+    if (code == NULL)
+        return;
+    codeUsed = 0;
+
+    // The way in: load the registers listed above, and jump to the block
+#ifdef __x86_64__
+    Byte(0x53);                                 // push rbx
+    Byte(0x55);                                 // push rbp
+    Byte(0x51);                                 // push rcx (link)
+    Byte(0x89); Byte(0xf5);                     // mov ebp, esi (limit)
+    Byte(0x48); Byte(0x89); Byte(0xfe);         // mov rsi, rdi (machine)
+    Byte(0x48); Byte(0x8b); Byte(0xbe);         // mov rdi, mainMemory
+    Word(mainMemoryAt);
+    Byte(0x48); Byte(0x8b); Byte(0x9e);         // mov rbx, pageTable
+    Word(pageTableAt);
+    Byte(0x48); Byte(0x89); Byte(0xd0);         // mov rax, rdx (block)
+#else
+    Byte(0x53);                                 // push ebx
+    Byte(0x56);                                 // push esi
+    Byte(0x57);                                 // push edi
+    Byte(0x55);                                 // push ebp
+    Byte(0x8b); Byte(0x74); Byte(0x24); Byte(0x14); // mov esi, machine
+    Byte(0x8b); Byte(0x6c); Byte(0x24); Byte(0x18); // mov ebp, limit
+    Byte(0x8b); Byte(0xbe);                     // mov edi, mainMemory
+    Word(mainMemoryAt);
+    Byte(0x8b); Byte(0x9e);                     // mov ebx, pageTable
+    Word(pageTableAt);
+    Byte(0x8b); Byte(0x44); Byte(0x24); Byte(0x1c); // mov eax, block
+#endif
+    Byte(0xba); Word(-1);                       // mov edx, -1 (no link)
+    Byte(0xff); Byte(0xe0);                     // jmp eax
+
+    // The way out, with the instructions left in eax, and the link in edx
+    epilogue = codeUsed;
+#ifdef __x86_64__
+    Byte(0x59);                                 // pop rcx
+    Byte(0x89); Byte(0x11);                     // mov [rcx], edx
+    Byte(0x5d);                                 // pop rbp
+    Byte(0x5b);                                 // pop rbx
+#else
+    Byte(0x8b); Byte(0x4c); Byte(0x24); Byte(0x20); // mov ecx, link
+    Byte(0x89); Byte(0x11);                     // mov [ecx], edx
+    Byte(0x5d);                                 // pop ebp
+    Byte(0x5f);                                 // pop edi
+    Byte(0x5e);                                 // pop esi
+    Byte(0x5b);                                 // pop ebx
+#endif
+    Byte(0xc3);                                 // ret
+    codeStart = codeUsed;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::~CodeCache
+// 	Throw away the translations, and the buffer.
+//----------------------------------------------------------------------
+
+CodeCache::~CodeCache()
+{
+    if (code != NULL) {
+        Flush();
+        FreeCode(code, CodeSize);
+    }
+    delete[] blocks;
+    delete[] heat;
+    delete[] instrs;
+    delete[] exitJumps;
+    delete[] exitAt;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Run
+// 	Run the translation of the block at "virtAddr" (which is at
+//	"physAddr"), and whatever it chains to, for at most "limit"
+//	instructions.  Return how many ran; 0 if the block isn't
+//	translated (yet), or couldn't run.
+//
+//	If the code returned where it could have jumped straight to the
+//	next block, and that block is the one run next, link them.
+//----------------------------------------------------------------------
+
+int
+CodeCache::Run(int virtAddr, int physAddr, int limit)
+{
+    TranslatedBlock *block;
+    int left, link;
+
+    if (code == NULL || (block = Lookup(virtAddr, physAddr)) == NULL) {
+        pendingLink = -1;
+        return 0;
+    }
+    if (pendingLink != -1 && pendingTarget == virtAddr)
+        Link(pendingLink, block);
+    pendingLink = -1;
+
+    left = ((TranslatedCode)(void *)code)(machine, limit,
+                                          code + block->code, &link);
+    if (link != -1) {
+        pendingLink = link;
+        pendingTarget = machine->registers[PCReg];
+    }
+    return limit - left;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Lookup
+// 	Return the translation of the block at "virtAddr" (which is at
+//	"physAddr"), translating it if it is hot enough.  A translation
+//	made from words no longer in memory, or for another address, is
+//	dropped (its code stays until the next Flush, but it always
+//	returns at once).
+//----------------------------------------------------------------------
+
+TranslatedBlock *
+CodeCache::Lookup(int virtAddr, int physAddr)
+{
+    TranslatedBlock *block = blocks[physAddr / 4];
+    unsigned int *words = (unsigned int *)&machine->mainMemory[physAddr];
+    int i;
+
+    if (block != NULL) {
+        for (i = 0; i < block->length && block->words[i] == words[i]; i++)
+            ;
+        if (block->virtAddr == virtAddr && i == block->length)
+            return block;
+        blocks[physAddr / 4] = NULL;
+        delete[] block->words;
+        delete block;
+    }
+    if (++heat[physAddr / 4] < HotBlock)
+        return NULL;
+    heat[physAddr / 4] = 0;
+    return Translate(virtAddr, physAddr);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Flush
+// 	Throw away all the translations, to start filling the buffer
+//	again.  Only while no translated code is running, of course.
+//----------------------------------------------------------------------
+
+void
+CodeCache::Flush()
+{
+    for (int i = 0; i < MemorySize / 4; i++)
+        if (blocks[i] != NULL) {
+            delete[] blocks[i]->words;
+            delete blocks[i];
+            blocks[i] = NULL;
+        }
+    codeUsed = codeStart;
+    pendingLink = -1;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Link
+// 	Make the jump whose target is at "from" go straight to "to".
+//----------------------------------------------------------------------
+
+void
+CodeCache::Link(int from, TranslatedBlock *to)
+{
+    PatchWord(from, to->code - (from + 4));
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Translate
+// 	Translate the block at "virtAddr" (which is at "physAddr"), and
+//	return it; NULL if not even its first instruction can be
+//	translated.
+//----------------------------------------------------------------------
+
+TranslatedBlock *
+CodeCache::Translate(int virtAddr, int physAddr)
+{
+    unsigned int *words = (unsigned int *)machine->mainMemory;
+    int pageEnd = (physAddr / PageSize + 1) * PageSize;
+    TranslatedBlock *block;
+    Instruction *instr, *branch;
+    int n, k, target;
+    bool delaySlot = FALSE;
+
+    // Find the end of the block, decoding as we go
+    for (n = 0; physAddr + 4 * n < pageEnd; n++) {
+        instr = &machine->decodeCache[physAddr / 4 + n];
+        if (instr->value != WordToHost(words[physAddr / 4 + n])) {
+            instr->value = WordToHost(words[physAddr / 4 + n]);
+            instr->Decode();
+        }
+        if (!IsTranslated(instr->opCode) ||
+            (delaySlot && IsBranch(instr->opCode)))
+            break;
+        instrs[n] = instr;
+        if (delaySlot) {
+            n++;
+            break;
+        }
+        delaySlot = IsBranch(instr->opCode);
+    }
+    if (n == 0)
+        return NULL;
+
+    if (codeUsed + MaxBlockCode > CodeSize)
+        Flush();
+    block = new TranslatedBlock;
+    block->virtAddr = virtAddr;
+    block->physAddr = physAddr;
+    block->length = n;
+    block->words = new unsigned int[n];
+    for (k = 0; k < n; k++)
+        block->words[k] = words[physAddr / 4 + k];
+    block->code = codeUsed;
+    blocks[physAddr / 4] = block;
+
+    blockPhys = physAddr;
+    blockLength = n;
+    numExits = 0;
+    EmitEntry(block);
+    pendingLoad = -1;
+    loadClean = FALSE;
+    for (k = 0; k < n; k++)
+        EmitInstruction(instrs[k], virtAddr + 4 * k, k);
+
+    // Where to go next
+    if (n >= 2 && IsBranch(instrs[n - 2]->opCode)) {
+        // past a branch and its delay slot
+        branch = instrs[n - 2];
+        k = virtAddr + 4 * (n - 2); // the branch
+        switch (branch->opCode) {
+          case OP_JR:
+          case OP_JALR:
+            EmitReturn(-1, k + 4);
+            break;
+          case OP_J:
+          case OP_JAL:
+            EmitChain(((k + 8) & 0xf0000000) | IndexToAddr(branch->extra),
+                      k + 4);
+            break;
+          default:
+            target = k + 4 + IndexToAddr(branch->extra);
+            if (target != k + 8) {
+                Reg(0x81, 7, NextPCReg);        // cmp NextPC, target
+                Word(target);
+                int taken = Jcc(CondE);
+                EmitChain(k + 8, k + 4);
+                Here(taken);
+            }
+            EmitChain(target, k + 4);
+        }
+    } else if (IsBranch(instrs[n - 1]->opCode) ||
+               physAddr + 4 * n < pageEnd) {
+        // short of a delay slot, or of an instruction, that can't be
+        // translated
+        exitJumps[numExits] = Jmp();
+        exitAt[numExits++] = n;
+    } else {
+        // at the end of the page
+        EmitChain(virtAddr + 4 * n, virtAddr + 4 * (n - 1));
+    }
+    EmitExits(virtAddr);
+    ASSERT(codeUsed - block->code <= MaxBlockCode);
+    return block;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitEntry
+// 	Start "block" with the checks that it still applies (see above),
+//	and if it does, take the instructions it runs off the limit.
+//	If not, return at once, with the PC registers set to the block,
+//	and the link the code came in by, if any.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitEntry(TranslatedBlock *block)
+{
+    int vpn = block->virtAddr >> pageShift;
+    int entryAt = vpn * sizeof(TranslationEntry);
+    int k, done;
+
+    Byte(0x81); Byte(0xbe);                     // cmp pageTableSize, vpn
+    Word(pageTableSizeAt); Word(vpn);
+    ExitIf(CondBE, -1);
+    Byte(0x80); Byte(0xbb);                     // cmp entry.valid, 0
+    Word(entryAt + validAt); Byte(0);
+    ExitIf(CondE, -1);
+    Byte(0x81); Byte(0xbb);                     // cmp entry.physicalPage, frame
+    Word(entryAt + physicalPageAt); Word(block->physAddr >> pageShift);
+    ExitIf(CondNE, -1);
+    for (k = 0; k < block->length; k++) {
+        Byte(0x81); Byte(0xbf);                 // cmp word k, what it was
+        Word(block->physAddr + 4 * k); Word(block->words[k]);
+        ExitIf(CondNE, -1);
+    }
+    Byte(0x81); Byte(0xfd); Word(block->length); // cmp ebp, length
+    ExitIf(CondL, -1);
+    Byte(0x81); Byte(0xed); Word(block->length); // sub ebp, length
+    Byte(0xc6); Byte(0x83);                     // mov entry.use, 1
+    Word(entryAt + useAt); Byte(1);
+    done = Jmp();
+
+    for (k = 0; k < numExits; k++)
+        Here(exitJumps[k]);
+    numExits = 0;
+    SetReg(PCReg, block->virtAddr);
+    SetReg(NextPCReg, block->virtAddr + 4);
+    Byte(0x89); Byte(0xe8);                     // mov eax, ebp
+    JumpTo(epilogue);
+    Here(done);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitInstruction
+// 	Translate "instr", instruction "k" of the block, at "pc".  Anything
+//	that would raise an exception instead leaves before it.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitInstruction(Instruction *instr, int pc, int k)
+{
+    int rs = instr->rs, rt = instr->rt, rd = instr->rd;
+    int result = -1;    // register eax goes to in the end, if any
+    bool loads = FALSE;
+    int skip, zero, done;
+
+    switch (instr->opCode) {
+      case OP_ADD:
+      case OP_ADDU:
+      case OP_SUB:
+      case OP_SUBU:
+      case OP_AND:
+      case OP_OR:
+      case OP_XOR:
+      case OP_NOR:
+        Reg(0x8b, EAX, rs);
+        switch (instr->opCode) {
+          case OP_ADD: case OP_ADDU: Reg(0x03, EAX, rt); break;
+          case OP_SUB: case OP_SUBU: Reg(0x2b, EAX, rt); break;
+          case OP_AND: Reg(0x23, EAX, rt); break;
+          case OP_XOR: Reg(0x33, EAX, rt); break;
+          default: Reg(0x0b, EAX, rt); break;
+        }
+        if (instr->opCode == OP_ADD || instr->opCode == OP_SUB)
+            ExitIf(CondO, k);
+        if (instr->opCode == OP_NOR) {
+            Byte(0xf7); Byte(0xd0);             // not eax
+        }
+        result = rd;
+        break;
+
+      case OP_ADDI:
+      case OP_ADDIU:
+      case OP_ANDI:
+      case OP_ORI:
+      case OP_XORI:
+        Reg(0x8b, EAX, rs);
+        switch (instr->opCode) {
+          case OP_ADDI: case OP_ADDIU:
+            Byte(0x05); Word(instr->extra); break;
+          case OP_ANDI: Byte(0x25); Word(instr->extra & 0xffff); break;
+          case OP_ORI: Byte(0x0d); Word(instr->extra & 0xffff); break;
+          default: Byte(0x35); Word(instr->extra & 0xffff); break;
+        }
+        if (instr->opCode == OP_ADDI)
+            ExitIf(CondO, k);
+        result = rt;
+        break;
+
+      case OP_LUI:
+        if (rt != 0)
+            SetReg(rt, instr->extra << 16);
+        break;
+
+      case OP_SLL:
+      case OP_SRA:
+      case OP_SRL:      // (which shifts in the sign, just like RunBlock)
+        Reg(0x8b, EAX, rt);
+        Byte(0xc1); Byte(instr->opCode == OP_SLL ? 0xe0 : 0xf8);
+        Byte(instr->extra);
+        result = rd;
+        break;
+
+      case OP_SLLV:
+      case OP_SRAV:
+      case OP_SRLV:
+        Reg(0x8b, ECX, rs);
+        Reg(0x8b, EAX, rt);
+        Byte(0xd3); Byte(instr->opCode == OP_SLLV ? 0xe0 : 0xf8);
+        result = rd;
+        break;
+
+      case OP_SLT:
+      case OP_SLTU:
+      case OP_SLTI:
+      case OP_SLTIU:
+        Reg(0x8b, EAX, rs);
+        if (instr->opCode == OP_SLT || instr->opCode == OP_SLTU) {
+            Reg(0x3b, EAX, rt);
+            result = rd;
+        } else {
+            Byte(0x3d); Word(instr->extra);     // cmp eax, extra
+            result = rt;
+        }
+        Byte(0x0f);                             // setl/setb al
+        Byte(instr->opCode == OP_SLT || instr->opCode == OP_SLTI ?
+             0x9c : 0x92);
+        Byte(0xc0);
+        Byte(0x0f); Byte(0xb6); Byte(0xc0);     // movzx eax, al
+        break;
+
+      case OP_MFHI:
+        Reg(0x8b, EAX, HiReg);
+        result = rd;
+        break;
+
+      case OP_MFLO:
+        Reg(0x8b, EAX, LoReg);
+        result = rd;
+        break;
+
+      case OP_MTHI:
+        Reg(0x8b, EAX, rs);
+        result = HiReg;
+        break;
+
+      case OP_MTLO:
+        Reg(0x8b, EAX, rs);
+        result = LoReg;
+        break;
+
+      case OP_MULT:
+      case OP_MULTU:
+        Reg(0x8b, EAX, rs);
+        Reg(0xf7, instr->opCode == OP_MULT ? 5 : 4, rt); // imul/mul rt
+        Reg(0x89, EDX, HiReg);
+        result = LoReg;
+        break;
+
+      case OP_DIV:
+      case OP_DIVU:
+        Reg(0x8b, ECX, rt);
+        Byte(0x85); Byte(0xc9);                 // test ecx, ecx
+        zero = Jcc(CondE);
+        Reg(0x8b, EAX, rs);
+        if (instr->opCode == OP_DIV) {
+            // the one quotient that overflows: it would on the host
+            // too, so leave it to OneInstruction
+            Byte(0x3d); Word(0x80000000);       // cmp eax, 0x80000000
+            skip = Jcc(CondNE);
+            Byte(0x83); Byte(0xf9); Byte(0xff); // cmp ecx, -1
+            ExitIf(CondE, k);
+            Here(skip);
+            Byte(0x99);                         // cdq
+            Byte(0xf7); Byte(0xf9);             // idiv ecx
+        } else {
+            Byte(0x31); Byte(0xd2);             // xor edx, edx
+            Byte(0xf7); Byte(0xf1);             // div ecx
+        }
+        Reg(0x89, EAX, LoReg);
+        Reg(0x89, EDX, HiReg);
+        done = Jmp();
+        Here(zero);
+        SetReg(LoReg, 0);
+        SetReg(HiReg, 0);
+        Here(done);
+        break;
+
+      case OP_BEQ:
+      case OP_BNE:
+      case OP_BGEZ:
+      case OP_BGEZAL:
+      case OP_BGTZ:
+      case OP_BLEZ:
+      case OP_BLTZ:
+      case OP_BLTZAL:
+        if (instr->opCode == OP_BGEZAL || instr->opCode == OP_BLTZAL)
+            SetReg(R31, pc + 8);
+        if (instr->opCode == OP_BEQ || instr->opCode == OP_BNE) {
+            Reg(0x8b, EAX, rs);
+            Reg(0x3b, EAX, rt);
+        } else {
+            Reg(0x83, 7, rs);                   // cmp rs, 0
+            Byte(0);
+        }
+        SetReg(NextPCReg, pc + 8);
+        switch (instr->opCode) {                // skip if not taken
+          case OP_BEQ: skip = Jcc(CondNE); break;
+          case OP_BNE: skip = Jcc(CondE); break;
+          case OP_BGEZ: case OP_BGEZAL: skip = Jcc(CondL); break;
+          case OP_BGTZ: skip = Jcc(CondLE); break;
+          case OP_BLEZ: skip = Jcc(CondG); break;
+          default: skip = Jcc(CondGE); break;
+        }
+        SetReg(NextPCReg, pc + 4 + IndexToAddr(instr->extra));
+        Here(skip);
+        break;
+
+      case OP_J:
+      case OP_JAL:
+        if (instr->opCode == OP_JAL)
+            SetReg(R31, pc + 8);
+        SetReg(NextPCReg, ((pc + 8) & 0xf0000000) | IndexToAddr(instr->extra));
+        break;
+
+      case OP_JR:
+      case OP_JALR:
+        if (instr->opCode == OP_JALR && rd != 0)
+            SetReg(rd, pc + 8);
+        Reg(0x8b, EAX, rs);
+        result = NextPCReg;
+        break;
+
+      case OP_LB:
+      case OP_LBU:
+      case OP_LH:
+      case OP_LHU:
+      case OP_LW:
+        EmitAddress(instr, instr->opCode == OP_LW ? 4 :
+                    (instr->opCode == OP_LH || instr->opCode == OP_LHU) ? 2 : 1,
+                    FALSE, k);
+        switch (instr->opCode) {                // load edx from [edi + eax]
+          case OP_LB: Byte(0x0f); Byte(0xbe); break;    // movsx byte
+          case OP_LBU: Byte(0x0f); Byte(0xb6); break;   // movzx byte
+          case OP_LH: Byte(0x0f); Byte(0xbf); break;    // movsx word
+          case OP_LHU: Byte(0x0f); Byte(0xb7); break;   // movzx word
+          default: Byte(0x8b); break;                   // mov
+        }
+        Byte(0x14); Byte(0x07);
+        loads = TRUE;
+        break;
+
+      case OP_SB:
+      case OP_SH:
+      case OP_SW:
+        EmitAddress(instr, instr->opCode == OP_SW ? 4 :
+                    instr->opCode == OP_SH ? 2 : 1, TRUE, k);
+        Reg(0x8b, EDX, rt);
+        switch (instr->opCode) {                // store edx to [edi + eax]
+          case OP_SB: Byte(0x88); break;
+          case OP_SH: Byte(0x66); Byte(0x89); break;
+          default: Byte(0x89); break;
+        }
+        Byte(0x14); Byte(0x07);
+        break;
+
+      default:
+        ASSERT(FALSE);  // IsTranslated said no
+    }
+    if (result > 0)     // (nothing is ever stored in register 0)
+        Reg(0x89, EAX, result);
+    EmitEndOfInstruction(loads, rt);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitAddress
+// 	Translate the address a load or store of "size" bytes refers to,
+//	into eax, as a physical address; leave before instruction "k" if
+//	Translate would raise an exception.  A store into the block
+//	itself leaves too, so the rest of the block isn't run stale.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitAddress(Instruction *instr, int size, bool writing, int k)
+{
+    Reg(0x8b, EAX, instr->rs);
+    if (instr->extra != 0) {
+        Byte(0x05); Word(instr->extra);         // add eax, extra
+    }
+    if (size > 1) {
+        Byte(0xa9); Word(size - 1);             // test eax, size - 1
+        ExitIf(CondNE, k);
+    }
+    Byte(0x89); Byte(0xc1);                     // mov ecx, eax
+    Byte(0xc1); Byte(0xe9); Byte(pageShift);    // shr ecx, pageShift
+    Byte(0x3b); Byte(0x8e); Word(pageTableSizeAt); // cmp ecx, pageTableSize
+    ExitIf(CondAE, k);
+    Byte(0x6b); Byte(0xc9); Byte(sizeof(TranslationEntry)); // imul ecx, ...
+    Byte(0x80); Byte(0x7c); Byte(0x0b);         // cmp entry.valid, 0
+    Byte(validAt); Byte(0);
+    ExitIf(CondE, k);
+    if (writing) {
+        Byte(0x80); Byte(0x7c); Byte(0x0b);     // cmp entry.readOnly, 0
+        Byte(readOnlyAt); Byte(0);
+        ExitIf(CondNE, k);
+    }
+    Byte(0x8b); Byte(0x54); Byte(0x0b);         // mov edx, entry.physicalPage
+    Byte(physicalPageAt);
+    Byte(0x81); Byte(0xfa); Word(NumPhysPages); // cmp edx, NumPhysPages
+    ExitIf(CondAE, k);
+    Byte(0xc6); Byte(0x44); Byte(0x0b);         // mov entry.use, 1
+    Byte(useAt); Byte(1);
+    if (writing) {
+        Byte(0xc6); Byte(0x44); Byte(0x0b);     // mov entry.dirty, 1
+        Byte(dirtyAt); Byte(1);
+    }
+    Byte(0xc1); Byte(0xe2); Byte(pageShift);    // shl edx, pageShift
+    Byte(0x25); Word(PageSize - 1);             // and eax, PageSize - 1
+    Byte(0x01); Byte(0xd0);                     // add eax, edx
+    if (writing) {
+        Byte(0x8d); Byte(0x88); Word(-blockPhys); // lea ecx, [eax - block]
+        Byte(0x81); Byte(0xf9); Word(4 * blockLength); // cmp ecx, length
+        ExitIf(CondB, k);
+    }
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitEndOfInstruction
+// 	Finish an instruction the way OneInstruction does (but for the
+//	PC registers): do the delayed load pending since the last one,
+//	and if this one "loads" (into "loadReg", from edx), leave its
+//	load pending.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitEndOfInstruction(bool loads, int loadReg)
+{
+    if (pendingLoad == -1) {    // whatever was pending at the start
+        Reg(0x8b, EAX, LoadReg);
+        Reg(0x8b, ECX, LoadValueReg);
+        Byte(0x89); Byte(0x8c); Byte(0x86);     // mov registers[eax], ecx
+        Word(registersAt);
+        SetReg(0, 0);
+    } else if (pendingLoad > 0) {
+        Reg(0x8b, EAX, LoadValueReg);
+        Reg(0x89, EAX, pendingLoad);
+    }
+    if (loads) {
+        Reg(0x89, EDX, LoadValueReg);
+        SetReg(LoadReg, loadReg);
+        pendingLoad = loadReg;
+        loadClean = FALSE;
+    } else {
+        if (!loadClean) {
+            SetReg(LoadReg, 0);
+            SetReg(LoadValueReg, 0);
+            loadClean = TRUE;
+        }
+        pendingLoad = 0;
+    }
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitChain
+// 	End the block by going on at "pc", which isn't in a delay slot
+//	(the last instruction run was at "prevPC").  This is a jump that
+//	Link can point straight at the translation of the next block;
+//	until then, it returns, and tells Run where the jump is.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitChain(int pc, int prevPC)
+{
+    int at, jump;
+
+    SetReg(PrevPCReg, prevPC);
+    Byte(0xba);                                 // mov edx, jump
+    at = codeUsed;
+    Word(0);
+    jump = Jmp();                               // to below, until linked
+    PatchWord(at, jump);
+    EmitReturn(pc, -1);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitReturn
+// 	Return from translated code to go on at "pc" -- or, if it is -1,
+//	at NextPC, as set by the jump just run, whose delay slot was at
+//	"prevPC".  The instructions left are in ebp, and the link (if
+//	any) in edx.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitReturn(int pc, int prevPC)
+{
+    if (pc != -1) {
+        SetReg(PCReg, pc);
+        SetReg(NextPCReg, pc + 4);
+    } else {
+        SetReg(PrevPCReg, prevPC);
+        Reg(0x8b, EAX, NextPCReg);
+        Reg(0x89, EAX, PCReg);
+        Byte(0x83); Byte(0xc0); Byte(4);        // add eax, 4
+        Reg(0x89, EAX, NextPCReg);
+        Byte(0xba); Word(-1);                   // mov edx, -1
+    }
+    Byte(0x89); Byte(0xe8);                     // mov eax, ebp
+    JumpTo(epilogue);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::EmitExits
+// 	Lay down the ways out of the block at "virtAddr" before each of
+//	its instructions, for those that need one: with the registers
+//	set as OneInstruction would have left them by then.
+//----------------------------------------------------------------------
+
+void
+CodeCache::EmitExits(int virtAddr)
+{
+    int k, i, pc;
+    bool any;
+
+    for (k = 0; k <= blockLength; k++) {
+        for (any = FALSE, i = 0; i < numExits; i++)
+            if (exitAt[i] == k) {
+                Here(exitJumps[i]);
+                any = TRUE;
+            }
+        if (!any)
+            continue;
+        pc = virtAddr + 4 * k;
+        if (k > 0)
+            SetReg(PrevPCReg, pc - 4);
+        SetReg(PCReg, pc);
+        if (k == 0 || !IsBranch(instrs[k - 1]->opCode))
+            SetReg(NextPCReg, pc + 4); // (in a delay slot, the branch
+                                       // has set it)
+        Byte(0x8d); Byte(0x85);                 // lea eax, [ebp + left]
+        Word(blockLength - k);
+        Byte(0xba); Word(-1);                   // mov edx, -1
+        JumpTo(epilogue);
+    }
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Byte, Word, PatchWord
+// 	Put a byte, or a 32 bit word, at the end of the code; or put a
+//	word at "at".
+//----------------------------------------------------------------------
+
+void
+CodeCache::Byte(int b)
+{
+    code[codeUsed++] = (char)b;
+}
+
+void
+CodeCache::Word(int w)
+{
+    PatchWord(codeUsed, w);
+    codeUsed += 4;
+}
+
+void
+CodeCache::PatchWord(int at, int w)
+{
+    code[at] = (char)w;
+    code[at + 1] = (char)(w >> 8);
+    code[at + 2] = (char)(w >> 16);
+    code[at + 3] = (char)(w >> 24);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Reg
+// 	Emit "op hostReg, guestReg" -- an instruction (such as mov, add,
+//	or cmp) on host register "hostReg" and the simulated register
+//	"guestReg" (or, with hostReg an opcode extension, an instruction
+//	on that register alone).
+//----------------------------------------------------------------------
+
+void
+CodeCache::Reg(int op, int hostReg, int guestReg)
+{
+    Byte(op);
+    Byte(0x80 | (hostReg << 3) | ESI);          // [esi + disp32]
+    Word(registersAt + 4 * guestReg);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::SetReg
+// 	Emit "mov guestReg, value".
+//----------------------------------------------------------------------
+
+void
+CodeCache::SetReg(int guestReg, int value)
+{
+    Reg(0xc7, 0, guestReg);
+    Word(value);
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Jcc, Jmp, Here, JumpTo
+// 	Emit a jump if "cond", or always, whose target is filled in
+//	later: Here makes it this point, and JumpTo emits a jump to
+//	"target", which is already there.
+//----------------------------------------------------------------------
+
+int
+CodeCache::Jcc(int cond)
+{
+    Byte(0x0f);
+    Byte(0x80 | cond);
+    Word(0);
+    return codeUsed - 4;
+}
+
+int
+CodeCache::Jmp()
+{
+    Byte(0xe9);
+    Word(0);
+    return codeUsed - 4;
+}
+
+void
+CodeCache::Here(int jump)
+{
+    PatchWord(jump, codeUsed - (jump + 4));
+}
+
+void
+CodeCache::JumpTo(int target)
+{
+    int jump = Jmp();
+
+    PatchWord(jump, target - (jump + 4));
+}
+
+//----------------------------------------------------------------------
+// CodeCache::ExitIf
+// 	Emit a jump, if "cond", to the way out before instruction "k"
+//	(-1: before the block starts at all).
+//----------------------------------------------------------------------
+
+void
+CodeCache::ExitIf(int cond, int k)
+{
+    exitJumps[numExits] = Jcc(cond);
+    exitAt[numExits++] = k;
+}
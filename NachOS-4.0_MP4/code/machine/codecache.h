@@ -0,0 +1,102 @@
+// codecache.h
+//	Data structures for running user programs as host machine code.
+//
+//	When it is turned on (nachos -dbt), basic blocks of the user
+//	program that run often are translated into instructions of the
+//	host (x86, 32 or 64 bit), and run from there.  Translated blocks
+//	jump straight into each other, so a loop can run for a long time
+//	without coming back to the simulator.
+//
+//	The translated code does exactly what Machine::RunBlock would do:
+//	same registers, same memory, same ticks.  Whatever RunBlock leaves
+//	to OneInstruction, the translated code leaves to it too: it stops
+//	just before, with the machine state as of that instruction.
+//
+//	On any other host, nothing is ever translated.
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include "copyright.h"
+
+class Machine;
+class Instruction;
+class TranslatedBlock;
+
+class CodeCache
+{
+public:
+    CodeCache(Machine *mach); // translate the user programs "mach" runs
+    ~CodeCache();
+
+    int Run(int virtAddr, int physAddr, int limit);
+    // Run translated code from the block at
+    // "virtAddr" (at "physAddr" in memory), for at
+    // most "limit" instructions; return how many
+    // were run, 0 if the block isn't translated
+
+private:
+    Machine *machine;
+    char *code;      // buffer for host instructions
+    int codeUsed;    // how much of it is in use
+    int codeStart;   // where translated blocks start, after the way
+                     // in and out of translated code
+    int epilogue;    // the way out, back to C++
+
+    TranslatedBlock **blocks; // translation of the block starting
+                              // at each word of memory, if any
+    int *heat;                // how often each word has started a
+                              // block that wasn't translated
+    int pendingLink;          // where the last run left, if it could
+                              // have jumped straight to the next block
+    int pendingTarget;        // ... and where that block is
+
+    // Where things are, for the host code: offsets within the Machine,
+    // and within a TranslationEntry
+    int registersAt, mainMemoryAt, pageTableAt, pageTableSizeAt;
+    int physicalPageAt, validAt, readOnlyAt, useAt, dirtyAt;
+    int pageShift;   // log2(PageSize)
+
+    TranslatedBlock *Lookup(int virtAddr, int physAddr);
+    TranslatedBlock *Translate(int virtAddr, int physAddr);
+    void Flush();    // throw away every translation
+    void Link(int from, TranslatedBlock *to);
+
+    // Emitting host instructions
+    void Byte(int b);
+    void Word(int w);
+    void PatchWord(int at, int w);
+    void Reg(int op, int hostReg, int guestReg); // op [guest register]
+    void SetReg(int guestReg, int value);
+    int Jcc(int cond);       // returns where to patch in the target
+    int Jmp();
+    void Here(int jump);     // make "jump" come to this point
+    void JumpTo(int target);
+    void ExitIf(int cond, int k);
+
+    void EmitEntry(TranslatedBlock *block);
+    void EmitInstruction(Instruction *instr, int pc, int k);
+    void EmitAddress(Instruction *instr, int size, bool writing, int k);
+    void EmitEndOfInstruction(bool loads, int loadReg);
+    void EmitChain(int pc, int prevPC);
+    void EmitReturn(int pc, int prevPC);
+    void EmitExits(int virtAddr);
+
+    // The block being translated
+    Instruction **instrs;    // its instructions
+    int blockPhys, blockLength; // where it is, and how many there are
+    int pendingLoad;  // register a delayed load is pending for: -1 if
+                      // not known (at the start), 0 if none
+    bool loadClean;   // LoadReg and LoadValueReg are both known to be 0
+    int *exitJumps;   // jumps to the exits from the block, and
+    int *exitAt;      // the instruction each one leaves before
+    int numExits;
+};
+
+#endif // CODECACHE_H
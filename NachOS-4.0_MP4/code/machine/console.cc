@@ -23,9 +23,10 @@
 //	"readFile" -- UNIX file simulating the keyboard (NULL -> use stdin)
 // 	"toCall" is the interrupt handler to call when a character arrives
 //		from the keyboard
+//	"size" -- how many characters can arrive at once
 //----------------------------------------------------------------------
 
-ConsoleInput::ConsoleInput(char *readFile, CallBackObj *toCall)
+ConsoleInput::ConsoleInput(char *readFile, CallBackObj *toCall, int size)
 {
     if (readFile == NULL)
         readFileNo = 0; // keyboard = stdin
@@ -34,7 +35,10 @@ ConsoleInput::ConsoleInput(char *readFile, CallBackObj *toCall)
 
     // set up the stuff to emulate asynchronous interrupts
     callWhenAvail = toCall;
-    incoming = EOF;
+    ASSERT(size > 0);
+    bufferSize = size;
+    incoming = new char[bufferSize];
+    numIncoming = nextIncoming = 0;
     disabled = false; // 2015.11.25
 
     // start polling for incoming keystrokes
@@ -50,6 +54,7 @@ ConsoleInput::~ConsoleInput()
 {
     if (readFileNo != 0)
         Close(readFileNo);
+    delete [] incoming;
 }
 
 //----------------------------------------------------------------------
@@ -58,15 +63,15 @@ ConsoleInput::~ConsoleInput()
 //	read in from the simulated keyboard (eg, the user typed something).
 //
 //	First check to make sure character is available.
-//	Then invoke the "callBack" registered by whoever wants the character.
+//	Then read in as many as there are (that fit in the buffer), and
+//	invoke the "callBack" registered by whoever wants them.
 //----------------------------------------------------------------------
 
 void ConsoleInput::CallBack()
 {
-    char c;
     int readCount;
 
-    ASSERT(incoming == EOF);
+    ASSERT(NumAvail() == 0);
     // 2015.11.25
     // do not schedule any more interrupts if console is disabled
     if (disabled)
@@ -81,8 +86,8 @@ void ConsoleInput::CallBack()
     }
     else
     {
-        // otherwise, try to read a character
-        readCount = ReadPartial(readFileNo, &c, sizeof(char));
+        // otherwise, try to read the characters
+        readCount = ReadPartial(readFileNo, incoming, bufferSize);
         if (readCount == 0)
         {
             // this seems to happen at end of file, when the
@@ -93,11 +98,12 @@ void ConsoleInput::CallBack()
         }
         else
         {
-            // save the character and notify the OS that
-            // it is available
-            ASSERT(readCount == sizeof(char));
-            incoming = c;
-            kernel->stats->numConsoleCharsRead++;
+            // save the characters and notify the OS that
+            // they are available
+            ASSERT(readCount > 0);
+            numIncoming = readCount;
+            nextIncoming = 0;
+            kernel->stats->numConsoleCharsRead += readCount;
         }
         callWhenAvail->CallBack();
     }
@@ -111,14 +117,13 @@ void ConsoleInput::CallBack()
 
 char ConsoleInput::GetChar()
 {
-    char ch = incoming;
-
-    if (incoming != EOF)
+    if (NumAvail() == 0)
+        return EOF;
+    if (nextIncoming == numIncoming - 1)
     { // schedule when next char will arrive
         kernel->interrupt->Schedule(this, ConsoleTime, ConsoleReadInt);
     }
-    incoming = EOF;
-    return ch;
+    return incoming[nextIncoming++];
 }
 
 //----------------------------------------------------------------------
@@ -128,9 +133,10 @@ char ConsoleInput::GetChar()
 //	"writeFile" -- UNIX file simulating the display (NULL -> use stdout)
 // 	"toCall" is the interrupt handler to call when a write to
 //	the display completes.
+//	"size" -- how many characters one write can send
 //----------------------------------------------------------------------
 
-ConsoleOutput::ConsoleOutput(char *writeFile, CallBackObj *toCall)
+ConsoleOutput::ConsoleOutput(char *writeFile, CallBackObj *toCall, int size)
 {
     if (writeFile == NULL)
         writeFileNo = 1; // display = stdout
@@ -139,6 +145,9 @@ ConsoleOutput::ConsoleOutput(char *writeFile, CallBackObj *toCall)
 
     callWhenDone = toCall;
     putBusy = FALSE;
+    ASSERT(size > 0);
+    bufferSize = size;
+    numPut = 0;
 }
 
 //----------------------------------------------------------------------
@@ -161,7 +170,7 @@ ConsoleOutput::~ConsoleOutput()
 void ConsoleOutput::CallBack()
 {
     putBusy = FALSE;
-    kernel->stats->numConsoleCharsWritten++;
+    kernel->stats->numConsoleCharsWritten += numPut;
     callWhenDone->CallBack();
 }
 
@@ -173,8 +182,22 @@ void ConsoleOutput::CallBack()
 
 void ConsoleOutput::PutChar(char ch)
 {
-    ASSERT(putBusy == FALSE);
-    WriteFile(writeFileNo, &ch, sizeof(char));
+    (void) PutChars(&ch, 1);
+}
+
+//----------------------------------------------------------------------
+// ConsoleOutput::PutChars()
+// 	Write up to a buffer full of the "count" characters at "data" to
+//	the simulated display, in one go, and return how many that was.
+//	A single interrupt comes once they have all crossed the line.
+//----------------------------------------------------------------------
+
+int ConsoleOutput::PutChars(char *data, int count)
+{
+    ASSERT(putBusy == FALSE && count > 0);
+    numPut = min(count, bufferSize);
+    WriteFile(writeFileNo, data, numPut);
     putBusy = TRUE;
-    kernel->interrupt->Schedule(this, ConsoleTime, ConsoleWriteInt);
+    kernel->interrupt->Schedule(this, ConsoleTime * numPut, ConsoleWriteInt);
+    return numPut;
 }
@@ -13,6 +13,11 @@
 //	to the console has limited bandwidth (like a modem!), and so
 //	each character takes measurable time.
 //
+//	A console can be given a buffer of more than one character, for
+//	DMA-like transfers: then up to that many characters go out (or
+//	come in) with a single interrupt.  Each still takes as long to
+//	cross the line; only the interrupts are fewer.
+//
 //	The user of the device registers itself to be called "back" when 
 //	the read/write interrupts occur.  There is a separate interrupt
 //	for read and write, and the device is "duplex" -- a character
@@ -46,14 +51,20 @@
 
 class ConsoleInput : public CallBackObj {
   public:
-    ConsoleInput(char *readFile, CallBackObj *toCall);
-				// initialize hardware console input 
+    ConsoleInput(char *readFile, CallBackObj *toCall, int bufferSize = 1);
+				// initialize hardware console input,
+				// taking in up to "bufferSize"
+				// characters at a time
     ~ConsoleInput();		// clean up console emulation
 
     char GetChar();	   	// Poll the console input.  If a char is 
 				// available, return it.  Otherwise, return EOF.
     				// "callWhenAvail" is called whenever there is 
-				// a char to be gotten
+				// a char to be gotten; if more than one
+				// came in, only once for all of them
+    int NumAvail() { return numIncoming - nextIncoming; }
+				// How many more GetChar can return
+				// before the next "callWhenAvail"
 
     void CallBack();		// Invoked when a character arrives
 				// from the keyboard.
@@ -64,22 +75,29 @@ class ConsoleInput : public CallBackObj {
     int readFileNo;			// UNIX file emulating the keyboard 
     CallBackObj *callWhenAvail;		// Interrupt handler to call when 
 					// there is a char to be read
-    char incoming;    			// Contains the character to be read,
-					// if there is one available. 
-					// Otherwise contains EOF.
+    char *incoming;    			// Contains the characters to be read,
+    int bufferSize;			// (room for this many)
+    int numIncoming;			// how many came in last time
+    int nextIncoming;			// the next one to be read
 	//2015.11.25
 	bool disabled;
 };
 
 class ConsoleOutput : public CallBackObj {
   public:
-    ConsoleOutput(char *writeFile, CallBackObj *toCall);
-				// initialize hardware console output 
+    ConsoleOutput(char *writeFile, CallBackObj *toCall, int bufferSize = 1);
+				// initialize hardware console output,
+				// sending out up to "bufferSize"
+				// characters at a time
     ~ConsoleOutput();		// clean up console emulation
 
     void PutChar(char ch);	// Write "ch" to the console display, 
 				// and return immediately.  "callWhenDone" 
 				// will called when the I/O completes. 
+    int PutChars(char *data, int count);
+				// Same, for as many of the "count"
+				// characters at "data" as fit in the
+				// buffer; return how many that was
     void CallBack();		// Invoked when next character can be put
 				// out to the display.
 
@@ -89,6 +107,8 @@ class ConsoleOutput : public CallBackObj {
 					// the next char can be put 
     bool putBusy;    			// Is a PutChar operation in progress?
 					// If so, you can't do another one!
+    int bufferSize;			// most characters one can put
+    int numPut;				// how many the one in progress put
 };
 
 #endif // CONSOLE_H
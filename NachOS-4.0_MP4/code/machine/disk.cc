@@ -33,10 +33,16 @@ const int DiskSize = (MagicSize + (NumSectors * SectorSize));
 //	if it doesn't exist), and check the magic number to make sure it's
 // 	ok to treat it as Nachos disk storage.
 //
+//	Then, if asked to, map the whole file (magic number and all) into
+//	memory.  A file too short to hold every sector is left unmapped:
+//	touching a mapping past the end of its file crashes.
+//
 //	"toCall" -- object to call when disk read/write request completes
+//	"mapped" -- serve requests from a mapping of the file, rather
+//		than by reading and writing it
 //----------------------------------------------------------------------
 
-Disk::Disk(CallBackObj *toCall)
+Disk::Disk(CallBackObj *toCall, bool mapped)
 {
     int magicNum;
     int tmp = 0;
@@ -63,6 +69,12 @@ Disk::Disk(CallBackObj *toCall)
         Lseek(fileno, DiskSize - sizeof(int), 0);
         WriteFile(fileno, (char *)&tmp, sizeof(int));
     }
+
+    image = NULL;
+    Lseek(fileno, 0, SEEK_END);
+    if (mapped && Tell(fileno) >= DiskSize)
+        image = MapFile(fileno, DiskSize, TRUE);
+    DEBUG(dbgDisk, (image != NULL ? "Disk is mapped." : "Disk is not mapped."));
     active = FALSE;
 }
 
@@ -74,9 +86,56 @@ Disk::Disk(CallBackObj *toCall)
 
 Disk::~Disk()
 {
+    if (image != NULL)
+    {
+        Sync();
+        UnmapFile(image, DiskSize);
+    }
     Close(fileno);
 }
 
+//----------------------------------------------------------------------
+// Disk::Sync
+// 	Wait until every sector written so far is in the UNIX file.  Only
+//	a mapped disk has anything to do: otherwise each request writes
+//	the file directly.
+//----------------------------------------------------------------------
+
+void
+Disk::Sync()
+{
+    if (image != NULL)
+        SyncFile(image, DiskSize);
+}
+
+//----------------------------------------------------------------------
+// Disk::MapContents
+// 	Return where sector 0 is, in a mapping of the UNIX file holding
+//	the disk (a new, read-only one, if the disk isn't mapped already).
+//	Writes made through the disk later show up in the mapping.  No
+//	simulated time passes.
+//----------------------------------------------------------------------
+
+char *
+Disk::MapContents()
+{
+    char *addr = image != NULL ? image : MapFile(fileno, DiskSize);
+
+    return addr == NULL ? NULL : addr + MagicSize;
+}
+
+//----------------------------------------------------------------------
+// Disk::UnmapContents
+// 	Undo MapContents.
+//----------------------------------------------------------------------
+
+void
+Disk::UnmapContents(char *contents)
+{
+    if (image == NULL)
+        UnmapFile(contents - MagicSize, DiskSize);
+}
+
 //----------------------------------------------------------------------
 // Disk::PrintSector()
 // 	Dump the data in a disk read/write request, for debugging.
@@ -101,7 +160,7 @@ PrintSector(bool writing, int sector, char *data)
 //----------------------------------------------------------------------
 // Disk::ReadRequest/WriteRequest
 // 	Simulate a request to read/write a single disk sector
-//	   Do the read/write immediately to the UNIX file
+//	   Do the read/write immediately to the UNIX file (or its mapping)
 //	   Set up an interrupt handler to be called later,
 //	      that will notify the caller when the simulator says
 //	      the operation has completed.
@@ -115,39 +174,81 @@ PrintSector(bool writing, int sector, char *data)
 
 void Disk::ReadRequest(int sectorNumber, char *data)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    ReadRequest(sectorNumber, data, 1);
+}
+
+void Disk::WriteRequest(int sectorNumber, char *data)
+{
+    WriteRequest(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// Disk::ReadRequest/WriteRequest
+// 	Simulate a request to read/write a run of physically consecutive
+//	disk sectors.  The request pays the usual latency to reach the
+//	first sector; every following sector is already under the head,
+//	so it only costs RotationTime to transfer.
+//
+//	"sectorNumber" -- the first disk sector to read/write
+//	"data" -- the bytes to be written, the buffer to hold the incoming bytes
+//	"numSectors" -- the number of consecutive sectors in the run
+//----------------------------------------------------------------------
+
+void Disk::ReadRequest(int sectorNumber, char *data, int numSectors)
+{
+    int rotation;
+    int seek = TimeToSeek(sectorNumber, &rotation);
+    int ticks = ComputeLatency(sectorNumber, FALSE) +
+                (numSectors - 1) * RotationTime;
 
     ASSERT(!active); // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT(numSectors > 0);
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    DEBUG(dbgDisk, "Reading " << numSectors << " sectors from sector " << sectorNumber);
+    if (image != NULL)
+        bcopy(image + MagicSize + SectorSize * sectorNumber, data,
+              SectorSize * numSectors);
+    else
+        ReadAt(fileno, data, SectorSize * numSectors,
+               MagicSize + SectorSize * sectorNumber);
     if (debug->IsEnabled('d'))
-        PrintSector(FALSE, sectorNumber, data);
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(FALSE, sectorNumber + i, &data[i * SectorSize]);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskReads++;
+    kernel->stats->diskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
-void Disk::WriteRequest(int sectorNumber, char *data)
+void Disk::WriteRequest(int sectorNumber, char *data, int numSectors)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int rotation;
+    int seek = TimeToSeek(sectorNumber, &rotation);
+    int ticks = ComputeLatency(sectorNumber, TRUE) +
+                (numSectors - 1) * RotationTime;
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT(numSectors > 0);
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
 
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    DEBUG(dbgDisk, "Writing " << numSectors << " sectors to sector " << sectorNumber);
+    if (image != NULL)
+        bcopy(data, image + MagicSize + SectorSize * sectorNumber,
+              SectorSize * numSectors);
+    else
+        WriteAt(fileno, data, SectorSize * numSectors,
+                MagicSize + SectorSize * sectorNumber);
     if (debug->IsEnabled('d'))
-        PrintSector(TRUE, sectorNumber, data);
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(TRUE, sectorNumber + i, &data[i * SectorSize]);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskWrites++;
+    kernel->stats->diskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
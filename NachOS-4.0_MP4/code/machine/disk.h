@@ -34,6 +34,9 @@
 // and an interrupt is invoked later to signal that the operation completed.
 //
 // The physical disk is in fact simulated via operations on a UNIX file.
+// Normally the whole file is mapped into memory, so that a request is
+// just a copy; otherwise (or if mapping fails) each request reads or
+// writes the file, with a single system call.
 //
 // To make life a little more realistic, the simulated time for
 // each operation reflects a "track buffer" -- RAM to store the contents
@@ -58,9 +61,12 @@ const int NumSectors = (SectorsPerTrack * NumTracks);
 
 class Disk : public CallBackObj {
   public:
-    Disk(CallBackObj *toCall);          // Create a simulated disk.  
+    Disk(CallBackObj *toCall, bool mapped = TRUE);
+    					// Create a simulated disk.  
 					// Invoke toCall->CallBack() 
 					// when each request completes.
+					// Map the UNIX file into memory
+					// if "mapped".
     ~Disk();				// Deallocate the disk.
     
     void ReadRequest(int sectorNumber, char* data);
@@ -70,6 +76,14 @@ class Disk : public CallBackObj {
     					// Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
 
+    void ReadRequest(int sectorNumber, char* data, int numSectors);
+    					// Read/write a run of "numSectors"
+					// physically consecutive sectors
+					// starting at sectorNumber, as a
+					// single request: one seek, then
+					// the rest stream past the head.
+    void WriteRequest(int sectorNumber, char* data, int numSectors);
+
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
@@ -78,9 +92,25 @@ class Disk : public CallBackObj {
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
 
+    int HeadSector() { return lastSector; }
+    					// Where the head was left by the
+					// previous request; used by disk
+					// schedulers to order requests.
+
+    char *MapContents();		// The contents of every sector,
+    					// mapped, for looking at outside
+					// of simulated time; NULL if
+					// that can't be done
+    void UnmapContents(char *contents);
+
+    void Sync();			// Make sure everything written
+    					// so far is in the UNIX file
+
   private:
     int fileno;				// UNIX file number for simulated disk 
     char diskname[32];			// name of simulated disk's file
+    char *image;			// the whole file, mapped into
+    					// memory; NULL if it isn't
     CallBackObj *callWhenDone;		// Invoke when any disk request finishes
     bool active;     			// Is a disk operation in progress?
     int lastSector;			// The previous disk request 
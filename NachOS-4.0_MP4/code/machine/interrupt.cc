@@ -23,6 +23,7 @@
 #include "copyright.h"
 #include "interrupt.h"
 #include "main.h"
+#include "smp.h"
 
 // String definitions for debugging messages
 
@@ -50,27 +51,20 @@ PendingInterrupt::PendingInterrupt(CallBackObj *callOnInt,
 }
 
 //----------------------------------------------------------------------
-// PendingCompare
-//	Compare to interrupts based on which should occur first.
+// Earlier
+//	Return TRUE if interrupt "x" should occur before "y": if it is
+//	due first, or, if both are due at the same time, scheduled first.
 //----------------------------------------------------------------------
 
-static int
-PendingCompare(PendingInterrupt *x, PendingInterrupt *y)
+static bool
+Earlier(PendingInterrupt *x, PendingInterrupt *y)
 {
-    if (x->when < y->when)
-    {
-        return -1;
-    }
-    else if (x->when > y->when)
-    {
-        return 1;
-    }
-    else
-    {
-        return 0;
-    }
+    return x->when < y->when || (x->when == y->when && x->order < y->order);
 }
 
+// "nextDue" when nothing is pending: later than any tick ever gets to
+static const int NeverDue = 0x7fffffff;
+
 //----------------------------------------------------------------------
 // Interrupt::Interrupt
 // 	Initialize the simulation of hardware device interrupts.
@@ -81,7 +75,13 @@ PendingCompare(PendingInterrupt *x, PendingInterrupt *y)
 Interrupt::Interrupt()
 {
     level = IntOff;
-    pending = new SortedList<PendingInterrupt *>(PendingCompare);
+    maxPending = 16;
+    pending = new PendingInterrupt *[maxPending];
+    numPending = 0;
+    nextDue = NeverDue;
+    numScheduled = 0;
+    freeList = NULL;
+    tracing = debug->IsEnabled(dbgInt);
     inHandler = FALSE;
     yieldOnReturn = FALSE;
     status = SystemMode;
@@ -94,11 +94,19 @@ Interrupt::Interrupt()
 
 Interrupt::~Interrupt()
 {
-    while (!pending->IsEmpty())
+    PendingInterrupt *node;
+
+    for (int i = 0; i < numPending; i++)
+    {
+        delete pending[i];
+    }
+    delete[] pending;
+    while (freeList != NULL)
     {
-        delete pending->RemoveFront();
+        node = freeList;
+        freeList = node->nextFree;
+        delete node;
     }
-    delete pending;
 }
 
 //----------------------------------------------------------------------
@@ -153,8 +161,16 @@ Interrupt::SetLevel(IntStatus now)
 //	Two things can cause OneTick to be called:
 //		interrupts are re-enabled
 //		a user instruction is executed
+//
+//	"count" -- how many ticks to advance by; a whole block of user
+//		instructions can be charged at once, as long as no
+//		interrupt was due before the last of them (see NextDue)
+//
+//	Until the next interrupt is due, there is nothing to check, and
+//	(unless we are printing the interrupt state each tick) the time
+//	is all that changes.
 //----------------------------------------------------------------------
-void Interrupt::OneTick()
+void Interrupt::OneTick(int count)
 {
     MachineStatus oldStatus = status;
     Statistics *stats = kernel->stats;
@@ -162,15 +178,19 @@ void Interrupt::OneTick()
     // advance simulated time
     if (status == SystemMode)
     {
-        stats->totalTicks += SystemTick;
-        stats->systemTicks += SystemTick;
+        stats->totalTicks += count * SystemTick;
+        stats->systemTicks += count * SystemTick;
     }
     else
     {
-        stats->totalTicks += UserTick;
-        stats->userTicks += UserTick;
+        stats->totalTicks += count * UserTick;
+        stats->userTicks += count * UserTick;
     }
     DEBUG(dbgInt, "== Tick " << stats->totalTicks << " ==");
+    if (stats->totalTicks < nextDue && !yieldOnReturn && !tracing)
+    {
+        return;
+    }
 
     // check any pending interrupts are now ready to fire
     ChangeLevel(IntOn, IntOff); // first, turn off interrupts
@@ -213,6 +233,9 @@ void Interrupt::YieldOnReturn()
 //	on the ready queue, the only thing to do is to advance
 //	simulated time until the next scheduled hardware interrupt.
 //
+//	On a multiprocessor, the threads waiting for a CPU aren't on the
+//	ready queue either: run them for a round first (see smp.h).
+//
 //	If there are no pending interrupts, stop.  There's nothing
 //	more for us to do.
 //----------------------------------------------------------------------
@@ -220,6 +243,12 @@ void Interrupt::Idle()
 {
     DEBUG(dbgInt, "Machine idling; checking for interrupts.");
     status = IdleMode;
+    if (kernel->cpus != NULL && kernel->cpus->RunRound())
+    {
+        CheckIfDue(FALSE); // anything due by the end of the round
+        status = SystemMode;
+        return;
+    }
     if (CheckIfDue(TRUE))
     { // check for any pending interrupts
         status = SystemMode;
@@ -253,6 +282,9 @@ void Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+#ifndef FILESYS_STUB
+    kernel->fileSystem->Sync(); // commit the journal while the disk works
+#endif
     delete debug;
 
     delete kernel; // Never returns.
@@ -263,7 +295,8 @@ void Interrupt::Halt()
 // 	Arrange for the CPU to be interrupted when simulated time
 //	reaches "now + when".
 //
-//	Implementation: just put it on a sorted list.
+//	Implementation: just put it on the heap, in a node from the pool
+//	if there is one.
 //
 //	NOTE: the Nachos kernel should not call this routine directly.
 //	Instead, it is only called by the hardware device simulators.
@@ -276,12 +309,111 @@ void Interrupt::Halt()
 void Interrupt::Schedule(CallBackObj *toCall, int fromNow, IntType type)
 {
     int when = kernel->stats->totalTicks + fromNow;
-    PendingInterrupt *toOccur = new PendingInterrupt(toCall, when, type);
+    PendingInterrupt *toOccur;
 
     DEBUG(dbgInt, "Scheduling interrupt handler the " << intTypeNames[type] << " at time = " << when);
     ASSERT(fromNow > 0);
 
-    pending->Insert(toOccur);
+    if (freeList != NULL)
+    {
+        toOccur = freeList;
+        freeList = toOccur->nextFree;
+        toOccur->callOnInterrupt = toCall;
+        toOccur->when = when;
+        toOccur->type = type;
+    }
+    else
+    {
+        toOccur = new PendingInterrupt(toCall, when, type);
+    }
+    toOccur->order = numScheduled++;
+    Push(toOccur);
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Push
+// 	Add "toOccur" to the heap of pending interrupts, moving it up
+//	past any that are to occur after it.
+//----------------------------------------------------------------------
+
+void Interrupt::Push(PendingInterrupt *toOccur)
+{
+    PendingInterrupt **bigger;
+    int i;
+
+    if (numPending == maxPending)
+    { // out of room: double it
+        bigger = new PendingInterrupt *[2 * maxPending];
+        for (i = 0; i < numPending; i++)
+        {
+            bigger[i] = pending[i];
+        }
+        delete[] pending;
+        pending = bigger;
+        maxPending *= 2;
+    }
+    for (i = numPending++; i > 0 && Earlier(toOccur, pending[(i - 1) / 2]);
+         i = (i - 1) / 2)
+    {
+        pending[i] = pending[(i - 1) / 2];
+    }
+    pending[i] = toOccur;
+    nextDue = pending[0]->when;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Pop
+// 	Take the first interrupt to occur off the heap, and return it.
+//	The last one on the heap takes its place, and moves down past
+//	any that are to occur before it.
+//----------------------------------------------------------------------
+
+PendingInterrupt *
+Interrupt::Pop()
+{
+    PendingInterrupt *first = pending[0];
+    PendingInterrupt *last = pending[--numPending];
+    int i, child;
+
+    for (i = 0; (child = 2 * i + 1) < numPending; i = child)
+    {
+        if (child + 1 < numPending && Earlier(pending[child + 1], pending[child]))
+        {
+            child++;
+        }
+        if (!Earlier(pending[child], last))
+        {
+            break;
+        }
+        pending[i] = pending[child];
+    }
+    pending[i] = last;
+    nextDue = numPending > 0 ? pending[0]->when : NeverDue;
+    return first;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::NextDueExcept
+// 	Return when the first pending interrupt not of the given type is
+//	to occur, or -1 if there is none.  Only the first of them all is
+//	kept in front of the heap, so look through the lot: there are
+//	never many.
+//
+//	"type" -- the kind of interrupt to leave out
+//----------------------------------------------------------------------
+
+int Interrupt::NextDueExcept(IntType type)
+{
+    int due = NeverDue;
+
+    for (int i = 0; i < numPending; i++)
+    {
+        if (pending[i]->type != type && pending[i]->when < due)
+        {
+            due = pending[i]->when;
+        }
+    }
+    return due == NeverDue ? -1 : due;
 }
 
 //----------------------------------------------------------------------
@@ -307,11 +439,11 @@ bool Interrupt::CheckIfDue(bool advanceClock)
     {
         DumpState();
     }
-    if (pending->IsEmpty())
+    if (numPending == 0)
     { // no pending interrupts
         return FALSE;
     }
-    next = pending->Front();
+    next = pending[0];
 
     if (next->when > stats->totalTicks)
     {
@@ -338,10 +470,11 @@ bool Interrupt::CheckIfDue(bool advanceClock)
     inHandler = TRUE;
     do
     {
-        next = pending->RemoveFront();     // pull interrupt off list
+        next = Pop();                      // pull interrupt off heap
         next->callOnInterrupt->CallBack(); // call the interrupt handler
-        delete next;
-    } while (!pending->IsEmpty() && (pending->Front()->when <= stats->totalTicks));
+        next->nextFree = freeList;         // and keep the node for reuse
+        freeList = next;
+    } while (nextDue <= stats->totalTicks);
     inHandler = FALSE;
     return TRUE;
 }
@@ -362,14 +495,32 @@ PrintPending(PendingInterrupt *pending)
 //----------------------------------------------------------------------
 // DumpState
 // 	Print the complete interrupt state - the status, and all interrupts
-//	that are scheduled to occur in the future.
+//	that are scheduled to occur in the future, in the order they will.
 //----------------------------------------------------------------------
 
 void Interrupt::DumpState()
 {
+    PendingInterrupt **sorted = new PendingInterrupt *[numPending];
+    PendingInterrupt *next;
+    int i, j;
+
+    for (i = 0; i < numPending; i++)
+    { // insertion sort a copy of the heap
+        next = pending[i];
+        for (j = i; j > 0 && Earlier(next, sorted[j - 1]); j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = next;
+    }
+
     cout << "Time: " << kernel->stats->totalTicks;
     cout << ", interrupts " << intLevelNames[level] << "\n";
     cout << "Pending interrupts:\n";
-    pending->Apply(PrintPending);
+    for (i = 0; i < numPending; i++)
+    {
+        PrintPending(sorted[i]);
+    }
     cout << "\nEnd of pending interrupts\n";
+    delete[] sorted;
 }
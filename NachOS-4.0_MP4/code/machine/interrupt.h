@@ -66,6 +66,10 @@ class PendingInterrupt {
     
     int when;			// When the interrupt is supposed to fire
     IntType type;		// for debugging
+
+    int order;			// Among interrupts due at the same time,
+				// the one scheduled first fires first
+    PendingInterrupt *nextFree;	// Next node in the pool of unused ones
 };
 
 // The following class defines the data structures for the simulation
@@ -119,13 +123,29 @@ class Interrupt {
 				// at time "when".  This is called
     				// by the hardware device simulators.
     
-    void OneTick();       	// Advance simulated time
+    void OneTick(int count = 1);	// Advance simulated time, by "count"
+				// ticks at once
+
+    int NextDue() { return numPending > 0 ? nextDue : -1; }
+				// When the next interrupt is to occur,
+				// or -1 if none is pending
+    int NextDueExcept(IntType type);
+				// The same, leaving out interrupts of
+				// the given type
 
   private:
     IntStatus level;		// are interrupts enabled or disabled?
-    SortedList<PendingInterrupt *> *pending;		
-    				// the list of interrupts scheduled
-				// to occur in the future
+    PendingInterrupt **pending;	// the interrupts scheduled to occur in
+				// the future: a binary heap, ordered by
+				// "when" (and "order")
+    int numPending;		// how many there are
+    int maxPending;		// how many "pending" has room for
+    int nextDue;		// when the first of them is due (a
+				// long way off, if none is pending)
+    int numScheduled;		// for PendingInterrupt::order
+    PendingInterrupt *freeList;	// nodes to reuse, rather than
+				// allocating one for each interrupt
+    bool tracing;		// printing interrupt state (dbgInt)?
     //int writeFileNo;            //UNIX file emulating the display
     bool inHandler;		// TRUE if we are running an interrupt handler
     //bool putBusy;               // Is a PrintInt operation in progress
@@ -139,6 +159,9 @@ class Interrupt {
     bool CheckIfDue(bool advanceClock); 
     				// Check if any interrupts are supposed
 				// to occur now, and if so, do them
+    void Push(PendingInterrupt *toOccur);
+    PendingInterrupt *Pop();	// Add to, or take the first off, the
+				// heap of pending interrupts
 
     void ChangeLevel(IntStatus old, 	// SetLevel, without advancing the
 			IntStatus now); // simulated time
@@ -9,6 +9,7 @@
 
 #include "copyright.h"
 #include "machine.h"
+#include "codecache.h"
 #include "main.h"
 
 // Textual names of the exceptions that can be generated by user program
@@ -50,9 +51,13 @@ static void CheckEndian()
 //
 //	"debug" -- if TRUE, drop into the debugger after each user instruction
 //		is executed.
+//	"translate" -- if TRUE, translate user code that runs often into
+//		host instructions (see codecache.h).
+//	"useTLB" -- if not NULL, the TLB to use instead of page tables;
+//		the machine deletes it when done.
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug)
+Machine::Machine(bool debug, bool translate, TLB *useTLB)
 {
     int i;
 
@@ -61,20 +66,58 @@ Machine::Machine(bool debug)
     mainMemory = new char[MemorySize];
     for (i = 0; i < MemorySize; i++)
         mainMemory[i] = 0;
+    tlb = useTLB;
 #ifdef USE_TLB
-    tlb = new TranslationEntry[TLBSize];
-    for (i = 0; i < TLBSize; i++)
-        tlb[i].valid = FALSE;
-    pageTable = NULL;
-#else // use linear page table
-    tlb = NULL;
-    pageTable = NULL;
+    if (tlb == NULL)
+        tlb = new TLB(TLBSize, TLBSize, TLBLRU);
 #endif
+    pageTable = NULL;
+
+    // every word of memory starts out 0, decoded as such
+    decodeCache = new Instruction[MemorySize / 4];
+    for (i = 0; i < MemorySize / 4; i++)
+    {
+        decodeCache[i].value = 0;
+        decodeCache[i].Decode();
+    }
+
+    FlushMemCache();
+    codeCache = translate ? new CodeCache(this) : NULL;
+    ownsMemory = TRUE;
 
     singleStep = debug;
     CheckEndian();
 }
 
+//----------------------------------------------------------------------
+// Machine::Machine
+// 	Initialize another CPU of a multiprocessor (see smp.h).  It has
+//	registers of its own, but runs out of the same memory as "boot",
+//	and so shares its decoded instructions too.  It has no TLB, and
+//	is never single-stepped.
+//
+//	"boot" -- the machine the kernel runs user programs on
+//	"translate" -- if TRUE, run user programs as host instructions
+//----------------------------------------------------------------------
+
+Machine::Machine(Machine *boot, bool translate)
+{
+    for (int i = 0; i < NumTotalRegs; i++)
+        registers[i] = 0;
+    mainMemory = boot->mainMemory;
+    decodeCache = boot->decodeCache;
+    ownsMemory = FALSE;
+    tlb = NULL;
+    pageTable = NULL;
+    pageTableSize = 0;
+
+    FlushMemCache();
+    codeCache = translate ? new CodeCache(this) : NULL;
+    singleStep = FALSE;
+    RunBlock(0);	// set up its tables now, while there is only
+			// one thread of the host to do it
+}
+
 //----------------------------------------------------------------------
 // Machine::~Machine
 // 	De-allocate the data structures used to simulate user program execution.
@@ -82,9 +125,15 @@ Machine::Machine(bool debug)
 
 Machine::~Machine()
 {
-    delete[] mainMemory;
+    if (ownsMemory)
+    {
+        delete[] mainMemory;
+        delete[] decodeCache;
+    }
+    if (codeCache != NULL)
+        delete codeCache;
     if (tlb != NULL)
-        delete[] tlb;
+        delete tlb;
 }
 
 //----------------------------------------------------------------------
@@ -24,6 +24,7 @@
 #include "copyright.h"
 #include "utility.h"
 #include "translate.h"
+#include "tlb.h"
 
 // Definitions related to the size, and format of user memory
 
@@ -38,7 +39,9 @@ const int PageSize = 128; // set the page size equal to
 const int NumPhysPages = 128;
 
 const int MemorySize = (NumPhysPages * PageSize);
-const int TLBSize = 4; // if there is a TLB, make it small
+const int TLBSize = 4; // if there is a TLB (and nachos -tlb doesn't
+					   // say otherwise), make it small
+const int MemCacheSize = 16; // translations ReadMem and WriteMem keep
 
 enum ExceptionType
 {
@@ -90,14 +93,41 @@ enum ExceptionType
 // The procedures in this class are defined in machine.cc, mipssim.cc, and
 // translate.cc.
 
-class Instruction;
+// The following class defines an instruction, represented in both
+// 	undecoded binary form
+//      decoded to identify
+//	    operation to do
+//	    registers to act on
+//	    any immediate operand value
+
+class Instruction
+{
+public:
+	void Decode(); // decode the binary representation of the instruction
+
+	unsigned int value; // binary representation of the instruction
+
+	char opCode;	 // Type of instruction.  This is NOT the same as the
+					 // opcode field from the instruction: see defs in mips.h
+	char rs, rt, rd; // Three registers from instruction.
+	int extra;		 // Immediate or target or shamt field or offset.
+					 // Immediates are sign-extended.
+};
+
 class Interrupt;
+class CodeCache;
 
 class Machine
 {
 public:
-	Machine(bool debug); // Initialize the simulation of the hardware
-		// for running user programs
+	Machine(bool debug, bool translate = FALSE, TLB *useTLB = NULL);
+	// Initialize the simulation of the hardware
+	// for running user programs; if "translate",
+	// run them as host code where possible; if
+	// "useTLB", translate addresses through it
+	Machine(Machine *boot, bool translate);
+	// Initialize another CPU of a multiprocessor,
+	// sharing the memory of "boot" (see smp.h)
 	~Machine(); // De-allocate the data structures
 
 	// Routines callable by the Nachos kernel
@@ -133,10 +163,11 @@ public:
 	// public.  However, while there can be multiple page tables (one per address
 	// space, stored in memory), there is only one TLB (implemented in hardware).
 	// Thus the TLB pointer should be considered as *read-only*, although
-	// the contents of the TLB are free to be modified by the kernel software.
+	// the contents of the TLB are free to be modified by the kernel software
+	// (see tlb.h).
 
-	TranslationEntry *tlb; // this pointer should be considered
-						   // "read-only" to Nachos kernel code
+	TLB *tlb; // this pointer should be considered
+			  // "read-only" to Nachos kernel code
 
 	TranslationEntry *pageTable;
 	unsigned int pageTableSize;
@@ -146,14 +177,40 @@ public:
 	// Read or write 1, 2, or 4 bytes of virtual
 	// memory (at addr).  Return FALSE if a
 	// correct translation couldn't be found.
+
+	void FlushMemCache();
+	// Forget the translations ReadMem and
+	// WriteMem keep; call whenever the page
+	// table or the TLB changes
 private:
 	// Routines internal to the machine simulation -- DO NOT call these directly
 	void DelayedLoad(int nextReg, int nextVal);
 	// Do a pending delayed load (modifying a reg)
 
-	void OneInstruction(Instruction *instr);
+	void OneInstruction();
 	// Run one instruction of a user program.
 
+	Instruction *FetchInstruction();
+	// Translate the PC, and return the
+	// instruction there, decoded
+
+	int RunBlock(int limit);
+	// Run the basic block at the PC (at most
+	// "limit" instructions of it), and return
+	// how many ran; 0 to single-step
+
+	int RunBlocks(int limit);
+	// Run blocks for at most "limit" instructions,
+	// without calling into the kernel; return
+	// how many ran
+
+	int BlockTranslate(int virtAddr, int size, bool writing);
+	// Translate for RunBlock, which never
+	// raises exceptions: -1 if one is due
+
+	void FillMemCache(int virtAddr, int physAddr, bool writing);
+	// Keep a translation Translate just made
+
 	ExceptionType Translate(int virtAddr, int *physAddr, int size, bool writing);
 	// Translate an address, and check for
 	// alignment.  Set the use and dirty bits in
@@ -172,12 +229,25 @@ private:
 
 	int registers[NumTotalRegs]; // CPU registers, for executing user programs
 
+	Instruction *decodeCache; // the last instruction decoded from
+		// each word of physical memory
+
+	MemCacheEntry memCache[MemCacheSize]; // translations kept for
+		// ReadMem and WriteMem, by virtual page #
+
+	CodeCache *codeCache; // user code translated for the host, if
+		// asked for (see codecache.h); else NULL
+
+	bool ownsMemory; // FALSE for a CPU sharing another's memory
+
 	bool singleStep; // drop back into the debugger after each
 		// simulated instruction
 	int runUntilTime; // drop back into the debugger when simulated
 		// time reaches this value
 
 	friend class Interrupt; // calls DelayedLoad()
+	friend class CodeCache; // runs user code, as RunBlock would
+	friend class Multiprocessor; // runs user code on other CPUs
 };
 
 extern void ExceptionHandler(ExceptionType which);
@@ -19,31 +19,12 @@
 #include "debug.h"
 #include "machine.h"
 #include "mipssim.h"
+#include "codecache.h"
+#include "smp.h"
 #include "main.h"
 
 static void Mult(int a, int b, bool signedArith, int *hiPtr, int *loPtr);
 
-// The following class defines an instruction, represented in both
-// 	undecoded binary form
-//      decoded to identify
-//	    operation to do
-//	    registers to act on
-//	    any immediate operand value
-
-class Instruction
-{
-public:
-	void Decode(); // decode the binary representation of the instruction
-
-	unsigned int value; // binary representation of the instruction
-
-	char opCode;	 // Type of instruction.  This is NOT the same as the
-					 // opcode field from the instruction: see defs in mips.h
-	char rs, rt, rd; // Three registers from instruction.
-	int extra;		 // Immediate or target or shamt field or offset.
-					 // Immediates are sign-extended.
-};
-
 //----------------------------------------------------------------------
 // Machine::Run
 // 	Simulate the execution of a user-level program on Nachos.
@@ -51,11 +32,24 @@ public:
 //
 //	This routine is re-entrant, in that it can be called multiple
 //	times concurrently -- one for each thread executing user code.
+//
+//	Instructions are run a basic block at a time (see RunBlock),
+//	except when we are tracing or in the debugger, or when there
+//	is something in the way that only OneInstruction can deal with.
+//	Blocks are run one after another, with the simulated time only
+//	advanced at the tick the next interrupt is due: nothing can
+//	happen before then that would notice it hadn't been.
+//
+//	On a multiprocessor (nachos -smp), the blocks run on one of the
+//	CPUs instead, which advances the time itself (see smp.h).
 //----------------------------------------------------------------------
 
 void Machine::Run()
 {
-	Instruction *instr = new Instruction; // storage for decoded instruction
+	bool tracing = debug->IsEnabled(dbgMach) || debug->IsEnabled(dbgAddr) ||
+				   debug->IsEnabled(dbgInt);
+	int done, limit, due, n;
+	bool stuck; // at something only OneInstruction can run
 
 	if (debug->IsEnabled('m'))
 	{
@@ -65,8 +59,36 @@ void Machine::Run()
 	kernel->interrupt->setStatus(UserMode);
 	for (;;)
 	{
-		OneInstruction(instr);
-		kernel->interrupt->OneTick();
+		done = 0;
+		stuck = TRUE;
+		if (!tracing && !singleStep)
+		{
+			if (kernel->cpus != NULL)
+				stuck = kernel->cpus->Run(this);
+			else
+			{
+				limit = 1 << 30; // as many as there are, if no interrupt is due
+				due = kernel->interrupt->NextDue();
+				if (due != -1)
+				{
+					n = due - kernel->stats->totalTicks;
+					limit = n > 0 ? divRoundUp(n, UserTick) : 1;
+				}
+				while ((n = RunBlock(limit - done)) > 0 && (done += n) < limit)
+					;
+				stuck = (n == 0);
+			}
+		}
+
+		// if stuck short of the limit, no interrupt is due yet: the
+		// instruction in the way can go right after the blocks
+		if (done > 0)
+			kernel->interrupt->OneTick(done);
+		if (stuck)
+		{
+			OneInstruction();
+			kernel->interrupt->OneTick();
+		}
 		if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
 			Debugger();
 	}
@@ -115,25 +137,24 @@ TypeToReg(RegType reg, Instruction *instr)
 //	store all data back to the machine registers and memory before
 //	leaving.  This allows the Nachos kernel to control our behavior
 //	by controlling the contents of memory, the translation table,
-//	and the register set.
+//	and the register set.  (The decoded instructions FetchInstruction
+//	keeps are no exception: each is checked against memory before use.)
 //----------------------------------------------------------------------
 
-void Machine::OneInstruction(Instruction *instr)
+void Machine::OneInstruction()
 {
 #ifdef SIM_FIX
 	int byte; // described in Kane for LWL,LWR,...
 #endif
 
-	int raw;
+	Instruction *instr;
 	int nextLoadReg = 0;
 	int nextLoadValue = 0; // record delayed load operation, to apply
 		// in the future
 
 	// Fetch instruction
-	if (!ReadMem(registers[PCReg], 4, &raw))
+	if ((instr = FetchInstruction()) == NULL)
 		return; // exception occurred
-	instr->value = raw;
-	instr->Decode();
 
 	if (debug->IsEnabled('m'))
 	{
@@ -707,6 +728,616 @@ void Machine::OneInstruction(Instruction *instr)
 	registers[NextPCReg] = pcAfter;
 }
 
+//----------------------------------------------------------------------
+// Machine::RunBlock
+// 	Run the instructions from the PC to the end of the basic block
+//	(the first branch or jump, and its delay slot), but no more than
+//	"limit" of them, and return how many were run: 0, having done
+//	nothing, if not even the first one can be run this way.  The
+//	caller charges the ticks for them.
+//
+//	Each instruction does exactly what OneInstruction would, but
+//	the block goes straight from one to the next, through the
+//	decode cache and a table of labels ("computed goto"), without
+//	fetching, translating the PC, or checking for interrupts.
+//
+//	The block is cut short
+//		after "limit" instructions,
+//		at the end of the physical page,
+//		if a word in memory is no longer what it was decoded from,
+//	and stops just before any instruction that would raise an
+//	exception (or that is left to OneInstruction, like syscalls),
+//	so that OneInstruction can run it instead, with the exception
+//	raised the usual way, at the usual time.
+//
+//	With a TLB, nothing is run this way: each fetch has to be looked
+//	up in the TLB, as OneInstruction does, or its counts and its
+//	replacement order would depend on how the program was run.
+//
+//	If user code is being translated (nachos -dbt), the translation
+//	of the block is run instead, if there is one; it may go on into
+//	the blocks after it, up to the limit.
+//----------------------------------------------------------------------
+
+// Finish an instruction in RunBlock the way OneInstruction does, and
+// go on to the next one, if the block isn't over.
+#define NextInBlock()                                                   \
+	{                                                                   \
+		registers[registers[LoadReg]] = registers[LoadValueReg];        \
+		registers[LoadReg] = nextLoadReg;                               \
+		registers[LoadValueReg] = nextLoadValue;                        \
+		registers[0] = 0;                                               \
+		registers[PrevPCReg] = registers[PCReg];                        \
+		registers[PCReg] = registers[NextPCReg];                        \
+		registers[NextPCReg] = pcAfter;                                 \
+		instr++;                                                        \
+		if (++done == limit ||                                          \
+			instr->value != WordToHost(words[instr - decodeCache]))     \
+			goto blockDone;                                             \
+		pcAfter = registers[NextPCReg] + 4;                             \
+		nextLoadReg = 0;                                                \
+		nextLoadValue = 0;                                              \
+		goto *dispatch[(int)instr->opCode];                             \
+	}
+
+// A branch or jump ends the block, after its delay slot
+#define EndOfBlock() limit = min(limit, done + 2)
+
+int Machine::RunBlock(int limit)
+{
+	static void *dispatch[MaxOpcode + 1];
+	static bool dispatchReady = FALSE;
+	unsigned int *words = (unsigned int *)mainMemory;
+	Instruction *instr;
+	int pc = registers[PCReg];
+	int done, physAddr;
+	int nextLoadReg, nextLoadValue, pcAfter;
+	int sum, diff, tmp, value;
+	unsigned int rs, rt, imm;
+
+	if (!dispatchReady)
+	{
+		for (int i = 0; i <= MaxOpcode; i++)
+			dispatch[i] = &&blockDone; // left to OneInstruction
+		dispatch[OP_ADD] = &&opAdd;
+		dispatch[OP_ADDI] = &&opAddi;
+		dispatch[OP_ADDIU] = &&opAddiu;
+		dispatch[OP_ADDU] = &&opAddu;
+		dispatch[OP_AND] = &&opAnd;
+		dispatch[OP_ANDI] = &&opAndi;
+		dispatch[OP_BEQ] = &&opBeq;
+		dispatch[OP_BGEZ] = &&opBgez;
+		dispatch[OP_BGEZAL] = &&opBgezal;
+		dispatch[OP_BGTZ] = &&opBgtz;
+		dispatch[OP_BLEZ] = &&opBlez;
+		dispatch[OP_BLTZ] = &&opBltz;
+		dispatch[OP_BLTZAL] = &&opBltzal;
+		dispatch[OP_BNE] = &&opBne;
+		dispatch[OP_DIV] = &&opDiv;
+		dispatch[OP_DIVU] = &&opDivu;
+		dispatch[OP_J] = &&opJ;
+		dispatch[OP_JAL] = &&opJal;
+		dispatch[OP_JALR] = &&opJalr;
+		dispatch[OP_JR] = &&opJr;
+		dispatch[OP_LB] = &&opLb;
+		dispatch[OP_LBU] = &&opLb;
+		dispatch[OP_LH] = &&opLh;
+		dispatch[OP_LHU] = &&opLh;
+		dispatch[OP_LUI] = &&opLui;
+		dispatch[OP_LW] = &&opLw;
+		dispatch[OP_MFHI] = &&opMfhi;
+		dispatch[OP_MFLO] = &&opMflo;
+		dispatch[OP_MTHI] = &&opMthi;
+		dispatch[OP_MTLO] = &&opMtlo;
+		dispatch[OP_MULT] = &&opMult;
+		dispatch[OP_MULTU] = &&opMultu;
+		dispatch[OP_NOR] = &&opNor;
+		dispatch[OP_OR] = &&opOr;
+		dispatch[OP_ORI] = &&opOri;
+		dispatch[OP_SB] = &&opSb;
+		dispatch[OP_SH] = &&opSh;
+		dispatch[OP_SLL] = &&opSll;
+		dispatch[OP_SLLV] = &&opSllv;
+		dispatch[OP_SLT] = &&opSlt;
+		dispatch[OP_SLTI] = &&opSlti;
+		dispatch[OP_SLTIU] = &&opSltiu;
+		dispatch[OP_SLTU] = &&opSltu;
+		dispatch[OP_SRA] = &&opSra;
+		dispatch[OP_SRAV] = &&opSrav;
+		dispatch[OP_SRL] = &&opSrl;
+		dispatch[OP_SRLV] = &&opSrlv;
+		dispatch[OP_SUB] = &&opSub;
+		dispatch[OP_SUBU] = &&opSubu;
+		dispatch[OP_SW] = &&opSw;
+		dispatch[OP_XOR] = &&opXor;
+		dispatch[OP_XORI] = &&opXori;
+		dispatch[OP_SYSCALL] = &&blockDone;
+		dispatchReady = TRUE;
+	}
+
+	// a block can only start without a TLB, where the PC and the next PC
+	// are in sequence, not in a delay slot, and at an instruction that is
+	// already decoded
+	if (tlb != NULL || registers[NextPCReg] != pc + 4 ||
+		(physAddr = BlockTranslate(pc, 4, FALSE)) == -1)
+		return 0;
+	instr = &decodeCache[physAddr / 4];
+	if (instr->value != WordToHost(words[physAddr / 4]))
+		return 0;
+
+	// translated code, if any, can run on past the end of the block
+	if (codeCache != NULL &&
+		(done = codeCache->Run(pc, physAddr, limit)) > 0)
+		return done;
+	limit = min(limit, (PageSize - physAddr % PageSize) / 4);
+
+	done = 0;
+	pcAfter = registers[NextPCReg] + 4;
+	nextLoadReg = 0;
+	nextLoadValue = 0;
+	goto *dispatch[(int)instr->opCode];
+
+opAdd:
+	sum = registers[(int)instr->rs] + registers[(int)instr->rt];
+	if (!((registers[(int)instr->rs] ^ registers[(int)instr->rt]) & SIGN_BIT) &&
+		((registers[(int)instr->rs] ^ sum) & SIGN_BIT))
+		goto blockDone; // overflow
+	registers[(int)instr->rd] = sum;
+	NextInBlock();
+
+opAddi:
+	sum = registers[(int)instr->rs] + instr->extra;
+	if (!((registers[(int)instr->rs] ^ instr->extra) & SIGN_BIT) &&
+		((instr->extra ^ sum) & SIGN_BIT))
+		goto blockDone; // overflow
+	registers[(int)instr->rt] = sum;
+	NextInBlock();
+
+opAddiu:
+	registers[(int)instr->rt] = registers[(int)instr->rs] + instr->extra;
+	NextInBlock();
+
+opAddu:
+	registers[(int)instr->rd] = registers[(int)instr->rs] + registers[(int)instr->rt];
+	NextInBlock();
+
+opAnd:
+	registers[(int)instr->rd] = registers[(int)instr->rs] & registers[(int)instr->rt];
+	NextInBlock();
+
+opAndi:
+	registers[(int)instr->rt] = registers[(int)instr->rs] & (instr->extra & 0xffff);
+	NextInBlock();
+
+opBeq:
+	if (registers[(int)instr->rs] == registers[(int)instr->rt])
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opBgezal:
+	registers[R31] = registers[NextPCReg] + 4;
+opBgez:
+	if (!(registers[(int)instr->rs] & SIGN_BIT))
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opBgtz:
+	if (registers[(int)instr->rs] > 0)
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opBlez:
+	if (registers[(int)instr->rs] <= 0)
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opBltzal:
+	registers[R31] = registers[NextPCReg] + 4;
+opBltz:
+	if (registers[(int)instr->rs] & SIGN_BIT)
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opBne:
+	if (registers[(int)instr->rs] != registers[(int)instr->rt])
+		pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opDiv:
+	if (registers[(int)instr->rt] == 0)
+	{
+		registers[LoReg] = 0;
+		registers[HiReg] = 0;
+	}
+	else
+	{
+		registers[LoReg] = registers[(int)instr->rs] / registers[(int)instr->rt];
+		registers[HiReg] = registers[(int)instr->rs] % registers[(int)instr->rt];
+	}
+	NextInBlock();
+
+opDivu:
+	rs = (unsigned int)registers[(int)instr->rs];
+	rt = (unsigned int)registers[(int)instr->rt];
+	if (rt == 0)
+	{
+		registers[LoReg] = 0;
+		registers[HiReg] = 0;
+	}
+	else
+	{
+		tmp = rs / rt;
+		registers[LoReg] = (int)tmp;
+		tmp = rs % rt;
+		registers[HiReg] = (int)tmp;
+	}
+	NextInBlock();
+
+opJal:
+	registers[R31] = registers[NextPCReg] + 4;
+opJ:
+	pcAfter = (pcAfter & 0xf0000000) | IndexToAddr(instr->extra);
+	EndOfBlock();
+	NextInBlock();
+
+opJalr:
+	registers[(int)instr->rd] = registers[NextPCReg] + 4;
+opJr:
+	pcAfter = registers[(int)instr->rs];
+	EndOfBlock();
+	NextInBlock();
+
+opLb:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 1, FALSE)) == -1)
+		goto blockDone;
+	value = mainMemory[physAddr];
+	if ((value & 0x80) && (instr->opCode == OP_LB))
+		value |= 0xffffff00;
+	else
+		value &= 0xff;
+	nextLoadReg = instr->rt;
+	nextLoadValue = value;
+	NextInBlock();
+
+opLh:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 2, FALSE)) == -1)
+		goto blockDone;
+	value = ShortToHost(*(unsigned short *)&mainMemory[physAddr]);
+	if ((value & 0x8000) && (instr->opCode == OP_LH))
+		value |= 0xffff0000;
+	else
+		value &= 0xffff;
+	nextLoadReg = instr->rt;
+	nextLoadValue = value;
+	NextInBlock();
+
+opLui:
+	registers[(int)instr->rt] = instr->extra << 16;
+	NextInBlock();
+
+opLw:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 4, FALSE)) == -1)
+		goto blockDone;
+	nextLoadReg = instr->rt;
+	nextLoadValue = WordToHost(*(unsigned int *)&mainMemory[physAddr]);
+	NextInBlock();
+
+opMfhi:
+	registers[(int)instr->rd] = registers[HiReg];
+	NextInBlock();
+
+opMflo:
+	registers[(int)instr->rd] = registers[LoReg];
+	NextInBlock();
+
+opMthi:
+	registers[HiReg] = registers[(int)instr->rs];
+	NextInBlock();
+
+opMtlo:
+	registers[LoReg] = registers[(int)instr->rs];
+	NextInBlock();
+
+opMult:
+	Mult(registers[(int)instr->rs], registers[(int)instr->rt], TRUE,
+		 &registers[HiReg], &registers[LoReg]);
+	NextInBlock();
+
+opMultu:
+	Mult(registers[(int)instr->rs], registers[(int)instr->rt], FALSE,
+		 &registers[HiReg], &registers[LoReg]);
+	NextInBlock();
+
+opNor:
+	registers[(int)instr->rd] = ~(registers[(int)instr->rs] | registers[(int)instr->rt]);
+	NextInBlock();
+
+opOr:
+	registers[(int)instr->rd] = registers[(int)instr->rs] | registers[(int)instr->rt];
+	NextInBlock();
+
+opOri:
+	registers[(int)instr->rt] = registers[(int)instr->rs] | (instr->extra & 0xffff);
+	NextInBlock();
+
+opSb:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 1, TRUE)) == -1)
+		goto blockDone;
+	mainMemory[physAddr] = (unsigned char)(registers[(int)instr->rt] & 0xff);
+	NextInBlock();
+
+opSh:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 2, TRUE)) == -1)
+		goto blockDone;
+	*(unsigned short *)&mainMemory[physAddr] =
+		ShortToMachine((unsigned short)(registers[(int)instr->rt] & 0xffff));
+	NextInBlock();
+
+opSll:
+	registers[(int)instr->rd] = registers[(int)instr->rt] << instr->extra;
+	NextInBlock();
+
+opSllv:
+	registers[(int)instr->rd] = registers[(int)instr->rt] << (registers[(int)instr->rs] & 0x1f);
+	NextInBlock();
+
+opSlt:
+	registers[(int)instr->rd] = registers[(int)instr->rs] < registers[(int)instr->rt];
+	NextInBlock();
+
+opSlti:
+	registers[(int)instr->rt] = registers[(int)instr->rs] < instr->extra;
+	NextInBlock();
+
+opSltiu:
+	rs = registers[(int)instr->rs];
+	imm = instr->extra;
+	registers[(int)instr->rt] = rs < imm;
+	NextInBlock();
+
+opSltu:
+	rs = registers[(int)instr->rs];
+	rt = registers[(int)instr->rt];
+	registers[(int)instr->rd] = rs < rt;
+	NextInBlock();
+
+opSra:
+	registers[(int)instr->rd] = registers[(int)instr->rt] >> instr->extra;
+	NextInBlock();
+
+opSrav:
+	registers[(int)instr->rd] = registers[(int)instr->rt] >> (registers[(int)instr->rs] & 0x1f);
+	NextInBlock();
+
+opSrl:
+	tmp = registers[(int)instr->rt];
+	tmp >>= instr->extra;
+	registers[(int)instr->rd] = tmp;
+	NextInBlock();
+
+opSrlv:
+	tmp = registers[(int)instr->rt];
+	tmp >>= (registers[(int)instr->rs] & 0x1f);
+	registers[(int)instr->rd] = tmp;
+	NextInBlock();
+
+opSub:
+	diff = registers[(int)instr->rs] - registers[(int)instr->rt];
+	if (((registers[(int)instr->rs] ^ registers[(int)instr->rt]) & SIGN_BIT) &&
+		((registers[(int)instr->rs] ^ diff) & SIGN_BIT))
+		goto blockDone; // overflow
+	registers[(int)instr->rd] = diff;
+	NextInBlock();
+
+opSubu:
+	registers[(int)instr->rd] = registers[(int)instr->rs] - registers[(int)instr->rt];
+	NextInBlock();
+
+opSw:
+	tmp = registers[(int)instr->rs] + instr->extra;
+	if ((physAddr = BlockTranslate(tmp, 4, TRUE)) == -1)
+		goto blockDone;
+	*(unsigned int *)&mainMemory[physAddr] =
+		WordToMachine((unsigned int)registers[(int)instr->rt]);
+	NextInBlock();
+
+opXor:
+	registers[(int)instr->rd] = registers[(int)instr->rs] ^ registers[(int)instr->rt];
+	NextInBlock();
+
+opXori:
+	registers[(int)instr->rt] = registers[(int)instr->rs] ^ (instr->extra & 0xffff);
+	NextInBlock();
+
+blockDone:
+	return done;
+}
+
+#undef NextInBlock
+#undef EndOfBlock
+
+//----------------------------------------------------------------------
+// IsBranch
+// 	Is "opCode" a branch or a jump, with a delay slot of its own?
+//----------------------------------------------------------------------
+
+static bool
+IsBranch(int opCode)
+{
+	switch (opCode)
+	{
+	case OP_BEQ:
+	case OP_BGEZ:
+	case OP_BGEZAL:
+	case OP_BGTZ:
+	case OP_BLEZ:
+	case OP_BLTZ:
+	case OP_BLTZAL:
+	case OP_BNE:
+	case OP_J:
+	case OP_JAL:
+	case OP_JALR:
+	case OP_JR:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+//----------------------------------------------------------------------
+// Machine::RunBlocks
+// 	Run blocks one after another, for at most "limit" instructions,
+//	and return how many ran: fewer only if the program got to an
+//	instruction that needs OneInstruction (a system call, say, or
+//	an exception), which is left at the PC.
+//
+//	Unlike Run, this never calls into the kernel, or advances the
+//	time, so the other CPUs of a multiprocessor can run it on threads
+//	of the host (see smp.h).  What RunBlock can't start on, but
+//	OneInstruction would do without the kernel -- an instruction not
+//	decoded yet, or one in a delay slot -- is done right here.
+//----------------------------------------------------------------------
+
+int Machine::RunBlocks(int limit)
+{
+	unsigned int *words = (unsigned int *)mainMemory;
+	Instruction *instr;
+	int done = 0, n, pc, target, physAddr;
+
+	while (done < limit)
+	{
+		if ((n = RunBlock(limit - done)) > 0)
+		{
+			done += n;
+			continue;
+		}
+		pc = registers[PCReg];
+		if ((physAddr = BlockTranslate(pc, 4, FALSE)) == -1)
+			break;
+		instr = &decodeCache[physAddr / 4];
+		if (instr->value != WordToHost(words[physAddr / 4]))
+		{
+			instr->value = WordToHost(words[physAddr / 4]);
+			instr->Decode();
+			continue;
+		}
+		target = registers[NextPCReg];
+		if (target == pc + 4 || IsBranch(instr->opCode))
+			break;
+
+		// in a delay slot: run it as if it weren't, then branch
+		registers[NextPCReg] = pc + 4;
+		if (RunBlock(1) == 0)
+		{
+			registers[NextPCReg] = target;
+			break;
+		}
+		registers[PCReg] = target;
+		registers[NextPCReg] = target + 4;
+		done++;
+	}
+	return done;
+}
+
+//----------------------------------------------------------------------
+// Machine::BlockTranslate
+// 	Translate "virtAddr" the way Translate does, and return the
+//	physical address; return -1 instead if Translate would fail, so
+//	that RunBlock can leave the exception to OneInstruction.
+//
+//	The common case -- a valid page table entry -- is done right
+//	here.
+//----------------------------------------------------------------------
+
+int Machine::BlockTranslate(int virtAddr, int size, bool writing)
+{
+	unsigned int vpn = (unsigned)virtAddr / PageSize;
+	TranslationEntry *entry;
+	int physAddr;
+
+	if (tlb == NULL && (virtAddr & (size - 1)) == 0 && vpn < pageTableSize)
+	{
+		entry = &pageTable[vpn];
+		if (entry->valid && !(writing && entry->readOnly) &&
+			entry->physicalPage < NumPhysPages)
+		{
+			entry->use = TRUE;
+			if (writing)
+				entry->dirty = TRUE;
+			return entry->physicalPage * PageSize + (unsigned)virtAddr % PageSize;
+		}
+	}
+	if (Translate(virtAddr, &physAddr, size, writing) != NoException)
+		return -1;
+	return physAddr;
+}
+
+//----------------------------------------------------------------------
+// Machine::FetchInstruction
+// 	Fetch the instruction at the PC, and return it decoded; return
+//	NULL if an exception was raised instead.
+//
+//	Every word of physical memory has an entry in "decodeCache", with
+//	the value it was last decoded from, so an instruction is decoded
+//	again only if the word at its address has changed since -- which
+//	also means that nothing has to tell the cache when memory is
+//	written, by a program or by the kernel, or when pages are mapped
+//	somewhere else.
+//
+//	With a page table, the PC is translated right here, the way
+//	Translate would; anything out of the ordinary (and any TLB) is
+//	left to Translate.
+//----------------------------------------------------------------------
+
+Instruction *
+Machine::FetchInstruction()
+{
+	int pc = registers[PCReg];
+	unsigned int vpn = (unsigned)pc / PageSize;
+	TranslationEntry *entry;
+	ExceptionType exception;
+	Instruction *instr;
+	unsigned int raw;
+	int physAddr;
+
+	if (tlb == NULL && (pc & 0x3) == 0 && vpn < pageTableSize &&
+		pageTable[vpn].valid && pageTable[vpn].physicalPage < NumPhysPages)
+	{
+		entry = &pageTable[vpn];
+		entry->use = TRUE;
+		physAddr = entry->physicalPage * PageSize + (unsigned)pc % PageSize;
+	}
+	else
+	{
+		exception = Translate(pc, &physAddr, 4, FALSE);
+		if (exception != NoException)
+		{
+			RaiseException(exception, pc);
+			return NULL;
+		}
+	}
+
+	raw = WordToHost(*(unsigned int *)&mainMemory[physAddr]);
+	instr = &decodeCache[physAddr / 4];
+	if (instr->value != raw)
+	{
+		instr->value = raw;
+		instr->Decode();
+	}
+	return instr;
+}
+
 //----------------------------------------------------------------------
 // Machine::DelayedLoad
 // 	Simulate effects of a delayed load.
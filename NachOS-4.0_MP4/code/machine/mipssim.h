@@ -96,6 +96,13 @@
 #define SIGN_BIT	0x80000000
 #define R31		31
 
+/*
+ * Everything below is for decoding and printing instructions, in
+ * mipssim.cc; the code cache only wants the opcodes.
+ */
+
+#ifndef OPCODES_ONLY
+
 /*
  * The table below is used to translate bits 31:26 of the instruction
  * into a value suitable for the "opCode" field of a MemWord structure,
@@ -226,4 +233,6 @@ static struct OpString opStrings[] = {
 	{"Reserved", {NONE, NONE, NONE}}
       };
 
+#endif // OPCODES_ONLY
+
 #endif // MIPSSIM_H
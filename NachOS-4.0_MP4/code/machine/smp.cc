@@ -0,0 +1,223 @@
+// smp.cc
+//	Routines to simulate a shared memory multiprocessor, one thread
+//	of the host per CPU.  See smp.h for how the CPUs and the kernel
+//	take turns.
+//
+//	Only RunJob runs on the other threads of the host: it must never
+//	call into the kernel, or touch anything but its CPU and its job.
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "smp.h"
+#include "synch.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// Multiprocessor::Multiprocessor
+// 	Set up "n" CPUs, each on a thread of the host, except the last,
+//	which the kernel runs on its own thread during a round (it would
+//	only be waiting anyway).
+//
+//	"n" -- how many CPUs
+//	"boot" -- the machine whose memory the CPUs share
+//	"translate" -- if TRUE, run user programs as host instructions
+//----------------------------------------------------------------------
+
+Multiprocessor::Multiprocessor(int n, Machine *boot, bool translate)
+{
+    ASSERT(n > 0 && boot->tlb == NULL);
+    numCPUs = n;
+    waiting = new List<SMPJob *>;
+    jobs = new SMPJob *[numCPUs];
+    finished = NewHostSemaphore(0);
+    quitting = FALSE;
+
+    processors = new Processor[numCPUs];
+    for (int i = 0; i < numCPUs; i++) {
+	processors[i].cpus = this;
+	processors[i].machine = new Machine(boot, translate);
+	processors[i].start = NewHostSemaphore(0);
+	processors[i].job = NULL;
+	processors[i].lastRan = NULL;
+	processors[i].hostThread = NULL;
+    }
+    for (int i = 0; i < numCPUs - 1; i++)
+	processors[i].hostThread = ForkHostThread(CPULoop, &processors[i]);
+}
+
+//----------------------------------------------------------------------
+// Multiprocessor::~Multiprocessor
+// 	Stop the threads of the host, and de-allocate the CPUs.
+//----------------------------------------------------------------------
+
+Multiprocessor::~Multiprocessor()
+{
+    quitting = TRUE;
+    for (int i = 0; i < numCPUs; i++) {
+	if (processors[i].hostThread != NULL) {
+	    HostSemaphoreV(processors[i].start);
+	    JoinHostThread(processors[i].hostThread);
+	}
+	DeleteHostSemaphore(processors[i].start);
+	delete processors[i].machine;
+    }
+    delete [] processors;
+    DeleteHostSemaphore(finished);
+    delete [] jobs;
+    delete waiting;
+}
+
+//----------------------------------------------------------------------
+// Multiprocessor::Run
+// 	Called by Machine::Run, on the thread of a user program: wait for
+//	the program to run on one of the CPUs for a round, and pick up its
+//	registers from there.  Return TRUE if it stopped short, at an
+//	instruction only OneInstruction can do.
+//
+//	The time it ran for is already accounted for, by RunRound.
+//
+//	"machine" -- the machine the kernel runs the thread's program on
+//----------------------------------------------------------------------
+
+bool
+Multiprocessor::Run(Machine *machine)
+{
+    SMPJob job;
+    Semaphore done("CPU", 0);
+
+    bcopy(machine->registers, job.registers, sizeof(job.registers));
+    job.pageTable = machine->pageTable;
+    job.pageTableSize = machine->pageTableSize;
+    job.thread = kernel->currentThread;
+    job.done = &done;
+    job.ran = 0;
+    job.stuck = FALSE;
+
+    kernel->interrupt->setStatus(SystemMode);
+    waiting->Append(&job);
+    done.P();
+    kernel->interrupt->setStatus(UserMode);
+
+    bcopy(job.registers, machine->registers, sizeof(job.registers));
+    return job.stuck;
+}
+
+//----------------------------------------------------------------------
+// Multiprocessor::RunRound
+// 	Called by Interrupt::Idle when no thread is ready to run, and by
+//	Thread::Yield: give the programs waiting a CPU each, as far as
+//	there are CPUs, and run them all until the next interrupt is due,
+//	or for SMPRoundTicks.
+//	Then advance the time, and let their threads run again.
+//
+//	Timer interrupts don't count: the round is the time slice (see
+//	smp.h).
+//
+//	Return FALSE if no program was waiting, or an interrupt is due
+//	already.
+//----------------------------------------------------------------------
+
+bool
+Multiprocessor::RunRound()
+{
+    int now = kernel->stats->totalTicks;
+    int due = kernel->interrupt->NextDue();
+    int numJobs, i, j, most, total;
+
+    if (waiting->IsEmpty() || (due != -1 && due <= now))
+	return FALSE;
+    due = kernel->interrupt->NextDueExcept(TimerInt);
+    limit = divRoundUp(due == -1 ? SMPRoundTicks
+			: min(SMPRoundTicks, due - now), UserTick);
+
+    // a program goes back to the CPU it ran on last, if it's free:
+    // its translated code is still there
+    for (numJobs = 0; numJobs < numCPUs && !waiting->IsEmpty(); numJobs++)
+	jobs[numJobs] = waiting->RemoveFront();
+    for (j = 0; j < numJobs; j++)
+	for (i = 0; i < numCPUs; i++)
+	    if (processors[i].job == NULL &&
+		processors[i].lastRan == jobs[j]->thread) {
+		processors[i].job = jobs[j];
+		jobs[j] = NULL;
+		break;
+	    }
+    for (j = 0, i = 0; j < numJobs; j++)
+	if (jobs[j] != NULL) {
+	    while (processors[i].job != NULL)
+		i++;
+	    processors[i].job = jobs[j];
+	}
+
+    DEBUG(dbgThread, "Round of " << limit << " instructions, on "
+	  << numJobs << " CPUs");
+    for (i = 0; i < numCPUs - 1; i++)
+	if (processors[i].job != NULL)
+	    HostSemaphoreV(processors[i].start);
+    if (processors[numCPUs - 1].job != NULL)
+	RunJob(&processors[numCPUs - 1]);
+    for (i = 0; i < numCPUs - 1; i++)
+	if (processors[i].job != NULL)
+	    HostSemaphoreP(finished);
+
+    // the CPUs ran side by side: the round took as long as the longest
+    most = total = 0;
+    for (i = 0; i < numCPUs; i++)
+	if (processors[i].job != NULL) {
+	    most = max(most, processors[i].job->ran);
+	    total += processors[i].job->ran;
+	    processors[i].job->done->V();
+	    processors[i].job = NULL;
+	}
+    kernel->stats->totalTicks += most * UserTick;
+    kernel->stats->userTicks += total * UserTick;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Multiprocessor::RunJob
+// 	Run the job of "cpu" for the round, on whatever thread of the
+//	host calls this.
+//----------------------------------------------------------------------
+
+void
+Multiprocessor::RunJob(Processor *cpu)
+{
+    Machine *machine = cpu->machine;
+    SMPJob *job = cpu->job;
+
+    bcopy(job->registers, machine->registers, sizeof(job->registers));
+    machine->pageTable = job->pageTable;
+    machine->pageTableSize = job->pageTableSize;
+    job->ran = machine->RunBlocks(limit);
+    job->stuck = (job->ran < limit);
+    bcopy(machine->registers, job->registers, sizeof(job->registers));
+    cpu->lastRan = job->thread;
+}
+
+//----------------------------------------------------------------------
+// Multiprocessor::CPULoop
+// 	What the thread of the host of each other CPU does: run its job
+//	each round, until it's time to stop.
+//
+//	"arg" -- the Processor it runs
+//----------------------------------------------------------------------
+
+void *
+Multiprocessor::CPULoop(void *arg)
+{
+    Processor *cpu = (Processor *)arg;
+
+    for (;;) {
+	HostSemaphoreP(cpu->start);
+	if (cpu->cpus->quitting)
+	    return NULL;
+	cpu->cpus->RunJob(cpu);
+	HostSemaphoreV(cpu->cpus->finished);
+    }
+}
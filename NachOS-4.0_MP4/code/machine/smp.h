@@ -0,0 +1,117 @@
+// smp.h
+//	Data structures to simulate a shared memory multiprocessor.
+//
+//	With "nachos -smp n", user programs run on n CPUs at once, each
+//	simulated on a thread of the host.  The CPUs share main memory
+//	(and so the decoded instructions), but each has registers and
+//	translated code (nachos -dbt) of its own.
+//
+//	The Nachos kernel itself still runs on just one thread of the
+//	host, as if every way into the kernel took the same lock: a CPU
+//	only runs user code, up to something that needs the kernel (a
+//	system call, an exception), and leaves that to the thread the
+//	program belongs to, which does it with OneInstruction as always.
+//
+//	The CPUs run in rounds.  A thread running a user program (in
+//	Machine::Run) puts its registers on a list, and waits.  When no
+//	thread is ready to run, instead of idling until the next interrupt,
+//	or when a thread yields the CPU (so that threads of the kernel
+//	that never wait can't keep the programs from running), the
+//	kernel starts a round: it gives each of the first n programs
+//	waiting a CPU -- the one it ran on last, if it can -- and runs
+//	them all at once, until the next interrupt is due, but for no
+//	more than SMPRoundTicks.  The time then moves on by as much as
+//	the CPU that ran the longest, and the threads are ready again.
+//
+//	The timer doesn't end a round: it would, every TimerTicks, long
+//	before a round got anywhere near SMPRoundTicks.  Rounds are the
+//	time slices instead, and a timer interrupt that fell due during
+//	one happens at its end, with the others.
+//
+//	Since the CPUs all stop at the end of each round, the kernel never
+//	changes a page table, or takes memory back, while a CPU is using
+//	it: there is no need for interrupts between processors.  And what
+//	each CPU runs, and for how long, doesn't depend on how fast the
+//	threads of the host go, so a run is as repeatable as on one CPU.
+//
+//	The CPUs translate addresses through page tables only: there
+//	is no TLB.
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "copyright.h"
+#include "list.h"
+#include "machine.h"
+
+const int SMPRoundTicks = 100000; // the longest a round can go, so that
+				 // programs waiting for a CPU get one
+
+class Thread;
+class Semaphore;
+
+// A user program waiting for a CPU, or running on one
+class SMPJob {
+  public:
+    int registers[NumTotalRegs];	// its CPU registers
+    TranslationEntry *pageTable;	// the page table to run it with
+    unsigned int pageTableSize;
+    Thread *thread;			// the thread it belongs to
+    Semaphore *done;			// the thread waits on this
+    int ran;				// instructions it ran in the round
+    bool stuck;				// stopped short, at something only
+					// OneInstruction can do
+};
+
+class Multiprocessor;
+
+// One of the CPUs, and the thread of the host it runs on
+class Processor {
+  public:
+    Multiprocessor *cpus;
+    Machine *machine;
+    void *hostThread;		// NULL if the kernel's own thread runs it
+    void *start;		// a host semaphore, to start a round
+    SMPJob *job;		// what it runs this round, if anything
+    Thread *lastRan;		// whose program it ran last
+};
+
+// The following class defines the CPUs, and the way the kernel hands
+// user programs out to them.
+class Multiprocessor {
+  public:
+    Multiprocessor(int n, Machine *boot, bool translate);
+				// Simulate "n" CPUs, sharing the memory
+				// of "boot"; if "translate", run user
+				// programs as host code where possible
+    ~Multiprocessor();		// Stop the CPUs
+
+    bool Run(Machine *machine);	// Run the program of the current thread
+				// (in "machine") on one of the CPUs, for
+				// a round; return TRUE if it stopped at
+				// something only OneInstruction can do
+
+    bool RunRound();		// Run the programs waiting for a CPU,
+				// for a round; FALSE if there are none,
+				// or an interrupt is already due
+
+  private:
+    int numCPUs;
+    Processor *processors;	// the last one runs on the kernel's thread
+    List<SMPJob *> *waiting;	// programs waiting for a round
+    SMPJob **jobs;		// the ones taken for this round
+    void *finished;		// a host semaphore, for the end of a round
+    int limit;			// instructions each CPU can run this round
+    bool quitting;		// TRUE when the CPUs are to stop
+
+    static void *CPULoop(void *arg); // what the other CPUs run
+    void RunJob(Processor *cpu);
+};
+
+#endif // SMP_H
@@ -0,0 +1,204 @@
+// tlb.cc
+//	Routines to emulate a set associative, software loaded TLB.
+//
+//	Lookups count as TLB hits in the statistics; refills that have to
+//	throw out an entry count as evictions.  (Misses are counted by
+//	the kernel, which handles them.)
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "tlb.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// TLB::TLB
+// 	Initialize an empty TLB.
+//
+//	"size" -- how many entries it has
+//	"ways" -- how many of them are in each set: "size" for a fully
+//		associative TLB.  At least 2, since one instruction may
+//		need two pages at once (its own, and the one it loads
+//		from or stores to); in a direct mapped TLB, they could
+//		keep throwing each other out forever.
+//	"policy" -- how refills pick the entry to replace
+//----------------------------------------------------------------------
+
+TLB::TLB(int size, int ways, TLBPolicy pol)
+{
+    ASSERT(ways >= 2 && size % ways == 0);
+    numWays = ways;
+    numSets = size / ways;
+    policy = pol;
+    currentASID = 0;
+    now = 0;
+    seed = 1;
+
+    entries = new TranslationEntry[size];
+    asids = new int[size];
+    sources = new TranslationEntry *[size];
+    lastUsed = new unsigned int[size];
+    referenced = new bool[size];
+    hands = new int[numSets];
+    for (int i = 0; i < size; i++) {
+	entries[i].valid = FALSE;
+	sources[i] = NULL;
+	lastUsed[i] = 0;
+	referenced[i] = FALSE;
+    }
+    for (int s = 0; s < numSets; s++)
+	hands[s] = 0;
+}
+
+//----------------------------------------------------------------------
+// TLB::~TLB
+// 	De-allocate the TLB.
+//----------------------------------------------------------------------
+
+TLB::~TLB()
+{
+    delete [] entries;
+    delete [] asids;
+    delete [] sources;
+    delete [] lastUsed;
+    delete [] referenced;
+    delete [] hands;
+}
+
+//----------------------------------------------------------------------
+// TLB::Lookup
+// 	Return the entry for virtual page "vpn" in the current address
+//	space, marking it used; NULL if it isn't in the TLB.
+//----------------------------------------------------------------------
+
+TranslationEntry *
+TLB::Lookup(int vpn)
+{
+    int i = ((unsigned)vpn % numSets) * numWays;
+
+    for (int w = 0; w < numWays; w++, i++)
+	if (entries[i].valid && entries[i].virtualPage == vpn &&
+	    asids[i] == currentASID) {
+	    lastUsed[i] = ++now;
+	    referenced[i] = TRUE;
+	    kernel->stats->numTLBHits++;
+	    return &entries[i];
+	}
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// TLB::Refill
+// 	Load a copy of "pte" for the current address space.  The use and
+//	dirty bits the machine sets in the copy go back to "pte" when
+//	the entry is replaced or flushed; so "pte" must stay where it is
+//	until then (see AddrSpace::~AddrSpace).
+//----------------------------------------------------------------------
+
+void
+TLB::Refill(TranslationEntry *pte)
+{
+    int set = (unsigned)pte->virtualPage % numSets;
+    int i = Victim(set);
+
+    if (entries[i].valid) {
+	DEBUG(dbgAddr, "TLB evicts virtual page " << entries[i].virtualPage
+	      << " of address space " << asids[i]);
+	Drop(i);
+	kernel->stats->numTLBEvictions++;
+    }
+    entries[i] = *pte;
+    asids[i] = currentASID;
+    sources[i] = pte;
+    lastUsed[i] = ++now;
+    referenced[i] = TRUE;
+}
+
+//----------------------------------------------------------------------
+// TLB::Victim
+// 	Return the entry of "set" to replace: a free one if there is one,
+//	and otherwise whichever the policy picks.
+//----------------------------------------------------------------------
+
+int
+TLB::Victim(int set)
+{
+    int first = set * numWays;
+    int i, best;
+
+    for (i = first; i < first + numWays; i++)
+	if (!entries[i].valid)
+	    return i;
+
+    switch (policy) {
+      case TLBLRU:
+	for (best = first, i = first + 1; i < first + numWays; i++)
+	    if (lastUsed[i] < lastUsed[best])
+		best = i;
+	return best;
+
+      case TLBRandom:
+	seed = seed * 1103515245 + 12345;
+	return first + (seed >> 16) % numWays;
+
+      case TLBClock:
+	while (referenced[first + hands[set]]) {
+	    referenced[first + hands[set]] = FALSE;
+	    hands[set] = (hands[set] + 1) % numWays;
+	}
+	i = first + hands[set];
+	hands[set] = (hands[set] + 1) % numWays;
+	return i;
+    }
+    ASSERTNOTREACHED();
+    return first;
+}
+
+//----------------------------------------------------------------------
+// TLB::Drop
+// 	Invalidate entry "i", copying the use and dirty bits the machine
+//	set in it back to the page table entry it came from.
+//----------------------------------------------------------------------
+
+void
+TLB::Drop(int i)
+{
+    if (sources[i] != NULL) {
+	if (entries[i].use)
+	    sources[i]->use = TRUE;
+	if (entries[i].dirty)
+	    sources[i]->dirty = TRUE;
+	sources[i] = NULL;
+    }
+    entries[i].valid = FALSE;
+}
+
+//----------------------------------------------------------------------
+// TLB::FlushASID
+// 	Drop every entry loaded for address space "asid".
+//----------------------------------------------------------------------
+
+void
+TLB::FlushASID(int asid)
+{
+    for (int i = 0; i < numSets * numWays; i++)
+	if (entries[i].valid && asids[i] == asid)
+	    Drop(i);
+}
+
+//----------------------------------------------------------------------
+// TLB::Flush
+// 	Drop every entry.
+//----------------------------------------------------------------------
+
+void
+TLB::Flush()
+{
+    for (int i = 0; i < numSets * numWays; i++)
+	if (entries[i].valid)
+	    Drop(i);
+}
@@ -0,0 +1,90 @@
+// tlb.h
+//	Data structures to emulate a translation lookaside buffer.
+//
+//	The TLB is a cache of page table entries, loaded by software: when
+//	a user program refers to a page that isn't in it, the machine
+//	raises a PageFaultException, and the kernel refills the TLB from
+//	the page table of the running address space, and returns to try
+//	the instruction again.
+//
+//	The TLB is set associative: "size" entries, in sets of "ways"
+//	(a virtual page can only go in set vpn % (size / ways)).  The
+//	entry a refill replaces is picked by the hardware, by one of the
+//	policies below.  Each entry is tagged with the address space
+//	(ASID) it was loaded for, so that a context switch only has to
+//	change the current ASID, not flush the TLB.
+//
+//  DO NOT CHANGE -- part of the machine emulation
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef TLB_MODEL_H
+#define TLB_MODEL_H
+
+#include "copyright.h"
+#include "utility.h"
+#include "translate.h"
+
+// How a refill picks the entry to replace, in a set with no free one
+enum TLBPolicy { TLBLRU,	// the one least recently used
+		 TLBRandom,	// any of them
+		 TLBClock	// the next one not used since the
+				// hand last went past it
+};
+
+const int NumASIDs = 64; // address space tags, as on the MIPS R3000
+
+// The following class defines the TLB hardware.
+class TLB {
+  public:
+    TLB(int size, int ways, TLBPolicy policy);
+				// Initialize a TLB of "size" entries, in
+				// sets of "ways" (at least 2, and
+				// dividing "size")
+    ~TLB();
+
+    TranslationEntry *Lookup(int vpn);
+				// Return the entry for virtual page "vpn" of
+				// the current address space; NULL if there
+				// is none (a TLB miss)
+
+    void Refill(TranslationEntry *pte);
+				// Load page table entry "pte", for the
+				// current address space, in place of
+				// whatever entry the policy picks
+
+    void SetASID(int asid) { currentASID = asid; }
+				// Switch to another address space
+
+    void FlushASID(int asid);	// Drop the entries of address space "asid"
+    void Flush();		// Drop every entry
+
+    int Size() { return numSets * numWays; }
+
+  private:
+    TranslationEntry *entries;	// set s is entries[s*numWays] on
+    int *asids;			// the address space each entry is for
+    TranslationEntry **sources;	// the page table entry each one was
+				// loaded from, to copy the use and
+				// dirty bits back to when it goes
+    unsigned int *lastUsed;	// when each one was last used (for LRU)
+    bool *referenced;		// used since the clock hand last went
+				// past it (for clock)
+    int *hands;			// clock hand of each set
+
+    int numSets, numWays;
+    TLBPolicy policy;
+    int currentASID;
+    unsigned int now;		// counts lookups, for LRU
+    unsigned int seed;		// for random replacement; separate from
+				// RandomNumber, so that a TLB doesn't
+				// change "nachos -rs" time slicing
+
+    int Victim(int set);	// pick the entry to replace in "set"
+    void Drop(int i);		// invalidate entry "i", copying its
+				// use and dirty bits back
+};
+
+#endif // TLB_MODEL_H
@@ -12,7 +12,7 @@
 //	Translation lookaside buffer -- associative lookup in the table
 //	to find an entry with the same virtual page #.  If found,
 //	this entry is used for the translation.
-//	If not, it traps to software with an exception.
+//	If not, it traps to software with an exception.  (See tlb.h.)
 //
 //	In practice, the TLB is much smaller than the amount of physical
 //	memory (16 entries is common on a machine that has 1000's of
@@ -78,6 +78,10 @@ ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
 //   	Returns FALSE if the translation step from virtual to physical memory
 //   	failed.
 //
+//	If the page is in the memory cache (see translate.h), and the
+//	address is aligned, the page table and TLB aren't looked at: the
+//	use bit was set when the translation was cached.
+//
 //	"addr" -- the virtual address to read from
 //	"size" -- the number of bytes to read (1, 2, or 4)
 //	"value" -- the place to write the result
@@ -88,29 +92,40 @@ bool Machine::ReadMem(int addr, int size, int *value)
 	int data;
 	ExceptionType exception;
 	int physicalAddress;
+	MemCacheEntry *cached;
+	char *where;
 
-	DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
-
-	exception = Translate(addr, &physicalAddress, size, FALSE);
-	if (exception != NoException)
+	cached = &memCache[((unsigned)addr / PageSize) % MemCacheSize];
+	if (cached->virtualPage == (int)((unsigned)addr / PageSize) &&
+		(addr & (size - 1)) == 0)
+		where = cached->page + (unsigned)addr % PageSize;
+	else
 	{
-		RaiseException(exception, addr);
-		return FALSE;
+		DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
+
+		exception = Translate(addr, &physicalAddress, size, FALSE);
+		if (exception != NoException)
+		{
+			RaiseException(exception, addr);
+			return FALSE;
+		}
+		FillMemCache(addr, physicalAddress, FALSE);
+		where = &mainMemory[physicalAddress];
 	}
 	switch (size)
 	{
 	case 1:
-		data = mainMemory[physicalAddress];
+		data = *where;
 		*value = data;
 		break;
 
 	case 2:
-		data = *(unsigned short *)&mainMemory[physicalAddress];
+		data = *(unsigned short *)where;
 		*value = ShortToHost(data);
 		break;
 
 	case 4:
-		data = *(unsigned int *)&mainMemory[physicalAddress];
+		data = *(unsigned int *)where;
 		*value = WordToHost(data);
 		break;
 
@@ -130,6 +145,10 @@ bool Machine::ReadMem(int addr, int size, int *value)
 //   	Returns FALSE if the translation step from virtual to physical memory
 //   	failed.
 //
+//	As with ReadMem, an aligned write to a page in the memory cache
+//	goes straight to memory -- but only once the page has been
+//	written through Translate, which sets its dirty bit.
+//
 //	"addr" -- the virtual address to write to
 //	"size" -- the number of bytes to be written (1, 2, or 4)
 //	"value" -- the data to be written
@@ -139,27 +158,38 @@ bool Machine::WriteMem(int addr, int size, int value)
 {
 	ExceptionType exception;
 	int physicalAddress;
+	MemCacheEntry *cached;
+	char *where;
 
-	DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
-
-	exception = Translate(addr, &physicalAddress, size, TRUE);
-	if (exception != NoException)
+	cached = &memCache[((unsigned)addr / PageSize) % MemCacheSize];
+	if (cached->virtualPage == (int)((unsigned)addr / PageSize) &&
+		cached->writable && (addr & (size - 1)) == 0)
+		where = cached->page + (unsigned)addr % PageSize;
+	else
 	{
-		RaiseException(exception, addr);
-		return FALSE;
+		DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
+
+		exception = Translate(addr, &physicalAddress, size, TRUE);
+		if (exception != NoException)
+		{
+			RaiseException(exception, addr);
+			return FALSE;
+		}
+		FillMemCache(addr, physicalAddress, TRUE);
+		where = &mainMemory[physicalAddress];
 	}
 	switch (size)
 	{
 	case 1:
-		mainMemory[physicalAddress] = (unsigned char)(value & 0xff);
+		*where = (unsigned char)(value & 0xff);
 		break;
 
 	case 2:
-		*(unsigned short *)&mainMemory[physicalAddress] = ShortToMachine((unsigned short)(value & 0xffff));
+		*(unsigned short *)where = ShortToMachine((unsigned short)(value & 0xffff));
 		break;
 
 	case 4:
-		*(unsigned int *)&mainMemory[physicalAddress] = WordToMachine((unsigned int)value);
+		*(unsigned int *)where = WordToMachine((unsigned int)value);
 		break;
 
 	default:
@@ -169,6 +199,44 @@ bool Machine::WriteMem(int addr, int size, int value)
 	return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Machine::FillMemCache
+// 	Keep the translation of "virtAddr" to "physAddr", which Translate
+//	has just made, for reading the page -- and for writing it, if
+//	"writing".  Nothing is kept while addresses are being traced,
+//	so that every access is still printed, nor with a TLB, which has
+//	to see every access to count its hits and keep its replacement
+//	policy honest.
+//----------------------------------------------------------------------
+
+void Machine::FillMemCache(int virtAddr, int physAddr, bool writing)
+{
+	int vpn = (unsigned)virtAddr / PageSize;
+	MemCacheEntry *cached = &memCache[vpn % MemCacheSize];
+
+	if (tlb != NULL || debug->IsEnabled(dbgAddr))
+		return;
+	if (cached->virtualPage != vpn)
+	{
+		cached->virtualPage = vpn;
+		cached->writable = FALSE;
+	}
+	cached->page = &mainMemory[physAddr - physAddr % PageSize];
+	if (writing)
+		cached->writable = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::FlushMemCache
+// 	Forget every translation kept by FillMemCache.
+//----------------------------------------------------------------------
+
+void Machine::FlushMemCache()
+{
+	for (int i = 0; i < MemCacheSize; i++)
+		memCache[i].virtualPage = -1;
+}
+
 //----------------------------------------------------------------------
 // Machine::Translate
 // 	Translate a virtual address into a physical address, using
@@ -187,7 +255,6 @@ bool Machine::WriteMem(int addr, int size, int value)
 ExceptionType
 Machine::Translate(int virtAddr, int *physAddr, int size, bool writing)
 {
-	int i;
 	unsigned int vpn, offset;
 	TranslationEntry *entry;
 	unsigned int pageFrame;
@@ -225,12 +292,7 @@ Machine::Translate(int virtAddr, int *physAddr, int size, bool writing)
 	}
 	else
 	{
-		for (entry = NULL, i = 0; i < TLBSize; i++)
-			if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn)))
-			{
-				entry = &tlb[i]; // FOUND!
-				break;
-			}
+		entry = tlb->Lookup(vpn);
 		if (entry == NULL)
 		{ // not found
 			DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
@@ -42,4 +42,18 @@ class TranslationEntry {
 			// page is modified.
 };
 
+// The machine also keeps a few of the translations it has made, from
+// virtual page # straight to where the page is in "mainMemory", so that
+// most reads and writes of memory need not go through Translate.  The
+// kernel must flush them (Machine::FlushMemCache) when it changes the
+// page table or the TLB.
+
+class MemCacheEntry {
+  public:
+    int virtualPage;	// -1 if the entry is empty
+    char *page;		// where the page is, in "mainMemory"
+    bool writable;	// if set, the page may be written without
+			// Translate: its dirty bit is already set
+};
+
 #endif
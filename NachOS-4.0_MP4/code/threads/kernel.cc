@@ -15,8 +15,12 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#ifndef FILESYS_STUB
+#include "filehdr.h"
+#endif
 #include "post.h"
 #include "synchconsole.h"
+#include "smp.h"
 
 //----------------------------------------------------------------------
 // Kernel::Kernel
@@ -28,14 +32,22 @@ Kernel::Kernel(int argc, char **argv)
 {
     randomSlice = FALSE; 
     debugUserProg = FALSE;
+    translateUserProg = FALSE;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
+    consoleBuffer = 1;         // default is a character at a time
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
 #endif
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
+    diskPolicy = DiskCLOOK;     // disk request scheduling
+    mapDisk = TRUE;             // rather than pread/pwrite per request
+    tlbSize = 0;                // no TLB: use page tables
+    tlbWays = 1;
+    tlbPolicy = TLBLRU;
+    numCPUs = 1;
 								
 	// MP4 mod tag
 	execfileNum = 0; // dummy operation to keep valgrind happy
@@ -49,6 +61,8 @@ Kernel::Kernel(int argc, char **argv)
 	    	i++;
         } else if (strcmp(argv[i], "-s") == 0) {
             debugUserProg = TRUE;
+        } else if (strcmp(argv[i], "-dbt") == 0) {
+            translateUserProg = TRUE;
 		} else if (strcmp(argv[i], "-e") == 0) {
         	execfile[++execfileNum]= argv[++i];
 			cout << execfile[execfileNum] << "\n";
@@ -60,6 +74,11 @@ Kernel::Kernel(int argc, char **argv)
 	    	ASSERT(i + 1 < argc);
 	    	consoleOut = argv[i + 1];
 	    	i++;
+		} else if (strcmp(argv[i], "-cb") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	consoleBuffer = atoi(argv[i + 1]);
+	    	ASSERT(consoleBuffer > 0);
+	    	i++;
 #ifndef FILESYS_STUB
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
@@ -72,14 +91,57 @@ Kernel::Kernel(int argc, char **argv)
             ASSERT(i + 1 < argc);   // next argument is int
             hostName = atoi(argv[i + 1]);
             i++;
+        } else if (strcmp(argv[i], "-ds") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a policy name
+            if (strcmp(argv[i + 1], "fifo") == 0) {
+                diskPolicy = DiskFIFO;
+            } else if (strcmp(argv[i + 1], "sstf") == 0) {
+                diskPolicy = DiskSSTF;
+            } else {
+                ASSERT(strcmp(argv[i + 1], "clook") == 0);
+                diskPolicy = DiskCLOOK;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-dio") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is "mmap" or "pread"
+            if (strcmp(argv[i + 1], "pread") == 0) {
+                mapDisk = FALSE;
+            } else {
+                ASSERT(strcmp(argv[i + 1], "mmap") == 0);
+                mapDisk = TRUE;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-tlb") == 0) {
+            ASSERT(i + 3 < argc);   // entries, ways, and a policy name
+            tlbSize = atoi(argv[i + 1]);
+            tlbWays = atoi(argv[i + 2]);
+            if (strcmp(argv[i + 3], "random") == 0) {
+                tlbPolicy = TLBRandom;
+            } else if (strcmp(argv[i + 3], "clock") == 0) {
+                tlbPolicy = TLBClock;
+            } else {
+                ASSERT(strcmp(argv[i + 3], "lru") == 0);
+                tlbPolicy = TLBLRU;
+            }
+            i += 3;
+        } else if (strcmp(argv[i], "-smp") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            numCPUs = atoi(argv[i + 1]);
+            ASSERT(numCPUs > 0);
+            i++;
         } else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-rs randomSeed]\n";
 	   		cout << "Partial usage: nachos [-s]\n";
-            cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
+            cout << "Partial usage: nachos [-dbt]\n";
+            cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut] [-cb #]\n";
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
 #endif
             cout << "Partial usage: nachos [-n #] [-m #]\n";
+            cout << "Partial usage: nachos [-ds fifo|sstf|clook]\n";
+            cout << "Partial usage: nachos [-dio mmap|pread]\n";
+            cout << "Partial usage: nachos [-tlb entries ways lru|random|clock]\n";
+            cout << "Partial usage: nachos [-smp #]\n";
 		}
     }
 }
@@ -106,13 +168,23 @@ Kernel::Initialize()
     interrupt = new Interrupt;		// start up interrupt handling
     scheduler = new Scheduler();	// initialize the ready queue
     alarm = new Alarm(randomSlice);	// start up time slicing
-    machine = new Machine(debugUserProg);
-    synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
-    synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    machine = new Machine(debugUserProg, translateUserProg,
+                          tlbSize > 0 ? new TLB(tlbSize, tlbWays,
+                                                (TLBPolicy)tlbPolicy) : NULL);
+    cpus = NULL;
+    if (numCPUs > 1) {
+        if (tlbSize > 0 || debugUserProg)
+            cerr << "-smp works with neither -tlb nor -s: using one CPU\n";
+        else
+            cpus = new Multiprocessor(numCPUs, machine, translateUserProg);
+    }
+    synchConsoleIn = new SynchConsoleInput(consoleIn, consoleBuffer);
+    synchConsoleOut = new SynchConsoleOutput(consoleOut, consoleBuffer);
+    synchDisk = new SynchDisk((DiskSchedPolicy)diskPolicy, mapDisk);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
+    openFileTable = new OpenFileTable();
     fileSystem = new FileSystem(formatFlag);
 #endif // FILESYS_STUB
 
@@ -150,11 +222,16 @@ Kernel::~Kernel()
     delete interrupt;
     delete scheduler;
     delete alarm;
+    if (cpus != NULL)
+        delete cpus;
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
     delete fileSystem;
+    delete synchDisk;
+#ifndef FILESYS_STUB
+    delete openFileTable;
+#endif
 	
 	// Mp4 mod tag
 	/*
@@ -192,6 +269,231 @@ Kernel::ThreadSelfTest() {
 
 }
 
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// Kernel::DiskSchedTest
+//      Measure each disk scheduling policy.  A few files are laid out
+//	one after another on disk, then read concurrently by one thread
+//	each, a few sectors at a time, so that the disk queue always
+//	holds requests far apart from each other.  Report the time the
+//	head spent seeking, and the total time, under each policy.
+//----------------------------------------------------------------------
+
+static const int BenchFiles = 4;
+static const int BenchFileSize = 32 * 1024;
+static const int BenchChunk = 4 * SectorSize;
+static Semaphore *benchDone;
+
+static void
+BenchReader(void *arg)
+{
+    OpenFile *file = (OpenFile *)arg;
+    char buffer[BenchChunk];
+
+    while (file->Read(buffer, BenchChunk) > 0)
+        ;
+    benchDone->V();
+}
+
+void
+Kernel::DiskSchedTest() {
+    static char *readerNames[BenchFiles] =
+        { "bench 0", "bench 1", "bench 2", "bench 3" };
+    static char *policyNames[] = { "FIFO", "SSTF", "C-LOOK" };
+    static int forkOrder[BenchFiles] = { 2, 0, 3, 1 };
+    DiskSchedPolicy oldPolicy = synchDisk->GetPolicy();
+    OpenFile *files[BenchFiles];
+    char name[16], data[BenchChunk];
+    int firstID = threadNum;
+    int i, j, p, startTicks, startSeek;
+
+    threadNum += BenchFiles;
+    for (j = 0; j < BenchChunk; j++)
+        data[j] = 'a' + j % 26;
+    for (i = 0; i < BenchFiles; i++) {
+        sprintf(name, "/bench%d", i);
+        ASSERT(fileSystem->Create(name, BenchFileSize));
+        files[i] = fileSystem->Open(name);
+        ASSERT(files[i] != NULL);
+        for (j = 0; j < BenchFileSize; j += BenchChunk)
+            files[i]->Write(data, BenchChunk);
+        delete files[i];
+    }
+
+    benchDone = new Semaphore("bench done", 0);
+    for (p = DiskFIFO; p <= DiskCLOOK; p++) {
+        synchDisk->SetPolicy((DiskSchedPolicy)p);
+        startTicks = stats->totalTicks;
+        startSeek = stats->diskSeekTicks;
+        for (i = 0; i < BenchFiles; i++) {
+            sprintf(name, "/bench%d", i);   // fresh read-ahead state
+            files[i] = fileSystem->Open(name);
+        }
+        for (j = 0; j < BenchFiles; j++) {
+            i = forkOrder[j];       // requests arrive out of disk order
+            Thread *reader = new Thread(readerNames[i], firstID + i);
+            reader->Fork((VoidFunctionPtr) BenchReader, (void *)files[i]);
+        }
+        for (i = 0; i < BenchFiles; i++)
+            benchDone->P();
+        for (i = 0; i < BenchFiles; i++)
+            delete files[i];
+        cout << policyNames[p] << ": seek ticks "
+             << stats->diskSeekTicks - startSeek << ", total ticks "
+             << stats->totalTicks - startTicks << "\n";
+    }
+    delete benchDone;
+    synchDisk->SetPolicy(oldPolicy);
+
+    for (i = 0; i < BenchFiles; i++) {
+        sprintf(name, "/bench%d", i);
+        fileSystem->Remove(name, FALSE);
+    }
+}
+
+//----------------------------------------------------------------------
+// Kernel::FileConcurrencyTest
+//      Measure aggregate file system throughput with 1, 2, 4 and 8
+//	threads.  Each thread makes its own directory and file, writes
+//	the file a chunk at a time, reads it back and checks it, and
+//	removes the directory again.  Independent files take different
+//	locks, so their disk requests should overlap in the disk queue.
+//----------------------------------------------------------------------
+
+static const int ConcurrentMax = 8;
+static const int ConcurrentFileSize = 16 * 1024;
+static const int ConcurrentChunk = 8 * SectorSize;
+static Semaphore *concurrentDone;
+
+static void
+ConcurrentWorker(void *arg)
+{
+    int which = (int)(long)arg;
+    FileSystem *fileSystem = kernel->fileSystem;
+    OpenFile *file;
+    char dirName[16], name[24];
+    char data[ConcurrentChunk], check[ConcurrentChunk];
+    int i, j;
+
+    sprintf(dirName, "/ft%d", which);
+    sprintf(name, "%s/data", dirName);
+    ASSERT(fileSystem->CreateDirectory(dirName));
+    ASSERT(fileSystem->Create(name, 0));
+    file = fileSystem->Open(name);
+    ASSERT(file != NULL);
+    for (i = 0; i < ConcurrentFileSize; i += ConcurrentChunk) {
+        for (j = 0; j < ConcurrentChunk; j++)
+            data[j] = 'a' + (which + i / ConcurrentChunk + j) % 26;
+        ASSERT(file->Write(data, ConcurrentChunk) == ConcurrentChunk);
+    }
+    delete file;                // flushes the delayed data
+
+    file = fileSystem->Open(name);
+    ASSERT(file != NULL);
+    ASSERT(file->Length() == ConcurrentFileSize);
+    for (i = 0; i < ConcurrentFileSize; i += ConcurrentChunk) {
+        ASSERT(file->Read(check, ConcurrentChunk) == ConcurrentChunk);
+        for (j = 0; j < ConcurrentChunk; j++)
+            ASSERT(check[j] == 'a' + (which + i / ConcurrentChunk + j) % 26);
+    }
+    delete file;
+
+    ASSERT(fileSystem->Remove(dirName, TRUE));
+    concurrentDone->V();
+}
+
+void
+Kernel::FileConcurrencyTest() {
+    static char *workerNames[ConcurrentMax] =
+        { "worker 0", "worker 1", "worker 2", "worker 3",
+          "worker 4", "worker 5", "worker 6", "worker 7" };
+    int firstID = threadNum;
+    int n, i, startTicks, ticks, bytes;
+
+    threadNum += ConcurrentMax;
+    concurrentDone = new Semaphore("concurrency test done", 0);
+    for (n = 1; n <= ConcurrentMax; n *= 2) {
+        startTicks = stats->totalTicks;
+        for (i = 0; i < n; i++) {
+            Thread *worker = new Thread(workerNames[i], firstID + i);
+            worker->Fork((VoidFunctionPtr) ConcurrentWorker, (void *)(long)i);
+        }
+        for (i = 0; i < n; i++)
+            concurrentDone->P();
+        ticks = stats->totalTicks - startTicks;
+        bytes = 2 * n * ConcurrentFileSize;     // written, then read
+        cout << n << " threads: " << bytes << " bytes in " << ticks
+             << " ticks, " << (bytes * 1000.0) / ticks
+             << " bytes per 1000 ticks\n";
+    }
+    delete concurrentDone;
+}
+
+//----------------------------------------------------------------------
+// Kernel::DiskFullTest
+//      Grow a one-sector file to MaxFileSize3 bytes, with one free
+//	sector too few, then with exactly as many as that takes: its
+//	data, and its sub-headers at both levels, the first one pushed
+//	down from the file header.  The disk is filled up to that point
+//	with one big file, then with empty ones, one sector each.  The
+//	first attempt must fail and change nothing, the second must
+//	leave the disk full, and the bitmap must agree with the files.
+//----------------------------------------------------------------------
+
+static const int FullPadMax = 64;
+
+void
+Kernel::DiskFullTest() {
+    int needed = divRoundUp(MaxFileSize3, SectorSize) - 1 +
+                 NumDirect + NumDirect * NumDirect;
+    OpenFile *file;
+    char name[16];
+    int pads, sectors;
+
+    ASSERT(fileSystem->Create("/grow", SectorSize));
+    file = fileSystem->Open("/grow");
+    ASSERT(file != NULL);
+    ASSERT(file->getHdr()->ExtendNeeds(MaxFileSize3) == needed);
+
+    // leave a few sectors over for the empty files to take up: the
+    // big one needs a header, and sub-headers of its own
+    sectors = fileSystem->FreeSectors() - needed - 4;
+    while (sectors + 1 + FileHeader::SubHeaders(sectors * SectorSize) >
+           fileSystem->FreeSectors() - needed - 4)
+        sectors--;
+    ASSERT(fileSystem->Create("/ballast", sectors * SectorSize));
+    for (pads = 0; fileSystem->FreeSectors() > needed - 1; pads++) {
+        ASSERT(pads < FullPadMax);
+        sprintf(name, "/pad%d", pads);
+        ASSERT(fileSystem->Create(name, 0));
+    }
+    ASSERT(fileSystem->FreeSectors() == needed - 1);
+
+    ASSERT(!fileSystem->Reserve(file, MaxFileSize3));
+    ASSERT(!fileSystem->ExtendFile(file, MaxFileSize3));
+    ASSERT(fileSystem->FreeSectors() == needed - 1);
+    ASSERT(file->Length() == SectorSize);
+
+    ASSERT(fileSystem->Remove("/pad0", FALSE));
+    ASSERT(fileSystem->FreeSectors() == needed);
+    ASSERT(fileSystem->ExtendFile(file, MaxFileSize3));
+    ASSERT(fileSystem->FreeSectors() == 0);
+    ASSERT(file->Length() == MaxFileSize3);
+    delete file;
+    ASSERT(fileSystem->Check(FALSE));
+    cout << "grew a file to " << MaxFileSize3 << " bytes with exactly "
+         << needed << " sectors free\n";
+
+    ASSERT(fileSystem->Remove("/grow", FALSE));
+    ASSERT(fileSystem->Remove("/ballast", FALSE));
+    while (--pads > 0) {
+        sprintf(name, "/pad%d", pads);
+        ASSERT(fileSystem->Remove(name, FALSE));
+    }
+    ASSERT(fileSystem->Check(FALSE));
+}
+#endif // FILESYS_STUB
+
 //----------------------------------------------------------------------
 // Kernel::ConsoleTest
 //      Test the synchconsole
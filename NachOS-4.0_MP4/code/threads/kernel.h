@@ -24,6 +24,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class Multiprocessor;
 
 
 
@@ -46,6 +47,11 @@ class Kernel {
 	
     void ConsoleTest();         // interactive console self test
     void NetworkTest();         // interactive 2-machine network test
+#ifndef FILESYS_STUB
+    void DiskSchedTest();       // compare disk scheduling policies
+    void FileConcurrencyTest(); // file system throughput, many threads
+    void DiskFullTest();        // grow a file on an exactly full disk
+#endif
 	Thread* getThread(int threadID){return t[threadID];}    
 
 	#ifdef FILESYS_STUB	
@@ -61,9 +67,14 @@ class Kernel {
     Statistics *stats;		// performance metrics
     Alarm *alarm;		// the software alarm clock    
     Machine *machine;           // the simulated CPU
+    Multiprocessor *cpus;       // the CPUs user programs run on, if
+                                // more than one (-smp); else NULL
     SynchConsoleInput *synchConsoleIn;
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
+#ifndef FILESYS_STUB
+    OpenFileTable *openFileTable; // in-core headers of open files
+#endif
     FileSystem *fileSystem;     
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
@@ -78,12 +89,19 @@ class Kernel {
 	int threadNum;
     bool randomSlice;		// enable pseudo-random time slicing
     bool debugUserProg;         // single step user program
+    bool translateUserProg;     // run user code as host code (-dbt)
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
+    int consoleBuffer;          // characters per console interrupt
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
 #endif
+    int diskPolicy;             // a DiskSchedPolicy (see synchdisk.h)
+    bool mapDisk;               // map the disk's UNIX file into memory
+    int tlbSize, tlbWays;       // the TLB to simulate, if tlbSize > 0
+    int tlbPolicy;              // a TLBPolicy (see machine/tlb.h)
+    int numCPUs;                // CPUs to run user programs on
 };
 
 
@@ -3,9 +3,11 @@
 //	operating system kernel.
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
-//              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
+//              -s -dbt -tlb <entries> <ways> <policy> -smp <#>
+//              -x <nachos file> -ci <consoleIn> -co <consoleOut> -cb <#>
 //              -f -cp <unix file> <nachos file>
-//              -p <nachos file> -r <nachos file> -l -D
+//              -p <nachos file> -r <nachos file> -l -D -B -FT -DF
+//              -dio mmap|pread
 //              -n <network reliability> -m <machine id>
 //              -z -K -C -N
 //
@@ -13,9 +15,17 @@
 //    -rs causes Yield to occur at random (but repeatable) spots
 //    -z prints the copyright message
 //    -s causes user programs to be executed in single-step mode
+//    -dbt translates user code that runs often into host instructions
+//       (see machine/codecache.h)
+//    -tlb <entries> <ways> lru|random|clock translates user addresses
+//       through a TLB instead of page tables (see machine/tlb.h)
+//    -smp runs user programs on # CPUs at once, each on a thread of
+//       the host (see machine/smp.h)
 //    -x runs a user program
 //    -ci specify file for console input (stdin is the default)
 //    -co specify file for console output (stdout is the default)
+//    -cb lets the console move up to # characters per interrupt
+//       (1 is the default; see machine/console.h)
 //    -n sets the network reliability
 //    -m sets this machine's host id (needed for the network)
 //    -K run a simple self test of kernel threads and synchronization
@@ -24,11 +34,23 @@
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
-//    -cp copies a file from UNIX to Nachos
+//    -cp copies a file, or a whole directory tree, from UNIX to Nachos
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system
+//    -layout reports how fragmented each file is, and what it costs
+//    -defrag moves fragmented files into contiguous runs
+//    -fsck checks the bitmap against the files on disk; "-fsck -repair"
+//       also fixes what it can (see FileSystem::Check)
+//    -B compares the disk scheduling policies (see Kernel::DiskSchedTest);
+//       the policy itself is chosen with -ds fifo|sstf|clook
+//    -FT measures file system throughput with several threads at once
+//       (see Kernel::FileConcurrencyTest)
+//    -DF fills the disk up, and checks a file can grow into exactly
+//       the room that is left (see Kernel::DiskFullTest)
+//    -dio pread reads and writes the disk's UNIX file for each request,
+//       instead of mapping it into memory (-dio mmap, the default)
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -44,6 +66,7 @@
 #include "main.h"
 #include "filesys.h"
 #include "openfile.h"
+#include "disk.h"
 #include "sysdep.h"
 
 // global variables
@@ -63,23 +86,35 @@ Cleanup(int x)
 }
 
 //-------------------------------------------------------------------
-// Constant used by "Copy" and "Print"
-//   It is the number of bytes read from the Unix file (for Copy)
-//   or the Nachos file (for Print) by each read operation
+// Constant used by "Print"
+//   It is the number of bytes read from the Nachos file by each
+//   read operation
 //-------------------------------------------------------------------
 static const int TransferSize = 128;
 
 #ifndef FILESYS_STUB
+//-------------------------------------------------------------------
+// Constant used by "Copy"
+//   The host file is written into Nachos this many bytes at a time:
+//   whole tracks, so that each chunk goes to disk as one multi-sector
+//   transfer
+//-------------------------------------------------------------------
+static const int ImportSize = 8 * SectorsPerTrack * SectorSize;
+
 //----------------------------------------------------------------------
-// Copy
-//      Copy the contents of the UNIX file "from" to the Nachos file "to"
+// CopyFile
+//      Copy the contents of the UNIX file "from" to the Nachos file "to".
+//	The length of the file is known up front, so all of its space is
+//	allocated at once, as one run of sectors, before any data is
+//	written; the data then goes straight to its sectors, a chunk of
+//	ImportSize bytes at a time.
 //----------------------------------------------------------------------
 
-static void Copy(char *from, char *to)
+static void CopyFile(char *from, char *to)
 {
     int fd;
     OpenFile *openFile;
-    int amountRead, fileLength;
+    int amount, fileLength, position;
     char *buffer;
 
     // Open UNIX file
@@ -94,32 +129,34 @@ static void Copy(char *from, char *to)
     fileLength = Tell(fd);
     Lseek(fd, 0, 0);
 
-    // TODO
-    // Create a Nachos file of the same length
-    char temp[260] = { '/0' };
-    strcpy(temp, to); // Because "to" will be modified during the Create function
-
-
-    // Create a Nachos file of the same length
+    // Create the Nachos file, and give it all its space
     DEBUG('f', "Copying file " << from << " of size " << fileLength << " to file " << to);
-    if (!kernel->fileSystem->Create(to, fileLength))
+    if (!kernel->fileSystem->Create(to, 0))
     { // Create Nachos file
         printf("Copy: couldn't create output file %s\n", to);
         Close(fd);
         return;
     }
 
-    // TODO
-    strcpy(to, temp);
-
-
     openFile = kernel->fileSystem->Open(to);
     ASSERT(openFile != NULL);
+    if (!kernel->fileSystem->ExtendFile(openFile, fileLength))
+    {
+        printf("Copy: not enough space for %s\n", to);
+        delete openFile;
+        kernel->fileSystem->Remove(to, FALSE);
+        Close(fd);
+        return;
+    }
 
-    // Copy the data in TransferSize chunks
-    buffer = new char[TransferSize];
-    while ((amountRead = ReadPartial(fd, buffer, sizeof(char) * TransferSize)) > 0)
-        openFile->Write(buffer, amountRead);
+    // Copy the data in ImportSize chunks
+    buffer = new char[ImportSize];
+    for (position = 0; position < fileLength; position += amount)
+    {
+        amount = min(ImportSize, fileLength - position);
+        Read(fd, buffer, amount);
+        openFile->WriteAt(buffer, amount, position);
+    }
     delete[] buffer;
 
     // Close the UNIX and the Nachos files
@@ -127,6 +164,46 @@ static void Copy(char *from, char *to)
     Close(fd);
 }
 
+//----------------------------------------------------------------------
+// Copy
+//      Copy the UNIX file "from" to the Nachos file "to".  If "from" is
+//	a directory, copy the whole tree under it: "to" is made a Nachos
+//	directory, and everything in "from" is copied into it.
+//----------------------------------------------------------------------
+
+static void Copy(char *from, char *to)
+{
+    char fromChild[MaxPathLen], toChild[MaxPathLen];
+    char *name;
+    void *dir;
+
+    if (!IsDirectory(from))
+    {
+        CopyFile(from, to);
+        return;
+    }
+    if ((dir = OpenDirectory(from)) == NULL)
+    {
+        printf("Copy: couldn't open input directory %s\n", from);
+        return;
+    }
+    DEBUG('f', "Copying directory " << from << " to " << to);
+    kernel->fileSystem->CreateDirectory(to); // fine if it is there already
+    while ((name = ReadDirectory(dir)) != NULL)
+    {
+        if (strlen(from) + strlen(name) + 2 > MaxPathLen ||
+            strlen(to) + strlen(name) + 2 > MaxPathLen)
+        {
+            printf("Copy: path too long, skipping %s/%s\n", from, name);
+            continue;
+        }
+        sprintf(fromChild, "%s/%s", from, name);
+        sprintf(toChild, "%s/%s", strcmp(to, "/") == 0 ? "" : to, name);
+        Copy(fromChild, toChild);
+    }
+    CloseDirectory(dir);
+}
+
 #endif // FILESYS_STUB
 
 //----------------------------------------------------------------------
@@ -203,6 +280,13 @@ int main(int argc, char **argv)
     bool mkdirFlag = false;
     bool recursiveListFlag = false;
     bool recursiveRemoveFlag = false;
+    bool diskSchedTestFlag = false;
+    bool fileConcurrencyTestFlag = false;
+    bool diskFullTestFlag = false;
+    bool layoutFlag = false;
+    bool checkFlag = false;
+    bool repairFlag = false;
+    bool defragFlag = false;
 #endif //FILESYS_STUB
 
     // some command line arguments are handled here.
@@ -296,6 +380,35 @@ int main(int argc, char **argv)
         {
             dumpFlag = true;
         }
+        else if (strcmp(argv[i], "-B") == 0)
+        {
+            diskSchedTestFlag = true;
+        }
+        else if (strcmp(argv[i], "-FT") == 0)
+        {
+            fileConcurrencyTestFlag = true;
+        }
+        else if (strcmp(argv[i], "-DF") == 0)
+        {
+            diskFullTestFlag = true;
+        }
+        else if (strcmp(argv[i], "-layout") == 0)
+        {
+            layoutFlag = true;
+        }
+        else if (strcmp(argv[i], "-fsck") == 0)
+        {
+            checkFlag = true;
+            if (i + 1 < argc && strcmp(argv[i + 1], "-repair") == 0)
+            {
+                repairFlag = true;
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "-defrag") == 0)
+        {
+            defragFlag = true;
+        }
 #endif //FILESYS_STUB
         else if (strcmp(argv[i], "-u") == 0)
         {
@@ -305,7 +418,8 @@ int main(int argc, char **argv)
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
-            cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-l] [-D] [-B] [-FT] [-DF]\n";
+            cout << "Partial usage: nachos [-layout] [-defrag] [-fsck [-repair]]\n";
 #endif //FILESYS_STUB
         }
     }
@@ -362,6 +476,30 @@ int main(int argc, char **argv)
     {
         Print(printFileName);
     }
+    if (diskSchedTestFlag)
+    {
+        kernel->DiskSchedTest();
+    }
+    if (fileConcurrencyTestFlag)
+    {
+        kernel->FileConcurrencyTest();
+    }
+    if (diskFullTestFlag)
+    {
+        kernel->DiskFullTest();
+    }
+    if (defragFlag)
+    {
+        kernel->fileSystem->Defrag(); // prints the new layout
+    }
+    else if (layoutFlag)
+    {
+        kernel->fileSystem->Layout();
+    }
+    if (checkFlag)
+    {
+        kernel->fileSystem->Check(repairFlag);
+    }
 #endif // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
@@ -295,3 +295,87 @@ void Condition::Broadcast(Lock* conditionLock)
         Signal(conditionLock);
     }
 }
+
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a reader/writer lock.  Initially, nobody holds it.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(char* debugName)
+{
+    name = debugName;
+    lock = new Lock("rwlock");
+    readable = new Condition("rwlock readable");
+    writable = new Condition("rwlock writable");
+    readers = waitingWriters = 0;
+    writer = NULL;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	Deallocate a reader/writer lock.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    ASSERT(readers == 0 && writer == NULL);
+    delete writable;
+    delete readable;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead/ReleaseRead
+// 	Take the lock shared, waiting while a writer holds it or waits
+//	for it; give it back, letting a writer in after the last reader.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireRead()
+{
+    lock->Acquire();
+    while (writer != NULL || waitingWriters > 0)
+        readable->Wait(lock);
+    readers++;
+    lock->Release();
+}
+
+void RWLock::ReleaseRead()
+{
+    lock->Acquire();
+    ASSERT(readers > 0);
+    if (--readers == 0)
+        writable->Signal(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite/ReleaseWrite
+// 	Take the lock alone, waiting for the readers and any writer to
+//	leave; give it back to the next writer, or else to all the
+//	waiting readers.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireWrite()
+{
+    lock->Acquire();
+    waitingWriters++;
+    while (writer != NULL || readers > 0)
+        writable->Wait(lock);
+    waitingWriters--;
+    writer = kernel->currentThread;
+    lock->Release();
+}
+
+void RWLock::ReleaseWrite()
+{
+    lock->Acquire();
+    ASSERT(IsHeldForWrite());
+    writer = NULL;
+    if (waitingWriters > 0)
+        writable->Signal(lock);
+    else
+        readable->Broadcast(lock);
+    lock->Release();
+}
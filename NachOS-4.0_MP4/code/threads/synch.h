@@ -1,8 +1,9 @@
 // synch.h 
 //	Data structures for synchronizing threads.
 //
-//	Three kinds of synchronization are defined here: semaphores,
-//	locks, and condition variables.  The implementation for
+//	Four kinds of synchronization are defined here: semaphores,
+//	locks, condition variables, and reader/writer locks built
+//	out of the last two.  The implementation for
 //	semaphores is given; for the latter two, only the procedure
 //	interface is given -- they are to be implemented as part of 
 //	the first assignment.
@@ -141,4 +142,40 @@ class Condition {
     char* name;
     List<Semaphore *> *waitQueue;	// list of waiting threads
 };
+
+// The following class defines a "reader/writer lock".  Any number of
+// readers may hold it at once, or a single writer:
+//
+//	AcquireRead/ReleaseRead -- share the lock with other readers
+//
+//	AcquireWrite/ReleaseWrite -- hold the lock alone
+//
+// A writer that is waiting keeps new readers out, so a steady stream
+// of readers cannot starve it.  The lock is not recursive: a thread
+// holding it must not acquire it again, in either mode.
+
+class RWLock {
+  public:
+    RWLock(char* debugName);		// initialize lock to be FREE
+    ~RWLock();				// deallocate lock
+    char* getName() { return name; }	// debugging assist
+
+    void AcquireRead();
+    void ReleaseRead();
+    void AcquireWrite();
+    void ReleaseWrite();
+
+    bool IsHeldForWrite() { return writer == kernel->currentThread; }
+				// return true if the current thread
+				// holds this lock as the writer
+
+  private:
+    char *name;			// debugging assist
+    Lock *lock;			// protects the fields below
+    Condition *readable;	// signalled when readers may go in
+    Condition *writable;	// signalled when a writer may go in
+    int readers;		// threads holding the lock to read
+    int waitingWriters;		// threads waiting to write
+    Thread *writer;		// thread holding the lock to write, if any
+};
 #endif // SYNCH_H
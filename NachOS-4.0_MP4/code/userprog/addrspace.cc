@@ -20,6 +20,7 @@
 #include "addrspace.h"
 #include "machine.h"
 #include "noff.h"
+#include "synchconsole.h"
 
 //----------------------------------------------------------------------
 // SwapHeader
@@ -59,26 +60,31 @@ SwapHeader (NoffHeader *noffH)
 
 //----------------------------------------------------------------------
 // AddrSpace::AddrSpace
-// 	Create an address space to run a user program.
-//	Set up the translation from program memory to physical 
-//	memory.  For now, this is really simple (1:1), since we are
-//	only uniprogramming, and we have a single unsegmented page table
+// 	Create an address space to run a user program.  It has no
+//	memory until a program is loaded into it: then each of its pages
+//	gets a physical page of its own, so that programs running at the
+//	same time don't overwrite each other.
 //----------------------------------------------------------------------
 
+int AddrSpace::nextASID = 0;
+AddrSpace *AddrSpace::asidOwner[NumASIDs];
+bool AddrSpace::usedPhysPage[NumPhysPages];
+int AddrSpace::numFreePages = NumPhysPages;
+
 AddrSpace::AddrSpace()
 {
-    pageTable = new TranslationEntry[NumPhysPages];
-    for (int i = 0; i < NumPhysPages; i++) {
-	pageTable[i].virtualPage = i;	// for now, virt page # = phys page #
-	pageTable[i].physicalPage = i;
-	pageTable[i].valid = TRUE;
-	pageTable[i].use = FALSE;
-	pageTable[i].dirty = FALSE;
-	pageTable[i].readOnly = FALSE;  
-    }
-    
-    // zero out the entire address space
-    bzero(kernel->machine->mainMemory, MemorySize);
+    pageTable = NULL;
+    numPages = 0;
+
+    // tags are reused round robin; RestoreState flushes whatever
+    // entries the tag's last owner left in the TLB
+    asid = nextASID;
+    nextASID = (nextASID + 1) % NumASIDs;
+
+#ifndef FILESYS_STUB
+    for (int i = 0; i < MaxOpenFiles; i++)
+	openFiles[i] = NULL;
+#endif
 }
 
 //----------------------------------------------------------------------
@@ -88,7 +94,18 @@ AddrSpace::AddrSpace()
 
 AddrSpace::~AddrSpace()
 {
+   if (kernel->machine->tlb != NULL && asidOwner[asid] == this) {
+	kernel->machine->tlb->FlushASID(asid);	// before the page table goes
+	asidOwner[asid] = NULL;
+   }
+   for (unsigned int i = 0; i < numPages; i++) {
+	usedPhysPage[pageTable[i].physicalPage] = FALSE;
+	numFreePages++;
+   }
    delete pageTable;
+#ifndef FILESYS_STUB
+   CloseAllFiles();
+#endif
 }
 
 
@@ -135,37 +152,54 @@ AddrSpace::Load(char *fileName)
     numPages = divRoundUp(size, PageSize);
     size = numPages * PageSize;
 
-    ASSERT(numPages <= NumPhysPages);		// check we're not trying
-						// to run anything too big --
-						// at least until we have
-						// virtual memory
+    if (numPages > (unsigned int) numFreePages) {	// check we're not
+						// trying to run anything
+						// too big -- at least until
+						// we have virtual memory
+	cerr << "Not enough memory for " << fileName << "\n";
+	numPages = 0;
+	delete executable;
+	return FALSE;
+    }
 
     DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
 
+// give each page the first free physical page, zeroed
+    pageTable = new TranslationEntry[numPages];
+    for (unsigned int i = 0, frame = 0; i < numPages; i++, frame++) {
+	while (usedPhysPage[frame])
+	    frame++;
+	usedPhysPage[frame] = TRUE;
+	numFreePages--;
+	bzero(&kernel->machine->mainMemory[frame * PageSize], PageSize);
+	pageTable[i].virtualPage = i;
+	pageTable[i].physicalPage = frame;
+	pageTable[i].valid = TRUE;
+	pageTable[i].use = FALSE;
+	pageTable[i].dirty = FALSE;
+	pageTable[i].readOnly = FALSE;  
+    }
+
 // then, copy in the code and data segments into memory
-// Note: this code assumes that virtual address = physical address
     if (noffH.code.size > 0) {
         DEBUG(dbgAddr, "Initializing code segment.");
 	DEBUG(dbgAddr, noffH.code.virtualAddr << ", " << noffH.code.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.code.virtualAddr]), 
-			noffH.code.size, noffH.code.inFileAddr);
+	LoadSegment(executable, noffH.code.virtualAddr,
+		    noffH.code.size, noffH.code.inFileAddr);
     }
     if (noffH.initData.size > 0) {
         DEBUG(dbgAddr, "Initializing data segment.");
 	DEBUG(dbgAddr, noffH.initData.virtualAddr << ", " << noffH.initData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
-			noffH.initData.size, noffH.initData.inFileAddr);
+	LoadSegment(executable, noffH.initData.virtualAddr,
+		    noffH.initData.size, noffH.initData.inFileAddr);
     }
 
 #ifdef RDATA
     if (noffH.readonlyData.size > 0) {
         DEBUG(dbgAddr, "Initializing read only data segment.");
 	DEBUG(dbgAddr, noffH.readonlyData.virtualAddr << ", " << noffH.readonlyData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
-			noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
+	LoadSegment(executable, noffH.readonlyData.virtualAddr,
+		    noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
     }
 #endif
 
@@ -173,6 +207,34 @@ AddrSpace::Load(char *fileName)
     return TRUE;			// success
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::LoadSegment
+// 	Copy "size" bytes of "executable", from "inFileAddr", to virtual
+//	address "virtAddr".  The pages need not be next to each other in
+//	physical memory, so read it all at once, and then copy it in a
+//	page at a time.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::LoadSegment(OpenFile *executable, unsigned int virtAddr,
+		       int size, int inFileAddr)
+{
+    char *buffer = new char[size];
+    unsigned int vpn;
+    int done, length;
+
+    executable->ReadAt(buffer, size, inFileAddr);
+    for (done = 0; done < size; done += length, virtAddr += length) {
+	vpn = virtAddr / PageSize;
+	ASSERT(vpn < numPages);
+	length = min(size - done, (int) (PageSize - virtAddr % PageSize));
+	bcopy(buffer + done, &kernel->machine->mainMemory[
+		pageTable[vpn].physicalPage * PageSize + virtAddr % PageSize],
+		length);
+    }
+    delete [] buffer;
+}
+
 //----------------------------------------------------------------------
 // AddrSpace::Execute
 // 	Run a user program using the current thread
@@ -251,13 +313,51 @@ void AddrSpace::SaveState()
 // 	On a context switch, restore the machine state so that
 //	this address space can run.
 //
-//      For now, tell the machine where to find the page table.
+//      For now, tell the machine where to find the page table, and
+//	have it forget the translations it kept from the last one.
+//
+//	With a TLB, the machine has no page table: only the ASID changes,
+//	and the entries of other address spaces stay in the TLB.  They
+//	only have to go if they were loaded for an earlier owner of this
+//	space's tag.
 //----------------------------------------------------------------------
 
 void AddrSpace::RestoreState() 
 {
-    kernel->machine->pageTable = pageTable;
-    kernel->machine->pageTableSize = numPages;
+    TLB *tlb = kernel->machine->tlb;
+
+    if (tlb != NULL) {
+	if (asidOwner[asid] != this) {
+	    tlb->FlushASID(asid);
+	    asidOwner[asid] = this;
+	}
+	tlb->SetASID(asid);
+    } else {
+	kernel->machine->pageTable = pageTable;
+	kernel->machine->pageTableSize = numPages;
+    }
+    kernel->machine->FlushMemCache();
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::RefillTLB
+// 	Handle a TLB miss at _vaddr_: load its page table entry into the
+//	TLB, so that the instruction that missed can be tried again.
+//	Return FALSE if the page isn't in the address space, or isn't
+//	valid -- a real page fault.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::RefillTLB(unsigned int vaddr)
+{
+    unsigned int vpn = vaddr / PageSize;
+
+    if (vpn >= numPages || !pageTable[vpn].valid)
+	return FALSE;
+    DEBUG(dbgAddr, "TLB refill, virtual page " << vpn);
+    kernel->stats->numTLBMisses++;
+    kernel->machine->tlb->Refill(&pageTable[vpn]);
+    return TRUE;
 }
 
 
@@ -311,6 +411,200 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
     return NoException;
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::ReadString
+// 	Copy the null-terminated string at "vaddr" in user memory into
+//	"buffer", which holds "size" bytes.  The pages it is on need not
+//	be next to each other in physical memory, so each byte is
+//	translated.  Return FALSE if the string runs into an address that
+//	is not legal, or doesn't fit.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::ReadString(unsigned int vaddr, char *buffer, int size)
+{
+    unsigned int paddr;
+
+    for (int i = 0; i < size; i++) {
+	if (Translate(vaddr + i, &paddr, 0) != NoException)
+	    return FALSE;
+	if ((buffer[i] = kernel->machine->mainMemory[paddr]) == '\0')
+	    return TRUE;
+    }
+    return FALSE;
+}
 
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// AddrSpace::AddOpenFile
+// 	Enter "file" into this program's open-file table and return its
+//	OpenFileId, or -1 if the table is full.  Ids below FirstFileId
+//	stand for the console (see syscall.h).
+//----------------------------------------------------------------------
 
+OpenFileId
+AddrSpace::AddOpenFile(OpenFile *file)
+{
+    for (int id = FirstFileId; id < MaxOpenFiles; id++)
+	if (openFiles[id] == NULL) {
+	    openFiles[id] = file;
+	    return id;
+	}
+    return -1;
+}
 
+//----------------------------------------------------------------------
+// AddrSpace::GetOpenFile
+// 	Return the file open as "id", or NULL if "id" is not a file
+//	this program has open.
+//----------------------------------------------------------------------
+
+OpenFile *
+AddrSpace::GetOpenFile(OpenFileId id)
+{
+    if (id < 0 || id >= MaxOpenFiles)
+	return NULL;
+    return openFiles[id];
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CloseOpenFile
+// 	Close the file open as "id".  Return FALSE if it was not open.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CloseOpenFile(OpenFileId id)
+{
+    OpenFile *file = GetOpenFile(id);
+
+    if (file == NULL)
+	return FALSE;
+    openFiles[id] = NULL;
+    delete file;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CloseAllFiles
+// 	Close every file the program still has open, as when it exits.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::CloseAllFiles()
+{
+    for (int id = 0; id < MaxOpenFiles; id++)
+	(void) CloseOpenFile(id);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UserRun
+// 	Translate the user buffer at "vaddr", a page at a time, for as
+//	long as its pages sit back to back in physical memory.  Set
+//	"run" to where that piece starts in mainMemory and return its
+//	length (at most "size"), or -1 if "vaddr" is not a legal address.
+//
+//	"writing" is TRUE if the kernel is going to store into the buffer.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::UserRun(unsigned int vaddr, int size, bool writing, char **run)
+{
+    unsigned int paddr, next;
+    int length;
+
+    if (Translate(vaddr, &paddr, writing) != NoException)
+	return -1;
+    *run = &kernel->machine->mainMemory[paddr];
+    length = min(size, (int) (PageSize - vaddr % PageSize));
+    while (length < size) {
+	if (Translate(vaddr + length, &next, writing) != NoException ||
+	    next != paddr + length)
+	    break;
+	length = min(size, length + PageSize);
+    }
+    return length;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ReadFile/WriteFile
+// 	Move "size" bytes between "file", at its current position, and
+//	the user buffer at "vaddr".  The buffer is translated page by
+//	page, and each physically contiguous piece of it is handed to the
+//	file system directly, so the data never passes through a kernel
+//	buffer.  Return the number of bytes transferred, or -1 if the
+//	buffer does not start at a legal address.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::ReadFile(OpenFile *file, unsigned int vaddr, int size)
+{
+    int done = 0, length, result;
+    char *run;
+
+    while (done < size) {
+	if ((length = UserRun(vaddr + done, size - done, TRUE, &run)) < 0)
+	    return (done > 0) ? done : -1;
+	result = file->Read(run, length);
+	done += result;
+	if (result < length)		// end of file
+	    break;
+    }
+    return done;
+}
+
+int
+AddrSpace::WriteFile(OpenFile *file, unsigned int vaddr, int size)
+{
+    int done = 0, length, result;
+    char *run;
+
+    while (done < size) {
+	if ((length = UserRun(vaddr + done, size - done, FALSE, &run)) < 0)
+	    return (done > 0) ? done : -1;
+	result = file->Write(run, length);
+	done += result;
+	if (result < length)		// end of file
+	    break;
+    }
+    return done;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ReadConsole/WriteConsole
+// 	Same as ReadFile/WriteFile, for the console: each physically
+//	contiguous piece of the user buffer goes to the display in one
+//	PutString.  A read stops at the end of the first line.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::ReadConsole(unsigned int vaddr, int size)
+{
+    int done = 0, length, result;
+    char *run;
+
+    while (done < size) {
+	if ((length = UserRun(vaddr + done, size - done, TRUE, &run)) < 0)
+	    return (done > 0) ? done : -1;
+	result = kernel->synchConsoleIn->GetLine(run, length);
+	done += result;
+	if (result < length || run[result - 1] == '\n')
+	    break;			// end of the line, or EOF
+    }
+    return done;
+}
+
+int
+AddrSpace::WriteConsole(unsigned int vaddr, int size)
+{
+    int done = 0, length;
+    char *run;
+
+    while (done < size) {
+	if ((length = UserRun(vaddr + done, size - done, FALSE, &run)) < 0)
+	    return (done > 0) ? done : -1;
+	kernel->synchConsoleOut->PutString(run, length);
+	done += length;
+    }
+    return done;
+}
+#endif // FILESYS_STUB
@@ -15,8 +15,13 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "tlb.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
+#define MaxOpenFiles		20	// open files per address space,
+					// including the console ids
+#define FirstFileId		2	// SysConsoleInput and SysConsoleOutput
+					// come first (see syscall.h)
 
 class AddrSpace {
   public:
@@ -34,20 +39,70 @@ class AddrSpace {
     void SaveState();			// Save/restore address space-specific
     void RestoreState();		// info on a context switch 
 
+    bool RefillTLB(unsigned int vaddr);	// Load the translation of _vaddr_
+					// into the TLB, after a miss;
+					// FALSE if there is none
+
     // Translate virtual address _vaddr_
     // to physical address _paddr_. _mode_
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    bool ReadString(unsigned int vaddr, char *buffer, int size);
+					// Copy a string argument of a system
+					// call out of user memory; FALSE if
+					// it isn't all there, or too long
+
+#ifndef FILESYS_STUB
+    OpenFileId AddOpenFile(OpenFile *file); // Give "file" an id, -1 if
+					// the table is full
+    OpenFile *GetOpenFile(OpenFileId id); // NULL if "id" is not open
+    bool CloseOpenFile(OpenFileId id);	// Close one file
+    void CloseAllFiles();		// Close everything, at exit
+
+    int ReadFile(OpenFile *file, unsigned int vaddr, int size);
+					// Read from "file" into user memory
+    int WriteFile(OpenFile *file, unsigned int vaddr, int size);
+					// Write user memory out to "file"
+    int ReadConsole(unsigned int vaddr, int size);
+					// Read a line from the console
+					// into user memory
+    int WriteConsole(unsigned int vaddr, int size);
+					// Write user memory to the console
+#endif
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    int asid;				// Tags this space's entries in the
+					// TLB, if there is one
+
+    static int nextASID;		// the next tag to hand out
+    static AddrSpace *asidOwner[NumASIDs]; // the space whose entries
+					// each tag marks in the TLB now
+
+    static bool usedPhysPage[NumPhysPages]; // pages some space has
+    static int numFreePages;		// how many no space has
+
+    void LoadSegment(OpenFile *executable, unsigned int virtAddr,
+		     int size, int inFileAddr);
+					// Copy part of the program into
+					// the pages it goes in
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
 
+#ifndef FILESYS_STUB
+    int UserRun(unsigned int vaddr, int size, bool writing, char **run);
+					// Find the physically contiguous
+					// piece of a user buffer at "vaddr"
+
+    OpenFile *openFiles[MaxOpenFiles];	// Files this program has open,
+					// indexed by OpenFileId
+#endif
+
 };
 
 #endif // ADDRSPACE_H
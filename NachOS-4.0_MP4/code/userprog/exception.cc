@@ -25,6 +25,10 @@
 #include "main.h"
 #include "syscall.h"
 #include "ksyscall.h"
+
+#define MaxStringArg 256	// longest string a system call takes,
+				// with the trailing '\0'
+
 //----------------------------------------------------------------------
 // ExceptionHandler
 // 	Entry point into the Nachos kernel.  Called when a user program
@@ -69,8 +73,9 @@ void ExceptionHandler(ExceptionType which)
 			DEBUG(dbgSys, "Message received.\n");
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *msg = &(kernel->machine->mainMemory[val]);
-				cout << msg << endl;
+				char msg[MaxStringArg];
+				if (kernel->currentThread->space->ReadString(val, msg, MaxStringArg))
+					cout << msg << endl;
 			}
 			SysHalt();
 			ASSERTNOTREACHED();
@@ -80,9 +85,10 @@ void ExceptionHandler(ExceptionType which)
 		case SC_Create:
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *filename = &(kernel->machine->mainMemory[val]);
+				char filename[MaxStringArg];
 				//cout << filename << endl;
-				status = SysCreate(filename);
+				status = kernel->currentThread->space->ReadString(val, filename, MaxStringArg) &&
+						 SysCreate(filename);
 
 				kernel->machine->WriteRegister(2, (int)status);
 			}
@@ -97,11 +103,12 @@ void ExceptionHandler(ExceptionType which)
 		case SC_Create:
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *filename = &(kernel->machine->mainMemory[val]);
+				char filename[MaxStringArg];
 				// TODO
 				int size = kernel->machine->ReadRegister(5);
 				//cout << filename << endl;
-				status = SysCreate(filename, size);
+				status = kernel->currentThread->space->ReadString(val, filename, MaxStringArg) &&
+						 SysCreate(filename, size);
 
 				kernel->machine->WriteRegister(2, (int)status);
 			}
@@ -116,8 +123,7 @@ void ExceptionHandler(ExceptionType which)
 			{
 				int size = kernel->machine->ReadRegister(5);
 				OpenFileId id = kernel->machine->ReadRegister(6);
-				char *buffer = &(kernel->machine->mainMemory[val]);
-				status = SysRead(buffer, size, id);
+				status = SysRead(val, size, id);
 				kernel->machine->WriteRegister(2, (int) status);
             }
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -131,8 +137,7 @@ void ExceptionHandler(ExceptionType which)
 			{
 				int size = kernel->machine->ReadRegister(5);
 				OpenFileId id = kernel->machine->ReadRegister(6);
-				char *buffer = &(kernel->machine->mainMemory[val]);
-				status = SysWrite(buffer, size, id);
+				status = SysWrite(val, size, id);
 				kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -144,8 +149,11 @@ void ExceptionHandler(ExceptionType which)
 	    case SC_Open:
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *name = &(kernel->machine->mainMemory[val]);
-				status = SysOpen(name);
+				char name[MaxStringArg];
+				if (kernel->currentThread->space->ReadString(val, name, MaxStringArg))
+					status = SysOpen(name);
+				else
+					status = -1;
 				kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -196,6 +204,9 @@ void ExceptionHandler(ExceptionType which)
 			DEBUG(dbgAddr, "Program exit\n");
 			val = kernel->machine->ReadRegister(4);
 			cout << "return value:" << val << endl;
+#ifndef FILESYS_STUB
+			kernel->currentThread->space->CloseAllFiles();
+#endif
 			kernel->currentThread->Finish();
 			break;
 		default:
@@ -203,6 +214,15 @@ void ExceptionHandler(ExceptionType which)
 			break;
 		}
 		break;
+	case PageFaultException:
+		// with a TLB, usually just a miss: refill, and try the
+		// instruction again
+		if (kernel->machine->tlb != NULL &&
+			kernel->currentThread->space->RefillTLB(
+				(unsigned)kernel->machine->ReadRegister(BadVAddrReg)))
+			return;
+		cerr << "Unexpected user mode exception " << (int)which << "\n";
+		break;
 	default:
 		cerr << "Unexpected user mode exception " << (int)which << "\n";
 		break;
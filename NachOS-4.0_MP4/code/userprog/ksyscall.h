@@ -44,17 +44,20 @@ int SysCreate(char *filename, int size)
 	return kernel->fileSystem->Create(filename, size);
 }
 
-int SysRead(char *buffer, int size, OpenFileId id)
+int SysRead(int buffer, int size, OpenFileId id)
 { 
+	if (id == SysConsoleInput)
+		return kernel->currentThread->space->ReadConsole(buffer, size);
 	return kernel->fileSystem->ReadFile(buffer, size, id);
 }
 
-int SysWrite(char *buffer, int size, OpenFileId id)
+int SysWrite(int buffer, int size, OpenFileId id)
 {
+	if (id == SysConsoleOutput)
+		return kernel->currentThread->space->WriteConsole(buffer, size);
         return kernel->fileSystem->WriteFile(buffer, size, id);
 }
 
-//When you finish the function "OpenAFile", you can remove the comment below.
 
 OpenFileId SysOpen(char *name)
 {
@@ -15,13 +15,15 @@
 //
 //      "inputFile" -- if NULL, use stdin as console device
 //              otherwise, read from this file
+//      "bufferSize" -- how many characters the device takes in at once
 //----------------------------------------------------------------------
 
-SynchConsoleInput::SynchConsoleInput(char *inputFile)
+SynchConsoleInput::SynchConsoleInput(char *inputFile, int bufferSize)
 {
-    consoleInput = new ConsoleInput(inputFile, this);
+    consoleInput = new ConsoleInput(inputFile, this, bufferSize);
     lock = new Lock("console in");
     waitFor = new Semaphore("console in", 0);
+    ready = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -47,12 +49,57 @@ SynchConsoleInput::GetChar()
     char ch;
 
     lock->Acquire();
-    waitFor->P();	// wait for EOF or a char to be available.
-    ch = consoleInput->GetChar();
+    ch = NextChar();
     lock->Release();
     return ch;
 }
 
+//----------------------------------------------------------------------
+// SynchConsoleInput::GetLine
+//      Read characters typed at the keyboard into "data", until the
+//	end of the line (the newline is kept), until there are "size"
+//	of them, or until EOF.  Return how many were read.
+//
+//	Only the first character may have to wait: with a buffered
+//	device, the rest of a line usually came in with it.
+//----------------------------------------------------------------------
+
+int
+SynchConsoleInput::GetLine(char *data, int size)
+{
+    int done = 0;
+    char ch;
+
+    lock->Acquire();
+    while (done < size) {
+	if ((ch = NextChar()) == EOF)
+	    break;
+	data[done++] = ch;
+	if (ch == '\n')
+	    break;
+    }
+    lock->Release();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleInput::NextChar
+//      Read a character, waiting for the device to call back only if
+//	it has none left from the last time it did.
+//----------------------------------------------------------------------
+
+char
+SynchConsoleInput::NextChar()
+{
+    char ch;
+
+    if (!ready)
+	waitFor->P();	// wait for EOF or a char to be available.
+    ch = consoleInput->GetChar();
+    ready = (consoleInput->NumAvail() > 0);
+    return ch;
+}
+
 //----------------------------------------------------------------------
 // SynchConsoleInput::CallBack
 //      Interrupt handler called when keystroke is hit; wake up
@@ -71,11 +118,12 @@ SynchConsoleInput::CallBack()
 //
 //      "outputFile" -- if NULL, use stdout as console device
 //              otherwise, read from this file
+//      "bufferSize" -- how many characters the device sends at once
 //----------------------------------------------------------------------
 
-SynchConsoleOutput::SynchConsoleOutput(char *outputFile)
+SynchConsoleOutput::SynchConsoleOutput(char *outputFile, int bufferSize)
 {
-    consoleOutput = new ConsoleOutput(outputFile, this);
+    consoleOutput = new ConsoleOutput(outputFile, this, bufferSize);
     lock = new Lock("console out");
     waitFor = new Semaphore("console out", 0);
 }
@@ -106,6 +154,25 @@ SynchConsoleOutput::PutChar(char ch)
     lock->Release();
 }
 
+//----------------------------------------------------------------------
+// SynchConsoleOutput::PutString
+//      Write "length" characters to the console display, as few
+//	device writes as the buffer allows, waiting for each.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleOutput::PutString(char *data, int length)
+{
+    int done = 0;
+
+    lock->Acquire();
+    while (done < length) {
+	done += consoleOutput->PutChars(data + done, length - done);
+	waitFor->P();
+    }
+    lock->Release();
+}
+
 //----------------------------------------------------------------------
 // SynchConsoleOutput::CallBack
 //      Interrupt handler called when it's safe to send the next 
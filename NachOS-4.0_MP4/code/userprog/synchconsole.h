@@ -22,27 +22,40 @@
 
 class SynchConsoleInput : public CallBackObj {
   public:
-    SynchConsoleInput(char *inputFile); // Initialize the console device
+    SynchConsoleInput(char *inputFile, int bufferSize = 1);
+				// Initialize the console device
     ~SynchConsoleInput();		// Deallocate console device
 	
 	void Disable() { consoleInput->Disable(); }// 2015.11.25
 
     char GetChar();		// Read a character, waiting if necessary
+    int GetLine(char *data, int size);
+				// Read up to "size" characters, up to
+				// and including the end of the line;
+				// return how many (fewer at EOF)
     
   private:
     ConsoleInput *consoleInput;	// the hardware keyboard
     Lock *lock;			// only one reader at a time
     Semaphore *waitFor;		// wait for callBack
+    bool ready;			// callBack came for the characters
+				// the keyboard has now, if any
+
+    char NextChar();		// GetChar, with the lock held
 
     void CallBack();		// called when a keystroke is available
 };
 
 class SynchConsoleOutput : public CallBackObj {
   public:
-    SynchConsoleOutput(char *outputFile); // Initialize the console device
+    SynchConsoleOutput(char *outputFile, int bufferSize = 1);
+				// Initialize the console device
     ~SynchConsoleOutput();
 
     void PutChar(char ch);	// Write a character, waiting if necessary
+    void PutString(char *data, int length);
+				// Write "length" characters, a buffer
+				// full at a time
    
   private:
     ConsoleOutput *consoleOutput;// the hardware display